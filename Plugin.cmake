@@ -27,6 +27,8 @@ set(OCPN_TEST_REPO
 #    "Default repository for tagged builds not matching 'beta'"
 #)
 
+option(OTIDALROUTE_TESTS "Build the numerical tests, run them with ctest" OFF)
+
 #
 #
 # -------  Plugin setup --------
@@ -58,6 +60,8 @@ set(SRC
         src/GribRecord.cpp
         src/GribRecord.h
         src/GribRecordSet.h
+        src/GribCurrentCache.cpp
+        src/GribCurrentCache.h
         src/otidalroute_pi.h
         src/otidalroute_pi.cpp
         src/otidalrouteOverlayFactory.cpp
@@ -72,6 +76,24 @@ set(SRC
         src/tcmgr.h
         src/NavFunc.cpp
         src/NavFunc.h
+        src/TidalPassageEngine.cpp
+        src/TidalPassageEngine.h
+        src/DepartureSweep.cpp
+        src/DepartureSweep.h
+        src/DepartureSolver.cpp
+        src/DepartureSolver.h
+        src/CurrentCube.cpp
+        src/CurrentCube.h
+        src/GribCurrentReader.cpp
+        src/GribCurrentReader.h
+        src/MappedFile.cpp
+        src/MappedFile.h
+        src/StationIndex.cpp
+        src/StationIndex.h
+        src/StationCurrentField.cpp
+        src/StationCurrentField.h
+        src/GlyphAtlas.cpp
+        src/GlyphAtlas.h
         src/routeprop.cpp
         src/routeprop.h
         src/tableroutes.cpp
@@ -88,6 +110,9 @@ endmacro ()
 
 macro(add_plugin_libraries)
   # Add libraries required by this plugin
+  find_package(Threads REQUIRED)
+  target_link_libraries(${PACKAGE_NAME} Threads::Threads)
+
   add_subdirectory("${CMAKE_SOURCE_DIR}/opencpn-libs/tinyxml")
   target_link_libraries(${PACKAGE_NAME} ocpn::tinyxml)
 
@@ -0,0 +1,291 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  otidalroute Plugin
+ * Author:   Mike Rossiter
+ *
+ ***************************************************************************
+ *   Copyright (C) 2016 by Mike Rossiter  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+
+#include "CurrentCube.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// Cube file layout, in the byte order of the machine that wrote it:
+//   header, time index (int64 seconds), u planes, v planes
+// Each plane is one step of nlat x nlon values, longitude fastest, float32
+// (NaN for no data) or int16 (INT16_MIN for no data). The sections start
+// on 8 byte boundaries so they can be used in place.
+struct CubeFileHeader {
+  char magic[8];  // "OTRCUBE"
+  uint32_t version;
+  uint32_t format;  // CUBE_FLOAT32 or CUBE_INT16
+  int32_t nlat, nlon, ntimes;
+  uint32_t byteOrder;  // CUBE_BYTE_ORDER as written
+  double lat0, lon0, dlat, dlon;
+  double scale;          // m/s per int16 step
+  uint64_t times, u, v;  // file offsets of the sections
+};
+
+static const char CUBE_MAGIC[8] = "OTRCUBE";
+static const uint32_t CUBE_VERSION = 1;
+static const uint32_t CUBE_BYTE_ORDER = 0x01020304;
+enum { CUBE_FLOAT32, CUBE_INT16 };
+
+static uint64_t Align8(uint64_t offset) { return (offset + 7) & ~(uint64_t)7; }
+
+// Pads the file from pos up to offset, then writes the section there
+static bool WriteAt(FILE* f, uint64_t& pos, uint64_t offset, const void* data,
+                    size_t bytes) {
+  static const char pad[8] = {0};
+  if (offset < pos || offset - pos > sizeof pad ||
+      fwrite(pad, 1, offset - pos, f) != offset - pos ||
+      fwrite(data, 1, bytes, f) != bytes)
+    return false;
+  pos = offset + bytes;
+  return true;
+}
+
+// Same as interp_angle in GribRecord.cpp
+static double InterpAngle(double a0, double a1, double d) {
+  if (a0 - a1 > M_PI)
+    a0 -= 2 * M_PI;
+  else if (a1 - a0 > M_PI)
+    a1 -= 2 * M_PI;
+  double a = (1 - d) * a0 + d * a1;
+  if (a < -M_PI) a += 2 * M_PI;
+  return a;
+}
+
+CurrentCube::CurrentCube()
+    : m_NLat(0),
+      m_NLon(0),
+      m_Fallback(NULL),
+      m_BuildMs(0),
+      m_Lat0(0),
+      m_Lon0(0),
+      m_DLat(1),
+      m_DLon(1),
+      m_FU(NULL),
+      m_FV(NULL),
+      m_QU(NULL),
+      m_QV(NULL),
+      m_Scale(0) {}
+
+void CurrentCube::Init(double lat0, double lon0, double dlat, double dlon,
+                       int nlat, int nlon, const std::vector<time_t>& times) {
+  m_Lat0 = lat0;
+  m_Lon0 = lon0;
+  m_DLat = dlat;
+  m_DLon = dlon;
+  m_NLat = nlat;
+  m_NLon = nlon;
+  m_Times = times;
+
+  size_t size = times.size() * nlat * nlon;
+  m_U.assign(size, NAN);
+  m_V.assign(size, NAN);
+
+  m_File.Close();
+  m_FU = m_U.data();
+  m_FV = m_V.data();
+  m_QU = m_QV = NULL;
+  m_Scale = 0;
+}
+
+bool CurrentCube::Save(const std::string& filename, bool quantise) const {
+  if (m_Times.empty()) return false;
+
+  size_t n = (size_t)m_Times.size() * m_NLat * m_NLon;
+  size_t valueSize = quantise ? sizeof(int16_t) : sizeof(float);
+
+  CubeFileHeader h;
+  memset(&h, 0, sizeof h);
+  memcpy(h.magic, CUBE_MAGIC, sizeof h.magic);
+  h.version = CUBE_VERSION;
+  h.format = quantise ? CUBE_INT16 : CUBE_FLOAT32;
+  h.nlat = m_NLat;
+  h.nlon = m_NLon;
+  h.ntimes = m_Times.size();
+  h.byteOrder = CUBE_BYTE_ORDER;
+  h.lat0 = m_Lat0;
+  h.lon0 = m_Lon0;
+  h.dlat = m_DLat;
+  h.dlon = m_DLon;
+  h.times = Align8(sizeof h);
+  h.u = Align8(h.times + m_Times.size() * sizeof(int64_t));
+  h.v = Align8(h.u + n * valueSize);
+
+  std::vector<int16_t> qu, qv;
+  if (quantise) {
+    double max = 0;
+    for (size_t k = 0; k < n; k++) {
+      double u, v;
+      if (Node(k, u, v)) max = std::max(max, std::max(fabs(u), fabs(v)));
+    }
+    h.scale = max > 0 ? max / INT16_MAX : 1;
+
+    qu.resize(n);
+    qv.resize(n);
+    for (size_t k = 0; k < n; k++) {
+      double u, v;
+      if (Node(k, u, v)) {
+        qu[k] = (int16_t)lround(u / h.scale);
+        qv[k] = (int16_t)lround(v / h.scale);
+      } else
+        qu[k] = qv[k] = INT16_MIN;
+    }
+  }
+
+  std::vector<int64_t> times(m_Times.begin(), m_Times.end());
+  const void* u = quantise ? (const void*)qu.data() : (const void*)m_FU;
+  const void* v = quantise ? (const void*)qv.data() : (const void*)m_FV;
+
+  FILE* f = fopen(filename.c_str(), "wb");
+  if (!f) return false;
+  uint64_t pos = 0;
+  bool ok = WriteAt(f, pos, 0, &h, sizeof h) &&
+            WriteAt(f, pos, h.times, times.data(),
+                    times.size() * sizeof(int64_t)) &&
+            WriteAt(f, pos, h.u, u, n * valueSize) &&
+            WriteAt(f, pos, h.v, v, n * valueSize);
+  if (fclose(f) != 0) ok = false;
+  if (!ok) remove(filename.c_str());
+  return ok;
+}
+
+bool CurrentCube::Map(const std::string& filename) {
+  Init(0, 0, 1, 1, 0, 0, std::vector<time_t>());
+  if (!m_File.Open(filename)) return false;
+
+  const unsigned char* data = m_File.Data();
+  size_t size = m_File.Size();
+  CubeFileHeader h;
+  if (size < sizeof h) {
+    m_File.Close();
+    return false;
+  }
+  memcpy(&h, data, sizeof h);
+
+  size_t valueSize = h.format == CUBE_INT16 ? sizeof(int16_t) : sizeof(float);
+  uint64_t n = (uint64_t)h.ntimes * h.nlat * h.nlon;
+  bool ok = memcmp(h.magic, CUBE_MAGIC, sizeof h.magic) == 0 &&
+            h.version == CUBE_VERSION && h.byteOrder == CUBE_BYTE_ORDER &&
+            (h.format == CUBE_FLOAT32 || h.format == CUBE_INT16) &&
+            h.nlat > 0 && h.nlon > 0 && h.ntimes > 0 && h.dlat != 0 &&
+            h.dlon != 0 && h.times % 8 == 0 && h.u % 8 == 0 &&
+            h.v % 8 == 0 && h.times + h.ntimes * sizeof(int64_t) <= size &&
+            h.u + n * valueSize <= size && h.v + n * valueSize <= size;
+  if (!ok) {
+    m_File.Close();
+    return false;
+  }
+
+  m_Lat0 = h.lat0;
+  m_Lon0 = h.lon0;
+  m_DLat = h.dlat;
+  m_DLon = h.dlon;
+  m_NLat = h.nlat;
+  m_NLon = h.nlon;
+
+  const int64_t* times = (const int64_t*)(data + h.times);
+  m_Times.assign(times, times + h.ntimes);
+
+  if (h.format == CUBE_INT16) {
+    m_QU = (const int16_t*)(data + h.u);
+    m_QV = (const int16_t*)(data + h.v);
+    m_Scale = h.scale;
+    m_FU = m_FV = NULL;
+  } else {
+    m_FU = (const float*)(data + h.u);
+    m_FV = (const float*)(data + h.v);
+  }
+  return true;
+}
+
+// Rate and direction (radians, towards) at grid coordinates pi, pj for
+// step k. The pseudo hermite weights and the polar interpolation are those
+// of GribRecord::getInterpolatedValues, which needs all four corners.
+bool CurrentCube::Step(int k, double pi, double pj, double& m,
+                       double& a) const {
+  int i0 = (int)pi, j0 = (int)pj;
+  int i1 = i0 + 1 < m_NLon ? i0 + 1 : i0;
+  int j1 = j0 + 1 < m_NLat ? j0 + 1 : j0;
+
+  double dx = pi - i0, dy = pj - j0;
+  dx = (3.0 - 2.0 * dx) * dx * dx;
+  dy = (3.0 - 2.0 * dy) * dy * dy;
+
+  const int ci[4] = {i0, i1, i0, i1}, cj[4] = {j0, j0, j1, j1};
+  double cm[4], ca[4];
+  for (int c = 0; c < 4; c++) {
+    double u, v;
+    if (!Node(Index(k, cj[c], ci[c]), u, v)) return false;
+    cm[c] = sqrt(u * u + v * v);
+    ca[c] = atan2(u, v);
+  }
+
+  double m0 = (1 - dx) * cm[0] + dx * cm[1], a0 = InterpAngle(ca[0], ca[1], dx);
+  double m1 = (1 - dx) * cm[2] + dx * cm[3], a1 = InterpAngle(ca[2], ca[3], dx);
+
+  m = (1 - dy) * m0 + dy * m1;
+  a = InterpAngle(a0, a1, dy);
+  return true;
+}
+
+bool CurrentCube::GetCurrent(time_t t, double lat, double lon, double& rate,
+                             double& set) {
+  if (m_Times.empty() || t < m_Times.front() || t > m_Times.back())
+    return m_Fallback && m_Fallback->GetCurrent(t, lat, lon, rate, set);
+
+  double pj = (lat - m_Lat0) / m_DLat;
+  double pi = (lon - m_Lon0) / m_DLon;
+  if (pi < 0) pi += 360 / fabs(m_DLon);  // the cube may be in 0-360
+  if (pj < 0 || pj > m_NLat - 1 || pi < 0 || pi > m_NLon - 1)
+    return m_Fallback && m_Fallback->GetCurrent(t, lat, lon, rate, set);
+
+  // Forecast steps either side of t
+  int k2 = std::upper_bound(m_Times.begin(), m_Times.end(), t) -
+           m_Times.begin();
+  int k1 = k2 - 1;
+  if (k2 == (int)m_Times.size()) k2 = k1;  // t is the last step
+
+  double m1, a1;
+  if (!Step(k1, pi, pj, m1, a1)) return false;
+
+  double m = m1, a = a1;
+  if (k2 != k1 && t != m_Times[k1]) {
+    double m2, a2;
+    if (!Step(k2, pi, pj, m2, a2)) return false;
+
+    double d = (double)(t - m_Times[k1]) / (m_Times[k2] - m_Times[k1]);
+    m = (1 - d) * m1 + d * m2;
+    a = InterpAngle(a1, a2, d);
+  }
+
+  rate = m * 3.6 / 1.852;  // knots
+  set = a * 180 / M_PI;
+  if (set < 0) set += 360;
+  return true;
+}
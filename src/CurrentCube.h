@@ -0,0 +1,119 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  otidalroute Plugin
+ * Author:   Mike Rossiter
+ *
+ ***************************************************************************
+ *   Copyright (C) 2016 by Mike Rossiter  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+
+#ifndef _CURRENTCUBE_H_
+#define _CURRENTCUBE_H_
+
+#include <math.h>
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include "MappedFile.h"
+#include "TidalPassageEngine.h"
+
+// The sea current of the GRIB file in a corridor around the route, packed
+// as float u/v (east/north, m/s) for every forecast step in a contiguous
+// time x lat x lon cube. The cube is filled once on the GUI thread before
+// the passages are run. It is not modified afterwards, so worker threads
+// may sample it at the same time.
+//
+// Interpolation matches GribRecord::getInterpolatedValues in space and the
+// blend between forecast steps in otidalrouteUIDialog::GetGribSpdDir.
+// Samples outside the corridor or the steps of the cube go to the
+// fallback sampler.
+//
+// A cube may be saved to a file and mapped back later, so a region that is
+// planned often need not be read from the GRIB again. A mapped cube serves
+// samples straight from the file.
+class CurrentCube : public CurrentSampler {
+public:
+  CurrentCube();
+
+  // Grid nodes are at lat0 + j * dlat, lon0 + i * dlon
+  void Init(double lat0, double lon0, double dlat, double dlon, int nlat,
+            int nlon, const std::vector<time_t>& times);
+
+  // u/v of a node for step k, NaN for no data. Not for a mapped cube.
+  void Set(int k, int j, int i, double u, double v) {
+    size_t n = Index(k, j, i);
+    m_U[n] = u;
+    m_V[n] = v;
+  }
+
+  bool GetCurrent(time_t t, double lat, double lon, double& rate,
+                  double& set);
+
+  // Writes the cube to a file. quantise stores u/v as 16 bit integers,
+  // half the size of floats, with a step of at most 1/65534 of the
+  // strongest current.
+  bool Save(const std::string& filename, bool quantise = false) const;
+  // Serves samples from a file written by Save, replacing the cube
+  bool Map(const std::string& filename);
+  bool IsMapped() const { return m_File.IsOpen(); }
+
+  bool IsEmpty() const { return m_Times.empty(); }
+  size_t Bytes() const {
+    return (size_t)m_NLat * m_NLon * m_Times.size() * 2 *
+               (m_QU ? sizeof(int16_t) : sizeof(float)) +
+           m_Times.size() * sizeof(time_t);
+  }
+
+  int m_NLat, m_NLon;
+  std::vector<time_t> m_Times;  // forecast steps, ascending
+  CurrentSampler* m_Fallback;
+  double m_BuildMs;  // time taken to fill the cube
+
+private:
+  size_t Index(int k, int j, int i) const {
+    return ((size_t)k * m_NLat + j) * m_NLon + i;
+  }
+  bool Node(size_t n, double& u, double& v) const {
+    if (m_QU) {
+      if (m_QU[n] == INT16_MIN || m_QV[n] == INT16_MIN) return false;
+      u = m_QU[n] * m_Scale;
+      v = m_QV[n] * m_Scale;
+      return true;
+    }
+    u = m_FU[n];
+    v = m_FV[n];
+    return !isnan(u) && !isnan(v);
+  }
+  bool Step(int k, double pi, double pj, double& m, double& a) const;
+
+  double m_Lat0, m_Lon0, m_DLat, m_DLon;
+  std::vector<float> m_U, m_V;
+
+  // The u/v planes, in m_U/m_V or in the mapped file
+  const float *m_FU, *m_FV;
+  const int16_t *m_QU, *m_QV;  // quantised, NULL for floats
+  double m_Scale;              // m/s per quantisation step
+  MappedFile m_File;
+};
+
+#endif
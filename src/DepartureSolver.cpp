@@ -0,0 +1,156 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  otidalroute Plugin
+ * Author:   Mike Rossiter
+ *
+ ***************************************************************************
+ *   Copyright (C) 2016 by Mike Rossiter  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+
+#include "DepartureSolver.h"
+#include "DepartureSweep.h"
+
+#include <algorithm>
+#include <math.h>
+
+// Cost of a departure that cannot be calculated
+static const double NO_PASSAGE = 1e12;
+// Cost added for arriving outside the arrival window, plus the hours early
+// or late, so the search is still led towards the window
+static const double OUTSIDE_WINDOW = 1e6;
+
+static bool SampleBefore(const DepartureSample& a, const DepartureSample& b) {
+  return a.departure < b.departure;
+}
+
+DepartureSolver::DepartureSolver(const TidalPassageEngine& engine,
+                                 const std::vector<PassageWaypoint>& waypoints)
+    : m_Evaluations(0),
+      m_CoarseEvaluations(0),
+      m_engine(engine),
+      m_waypoints(waypoints),
+      m_arriveAfter(0),
+      m_arriveBefore(0),
+      m_cancel(false) {
+  m_Best.departure = m_Best.arrival = 0;
+  m_Best.hours = 0;
+  m_Best.ok = false;
+  m_Best.refined = false;
+}
+
+DepartureSample DepartureSolver::MakeSample(time_t departure,
+                                            const PassageResult& result) const {
+  DepartureSample sample;
+  sample.departure = departure;
+  sample.arrival = result.end;
+  sample.hours = result.Hours();
+  sample.ok = result.status == PASSAGE_OK;
+  sample.refined = false;
+  return sample;
+}
+
+DepartureSample DepartureSolver::Evaluate(time_t departure) {
+  DepartureSample sample =
+      MakeSample(departure, m_engine.Run(m_waypoints, departure));
+  sample.refined = true;
+
+  m_Evaluations++;
+  m_Curve.push_back(sample);
+  return sample;
+}
+
+double DepartureSolver::Cost(const DepartureSample& sample) const {
+  if (!sample.ok) return NO_PASSAGE;
+
+  double cost = (double)(sample.arrival - sample.departure) / 3600;
+  if (m_arriveAfter && sample.arrival < m_arriveAfter)
+    cost += OUTSIDE_WINDOW + (double)(m_arriveAfter - sample.arrival) / 3600;
+  if (m_arriveBefore && sample.arrival > m_arriveBefore)
+    cost += OUTSIDE_WINDOW + (double)(sample.arrival - m_arriveBefore) / 3600;
+  return cost;
+}
+
+bool DepartureSolver::Solve(time_t first, time_t last, int coarseStep,
+                            int tolerance, unsigned threads) {
+  m_Curve.clear();
+  m_Evaluations = 0;
+  m_CoarseEvaluations = 0;
+  m_Best.ok = false;
+
+  if (last < first || coarseStep <= 0 || m_cancel) return false;
+  if (tolerance < 1) tolerance = 1;
+
+  // Coarse sampling of the ETA function over the whole window. Start
+  // clears the sweep's own flag, so a Cancel that came in meanwhile is
+  // passed on again.
+  int count = (int)((last - first) / coarseStep) + 1;
+  std::vector<PassageResult> results(count);
+  m_coarse.Start(m_engine, m_waypoints, first, coarseStep, count,
+                 [&results](int index, const PassageResult& result) {
+                   results[index] = result;
+                 },
+                 DepartureSweep::FinishedCallback(), threads);
+  if (m_cancel) m_coarse.Cancel();
+  m_coarse.Wait();
+  if (m_cancel) return false;  // some departures were never run
+
+  int best = 0;
+  for (int i = 0; i < count; i++) {
+    m_Curve.push_back(MakeSample(first + (time_t)i * coarseStep, results[i]));
+    if (Cost(m_Curve[i]) < Cost(m_Curve[best])) best = i;
+  }
+  m_Evaluations = m_CoarseEvaluations = count;
+  m_Best = m_Curve[best];
+
+  if (!m_Best.ok) return false;
+
+  // Refine inside the bracket around the best coarse departure
+  const double gr = (sqrt(5.0) - 1) / 2;
+  double a = m_Curve[std::max(best - 1, 0)].departure;
+  double b = m_Curve[std::min(best + 1, count - 1)].departure;
+
+  double c = b - gr * (b - a);
+  double d = a + gr * (b - a);
+  DepartureSample sc = Evaluate((time_t)c);
+  DepartureSample sd = Evaluate((time_t)d);
+
+  while (b - a > tolerance && !m_cancel) {
+    if (Cost(sc) < Cost(sd)) {
+      b = d;
+      d = c;
+      sd = sc;
+      c = b - gr * (b - a);
+      sc = Evaluate((time_t)c);
+    } else {
+      a = c;
+      c = d;
+      sc = sd;
+      d = a + gr * (b - a);
+      sd = Evaluate((time_t)d);
+    }
+  }
+
+  for (size_t i = 0; i < m_Curve.size(); i++)
+    if (Cost(m_Curve[i]) < Cost(m_Best)) m_Best = m_Curve[i];
+
+  std::stable_sort(m_Curve.begin(), m_Curve.end(), SampleBefore);
+  return !m_cancel;
+}
@@ -0,0 +1,94 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  otidalroute Plugin
+ * Author:   Mike Rossiter
+ *
+ ***************************************************************************
+ *   Copyright (C) 2016 by Mike Rossiter  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+#ifndef _DEPARTURESOLVER_H_
+#define _DEPARTURESOLVER_H_
+
+#include <atomic>
+#include <vector>
+
+#include "DepartureSweep.h"
+#include "TidalPassageEngine.h"
+
+struct DepartureSample {
+  time_t departure, arrival;
+  double hours;  // passage time
+  bool ok;       // the passage could be calculated
+  bool refined;  // evaluated by the refinement, not the coarse sweep
+};
+
+// Finds the departure time giving the shortest passage, optionally
+// arriving inside an arrival window.
+// The window [first, last] is sampled every coarse step (in parallel), then
+// the best bracket is refined by golden-section search to the tolerance.
+class DepartureSolver {
+public:
+  DepartureSolver(const TidalPassageEngine& engine,
+                  const std::vector<PassageWaypoint>& waypoints);
+
+  // Arrivals outside [earliest, latest] are penalised. 0 = no limit.
+  void SetArrivalWindow(time_t earliest, time_t latest) {
+    m_arriveAfter = earliest;
+    m_arriveBefore = latest;
+  }
+
+  // Returns false if no departure in the window gives a passage or the
+  // search was cancelled. A solver searches once: Cancel may be called
+  // before Solve starts, and is not undone by it.
+  bool Solve(time_t first, time_t last, int coarseStep, int tolerance = 60,
+             unsigned threads = 0);
+
+  // The passage for one departure
+  PassageResult Run(time_t departure) const {
+    return m_engine.Run(m_waypoints, departure);
+  }
+
+  // Stops the coarse sweep and the refinement, from any thread
+  void Cancel() {
+    m_cancel = true;
+    m_coarse.Cancel();
+  }
+  bool IsCancelled() const { return m_cancel; }
+
+  DepartureSample m_Best;
+  std::vector<DepartureSample> m_Curve;  // every evaluation, by departure
+  int m_Evaluations;
+  int m_CoarseEvaluations;
+
+private:
+  DepartureSample Evaluate(time_t departure);
+  DepartureSample MakeSample(time_t departure,
+                             const PassageResult& result) const;
+  double Cost(const DepartureSample& sample) const;
+
+  TidalPassageEngine m_engine;
+  std::vector<PassageWaypoint> m_waypoints;
+  time_t m_arriveAfter, m_arriveBefore;
+  std::atomic<bool> m_cancel;
+  DepartureSweep m_coarse;  // the coarse sampling, on a pool of workers
+};
+
+#endif
@@ -0,0 +1,115 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  otidalroute Plugin
+ * Author:   Mike Rossiter
+ *
+ ***************************************************************************
+ *   Copyright (C) 2016 by Mike Rossiter  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+
+#include "DepartureSweep.h"
+
+DepartureSweep::DepartureSweep()
+    : m_engine(0),
+      m_first(0),
+      m_step(0),
+      m_count(0),
+      m_next(0),
+      m_completed(0),
+      m_running(0),
+      m_cancel(false) {}
+
+DepartureSweep::~DepartureSweep() {
+  Cancel();
+  Wait();
+}
+
+void DepartureSweep::Start(const TidalPassageEngine& engine,
+                           const std::vector<PassageWaypoint>& waypoints,
+                           time_t first, int step, int count,
+                           ResultCallback onResult,
+                           FinishedCallback onFinished, unsigned threads) {
+  Cancel();
+  Wait();
+
+  m_engine = engine;
+  m_waypoints = waypoints;
+  m_first = first;
+  m_step = step;
+  m_count = count;
+  m_onResult = onResult;
+  m_onFinished = onFinished;
+
+  m_next = 0;
+  m_completed = 0;
+  m_cancel = false;
+
+  if (count <= 0) {  // nothing to do
+    if (m_onFinished) m_onFinished();
+    return;
+  }
+
+  if (threads == 0) threads = std::thread::hardware_concurrency();
+  if (threads == 0) threads = 1;
+  if (threads > (unsigned)count) threads = count;
+
+  m_running = threads;
+  for (unsigned i = 0; i < threads; i++)
+    m_threads.push_back(std::thread(&DepartureSweep::Worker, this));
+}
+
+void DepartureSweep::Wait() {
+  for (size_t i = 0; i < m_threads.size(); i++) m_threads[i].join();
+  m_threads.clear();
+}
+
+void DepartureSweep::Worker() {
+  for (;;) {
+    if (m_cancel) break;
+    int index = m_next++;
+    if (index >= m_count) break;
+
+    PassageResult result =
+        m_engine.Run(m_waypoints, m_first + (time_t)index * m_step);
+    m_completed++;
+    if (m_onResult) m_onResult(index, result);
+  }
+
+  if (--m_running == 0 && m_onFinished) m_onFinished();
+}
+
+std::vector<PassageResult> DepartureSweep::Run(
+    const TidalPassageEngine& engine,
+    const std::vector<PassageWaypoint>& waypoints, time_t first, int step,
+    int count, unsigned threads) {
+  std::vector<PassageResult> results(count > 0 ? count : 0);
+
+  DepartureSweep sweep;
+  sweep.Start(
+      engine, waypoints, first, step, count,
+      [&results](int index, const PassageResult& result) {
+        results[index] = result;
+      },
+      FinishedCallback(), threads);
+  sweep.Wait();
+
+  return results;
+}
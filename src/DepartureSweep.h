@@ -0,0 +1,93 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  otidalroute Plugin
+ * Author:   Mike Rossiter
+ *
+ ***************************************************************************
+ *   Copyright (C) 2016 by Mike Rossiter  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+#ifndef _DEPARTURESWEEP_H_
+#define _DEPARTURESWEEP_H_
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "TidalPassageEngine.h"
+
+// Runs one passage for each of a window of departure times on a pool of
+// worker threads. The engine's CurrentSampler must be safe to call from
+// several threads at once.
+class DepartureSweep {
+public:
+  // Called from a worker thread as each departure finishes, in no
+  // particular order. index is 0 for the first departure.
+  typedef std::function<void(int index, const PassageResult& result)>
+      ResultCallback;
+  // Called once, from the last worker thread to finish
+  typedef std::function<void()> FinishedCallback;
+
+  DepartureSweep();
+  ~DepartureSweep();
+
+  // Starts count departures, step seconds apart, from first.
+  // threads = 0 uses one worker per core.
+  void Start(const TidalPassageEngine& engine,
+             const std::vector<PassageWaypoint>& waypoints, time_t first,
+             int step, int count, ResultCallback onResult,
+             FinishedCallback onFinished = FinishedCallback(),
+             unsigned threads = 0);
+
+  // Stops handing out departures. Passages already running complete.
+  void Cancel() { m_cancel = true; }
+  bool IsCancelled() const { return m_cancel; }
+  bool IsRunning() const { return m_running > 0; }
+
+  // Joins the worker threads
+  void Wait();
+
+  int Count() const { return m_count; }
+  int Completed() const { return m_completed; }
+
+  // Blocking sweep, results in departure order
+  static std::vector<PassageResult> Run(
+      const TidalPassageEngine& engine,
+      const std::vector<PassageWaypoint>& waypoints, time_t first, int step,
+      int count, unsigned threads = 0);
+
+private:
+  void Worker();
+
+  TidalPassageEngine m_engine;
+  std::vector<PassageWaypoint> m_waypoints;
+  time_t m_first;
+  int m_step, m_count;
+  ResultCallback m_onResult;
+  FinishedCallback m_onFinished;
+
+  std::vector<std::thread> m_threads;
+  std::atomic<int> m_next, m_completed, m_running;
+  std::atomic<bool> m_cancel;
+};
+
+#endif
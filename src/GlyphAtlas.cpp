@@ -0,0 +1,169 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  otidalroute Plugin
+ * Author:   Mike Rossiter
+ *
+ ***************************************************************************
+ *   Copyright (C) 2016 by Mike Rossiter  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+
+#include "GlyphAtlas.h"
+
+#include <string.h>
+
+// The characters rendered, then the degree sign
+static const char GLYPHS[] = " 0123456789.,:+-/%";
+
+static int NextPowerOfTwo(int n) {
+  int p = 1;
+  while (p < n) p *= 2;
+  return p;
+}
+
+GlyphAtlas::GlyphAtlas()
+    : m_Texture(0), m_TexWidth(0), m_TexHeight(0), m_Height(0), m_Degree(-1) {
+  for (int i = 0; i < 128; i++) m_Index[i] = -1;
+}
+
+GlyphAtlas::~GlyphAtlas() {
+  if (m_Texture) glDeleteTextures(1, &m_Texture);
+}
+
+bool GlyphAtlas::Build(const wxFont& font) {
+  if (m_Texture && font == m_Font) return true;
+
+  wxString chars(GLYPHS);
+  chars += wxString::FromUTF8("\xC2\xB0");  // degree sign
+
+  wxMemoryDC mdc(wxNullBitmap);
+  mdc.SetFont(font);
+
+  // Lay the glyphs out in one row, a pixel apart so they do not bleed
+  std::vector<Glyph> glyphs(chars.Length());
+  int width = 1, height = 0;
+  for (size_t i = 0; i < chars.Length(); i++) {
+    int w, h;
+    mdc.GetTextExtent(chars.Mid(i, 1), &w, &h);
+    glyphs[i].x = width;
+    glyphs[i].width = w;
+    width += w + 1;
+    if (h > height) height = h;
+  }
+  if (height == 0) return false;
+
+  // White on black, the brightness becoming the alpha
+  wxBitmap bm(width, height);
+  mdc.SelectObject(bm);
+  mdc.SetBackground(*wxBLACK_BRUSH);
+  mdc.Clear();
+  mdc.SetTextForeground(*wxWHITE);
+  mdc.SetBackgroundMode(wxTRANSPARENT);
+  for (size_t i = 0; i < chars.Length(); i++)
+    mdc.DrawText(chars.Mid(i, 1), glyphs[i].x, 0);
+  mdc.SelectObject(wxNullBitmap);
+
+  wxImage image = bm.ConvertToImage();
+  const unsigned char* d = image.GetData();
+
+  int texWidth = NextPowerOfTwo(width), texHeight = NextPowerOfTwo(height);
+  std::vector<unsigned char> rgba(4 * texWidth * texHeight, 0);
+  for (int y = 0; y < height; y++)
+    for (int x = 0; x < width; x++) {
+      const unsigned char* p = d + 3 * (y * width + x);
+      unsigned char* q = &rgba[4 * (y * texWidth + x)];
+      q[0] = q[1] = q[2] = 255;
+      q[3] = (p[0] + p[1] + p[2]) / 3;
+    }
+
+  if (!m_Texture) glGenTextures(1, &m_Texture);
+  glBindTexture(GL_TEXTURE_2D, m_Texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, texWidth, texHeight, 0, GL_RGBA,
+               GL_UNSIGNED_BYTE, &rgba[0]);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  m_Font = font;
+  m_TexWidth = texWidth;
+  m_TexHeight = texHeight;
+  m_Height = height;
+  m_Glyphs = glyphs;
+  for (int i = 0; i < 128; i++) m_Index[i] = -1;
+  for (size_t i = 0; i < strlen(GLYPHS); i++)
+    m_Index[(unsigned char)GLYPHS[i]] = i;
+  m_Degree = strlen(GLYPHS);
+  return true;
+}
+
+// The glyph of the character at c, moving c past it
+int GlyphAtlas::GlyphOf(const unsigned char*& c) const {
+  if (*c < 128) return m_Index[*c++];
+  if (c[0] == 0xC2 && c[1] == 0xB0) {
+    c += 2;
+    return m_Degree;
+  }
+  c++;
+  return -1;
+}
+
+void GlyphAtlas::AddString(const char* text, float x, float y,
+                           std::vector<GlyphVertex>& quads) const {
+  if (!m_Texture) return;
+
+  float v1 = (float)m_Height / m_TexHeight;
+  for (const unsigned char* c = (const unsigned char*)text; *c;) {
+    int g = GlyphOf(c);
+    if (g < 0) continue;
+
+    const Glyph& glyph = m_Glyphs[g];
+    float u0 = (float)glyph.x / m_TexWidth;
+    float u1 = (float)(glyph.x + glyph.width) / m_TexWidth;
+    GlyphVertex q[4] = {{x, y, u0, 0},
+                        {x + glyph.width, y, u1, 0},
+                        {x + glyph.width, y + m_Height, u1, v1},
+                        {x, y + m_Height, u0, v1}};
+    quads.insert(quads.end(), q, q + 4);
+    x += glyph.width;
+  }
+}
+
+void GlyphAtlas::Draw(const std::vector<GlyphVertex>& quads,
+                      const wxColour& colour) const {
+  if (!m_Texture || quads.empty()) return;
+
+  glEnable(GL_TEXTURE_2D);
+  glBindTexture(GL_TEXTURE_2D, m_Texture);
+  glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glColor4ub(colour.Red(), colour.Green(), colour.Blue(), 255);
+
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+  glVertexPointer(2, GL_FLOAT, sizeof(GlyphVertex), &quads[0].x);
+  glTexCoordPointer(2, GL_FLOAT, sizeof(GlyphVertex), &quads[0].u);
+  glDrawArrays(GL_QUADS, 0, quads.size());
+  glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glDisable(GL_TEXTURE_2D);
+}
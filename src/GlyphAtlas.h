@@ -0,0 +1,88 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  otidalroute Plugin
+ * Author:   Mike Rossiter
+ *
+ ***************************************************************************
+ *   Copyright (C) 2016 by Mike Rossiter  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+
+#ifndef _GLYPHATLAS_H_
+#define _GLYPHATLAS_H_
+
+#include "wx/wxprec.h"
+
+#ifndef WX_PRECOMP
+#include "wx/wx.h"
+#endif  // precompiled headers
+
+#include <wx/glcanvas.h>
+#include <vector>
+
+// The characters of the overlay labels rendered once into a texture, so a
+// label is drawn as a few textured quads from it instead of being
+// rasterised to a bitmap and copied to the screen pixel by pixel. The
+// glyphs are white with the coverage in alpha, and take the colour they
+// are drawn in from GL.
+//
+// Digits, signs and punctuation only, and the degree sign given as UTF-8.
+// Other characters are left out of the labels.
+
+struct GlyphVertex {
+  float x, y;  // pixels
+  float u, v;  // texture
+};
+
+class GlyphAtlas {
+public:
+  GlyphAtlas();
+  ~GlyphAtlas();
+
+  // Renders the glyphs of font, unless already done for it. Needs the GL
+  // context of the overlay to be current.
+  bool Build(const wxFont& font);
+
+  // The quads of text with its top left corner at x, y, appended to quads
+  void AddString(const char* text, float x, float y,
+                 std::vector<GlyphVertex>& quads) const;
+  // Draws quads from AddString in one go
+  void Draw(const std::vector<GlyphVertex>& quads,
+            const wxColour& colour) const;
+
+  int Height() const { return m_Height; }
+
+private:
+  struct Glyph {
+    int x, width;  // in the texture, pixels
+  };
+
+  int GlyphOf(const unsigned char*& c) const;
+
+  GLuint m_Texture;
+  int m_TexWidth, m_TexHeight;
+  int m_Height;
+  wxFont m_Font;
+  std::vector<Glyph> m_Glyphs;
+  short m_Index[128];  // glyph of an ASCII character, -1 for none
+  short m_Degree;      // glyph of the degree sign
+};
+
+#endif
@@ -0,0 +1,125 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  otidalroute Plugin
+ * Author:   Mike Rossiter
+ *
+ ***************************************************************************
+ *   Copyright (C) 2016 by Mike Rossiter  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+
+#include "GribCurrentCache.h"
+
+GribCurrentCache::GribCurrentCache(size_t capacity)
+    : m_Hits(0),
+      m_Misses(0),
+      m_MinStep(0),
+      m_Capacity(capacity),
+      m_ID(0),
+      m_Recheck(false) {}
+
+bool GribCurrentCache::Find(time_t t, GribRecordSetPtr& set) {
+  std::map<time_t, GribRecordSetPtr>::iterator it = m_Sets.find(t);
+  if (it == m_Sets.end() || m_Recheck) {
+    m_Misses++;
+    return false;
+  }
+
+  m_Hits++;
+  set = it->second;
+  return true;
+}
+
+GribRecordSetPtr GribCurrentCache::Store(time_t t, GribRecordSet* set) {
+  if (set && set->m_ID != m_ID) {
+    Invalidate();
+    m_ID = set->m_ID;
+  }
+  if (set) m_Recheck = false;
+
+  GribRecordSetPtr copy;
+  if (set) {
+    copy.reset(new GribRecordSet(set->m_ID));
+    copy->m_Reference_Time = set->m_Reference_Time;
+
+    const int idx[] = {Idx_SEACURRENT_VX, Idx_SEACURRENT_VY};
+    for (int i = 0; i < 2; i++) {
+      GribRecord* rec = set->m_GribRecordPtrArray[idx[i]];
+      if (rec) copy->SetUnRefGribRecord(idx[i], new GribRecord(*rec));
+    }
+
+    // Whatever time was asked for, the records are (or are interpolated
+    // from) a forecast step of the file
+    time_t step = StepTime(copy.get());
+    if (step && m_Steps.insert(step).second) {
+      std::set<time_t>::iterator s = m_Steps.find(step), n = s;
+      if (s != m_Steps.begin()) {
+        time_t gap = step - *--n;
+        if (!m_MinStep || gap < m_MinStep) m_MinStep = gap;
+      }
+      if (++s != m_Steps.end()) {
+        time_t gap = *s - step;
+        if (!m_MinStep || gap < m_MinStep) m_MinStep = gap;
+      }
+    }
+  }
+
+  std::map<time_t, GribRecordSetPtr>::iterator it = m_Sets.find(t);
+  if (it != m_Sets.end()) {
+    it->second = copy;
+    return copy;
+  }
+
+  while (m_Sets.size() >= m_Capacity && !m_Order.empty()) {
+    m_Sets.erase(m_Order.front());
+    m_Order.pop_front();
+  }
+
+  m_Sets[t] = copy;
+  m_Order.push_back(t);
+  return copy;
+}
+
+bool GribCurrentCache::Bracket(time_t t, time_t& before, time_t& after,
+                               bool strict) const {
+  std::set<time_t>::const_iterator it = m_Steps.lower_bound(t);
+  if (it != m_Steps.end() && *it == t) {
+    before = after = t;
+    return true;
+  }
+  if (it == m_Steps.end() || it == m_Steps.begin()) return false;
+
+  after = *it;
+  before = *--it;
+  return !strict || after - before <= m_MinStep;
+}
+
+time_t GribCurrentCache::StepTime(const GribRecordSet* set) {
+  if (!set || !set->m_GribRecordPtrArray[Idx_SEACURRENT_VX]) return 0;
+  return set->m_GribRecordPtrArray[Idx_SEACURRENT_VX]->getRecordCurrentDate();
+}
+
+void GribCurrentCache::Invalidate() {
+  m_Sets.clear();
+  m_Order.clear();
+  m_Steps.clear();
+  m_MinStep = 0;
+  m_Recheck = false;
+}
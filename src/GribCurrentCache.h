@@ -0,0 +1,98 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  otidalroute Plugin
+ * Author:   Mike Rossiter
+ *
+ ***************************************************************************
+ *   Copyright (C) 2016 by Mike Rossiter  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+
+#ifndef _GRIBCURRENTCACHE_H_
+#define _GRIBCURRENTCACHE_H_
+
+#include <assert.h>
+#include <time.h>
+#include <deque>
+#include <map>
+#include <memory>
+#include <set>
+
+#include "GribRecordSet.h"
+
+typedef std::shared_ptr<GribRecordSet> GribRecordSetPtr;
+
+// Sea current records returned by the GRIB plugin, keyed by the time they
+// were requested for. The plugin frees its record set as soon as the
+// GRIB_TIMELINE_RECORD message has been handled, so the current records
+// are copied into a set owned by the cache. Repeated samples at the same
+// time are then interpolated in memory without a round trip through
+// SendPluginMessage.
+//
+// The cache also learns the forecast step times of the GRIB file from the
+// records it is given, so that a sample between two steps can be blended
+// from the sets at the bracketing steps.
+//
+// Only used on the GUI thread.
+class GribCurrentCache {
+public:
+  GribCurrentCache(size_t capacity = 64);
+
+  // Looks up the records for time t and counts a hit or a miss. The set
+  // may be empty if the GRIB plugin had no records for the time.
+  bool Find(time_t t, GribRecordSetPtr& set);
+
+  // Copies the sea current records of the plugin's set for time t and
+  // returns the cached copy. A set from a different GRIB file (m_ID)
+  // invalidates everything cached so far.
+  GribRecordSetPtr Store(time_t t, GribRecordSet* set);
+
+  // The known forecast steps either side of t. before == after if t is a
+  // step. With strict set the bracket is only trusted if it is no wider
+  // than the smallest step interval seen, i.e. no unseen step can lie
+  // between them.
+  bool Bracket(time_t t, time_t& before, time_t& after,
+               bool strict = true) const;
+
+  // Forecast step time of the records in a set, 0 if none
+  static time_t StepTime(const GribRecordSet* set);
+
+  // Forget all records, e.g. when the GRIB plugin has closed its files
+  void Invalidate();
+
+  // Makes the next Find miss, so that the set then stored shows whether
+  // the GRIB plugin has loaded another file. Keeps the records if not.
+  void Recheck() { m_Recheck = true; }
+
+  size_t Size() const { return m_Sets.size(); }
+
+  unsigned long m_Hits, m_Misses;
+  time_t m_MinStep;  // smallest interval between known steps, 0 if unknown
+
+private:
+  size_t m_Capacity;
+  unsigned int m_ID;  // GRIB file the cached records came from
+  bool m_Recheck;     // m_ID to be checked before the next hit
+  std::map<time_t, GribRecordSetPtr> m_Sets;
+  std::deque<time_t> m_Order;  // oldest first, for eviction
+  std::set<time_t> m_Steps;    // forecast step times seen
+};
+
+#endif
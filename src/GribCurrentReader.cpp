@@ -0,0 +1,566 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  otidalroute Plugin
+ * Author:   Mike Rossiter
+ *
+ ***************************************************************************
+ *   Copyright (C) 2016 by Mike Rossiter  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+
+#include "GribCurrentReader.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+// GribRecord filled from a field decoded by the reader
+class GribReaderRecord : public GribRecord {
+public:
+  GribReaderRecord(int edition, int type, int level, int levelValue,
+                   unsigned char center, unsigned char model,
+                   unsigned char grid, time_t ref, time_t cur, int ni, int nj,
+                   double la1, double lo1, double la2, double lo2,
+                   double* values) {
+    id = 0;
+    ok = true;
+    knownData = true;
+    waveData = false;
+    IsDuplicated = false;
+    eof = false;
+    m_bfilled = false;
+    dataCenterModel = OTHER_DATA_CENTER;
+
+    editionNumber = edition;
+    idCenter = center;
+    idModel = model;
+    idGrid = grid;
+    dataType = type;
+    levelType = level;
+    this->levelValue = levelValue;
+    dataKey = makeKey(dataType, levelType, levelValue);
+
+    periodP1 = periodP2 = 0;
+    timeRange = 0;
+    periodsec = cur - ref;
+    refyear = refmonth = refday = refhour = refminute = 0;
+    refDate = ref;
+    strRefDate[0] = 0;
+    setRecordCurrentDate(cur);
+
+    NV = PV = 0;
+    gridType = 0;
+    Ni = ni;
+    Nj = nj;
+    La1 = la1;
+    Lo1 = lo1;
+    La2 = la2;
+    Lo2 = lo2;
+    Di = ni > 1 ? (lo2 - lo1) / (ni - 1) : 0;
+    Dj = nj > 1 ? (la2 - la1) / (nj - 1) : 0;
+    latMin = std::min(la1, la2);
+    latMax = std::max(la1, la2);
+    lonMin = lo1;
+    lonMax = lo2;
+    resolFlags = scanFlags = 0;
+    hasDiDj = true;
+    isEarthSpheric = true;
+    isUeastVnorth = false;
+    isScanIpositive = true;
+    isScanJpositive = Dj > 0;
+    isAdjacentI = true;
+
+    // Missing values are GRIB_NOTDEF in data, there is no bitmap
+    hasBMS = false;
+    BMSsize = 0;
+    BMSbits = NULL;
+    data = values;
+  }
+};
+
+static unsigned int U16(const unsigned char* p) { return p[0] << 8 | p[1]; }
+
+static unsigned int U24(const unsigned char* p) {
+  return p[0] << 16 | p[1] << 8 | p[2];
+}
+
+static unsigned int U32(const unsigned char* p) {
+  return (unsigned int)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+// GRIB signed integers are sign and magnitude
+static int S8(const unsigned char* p) {
+  int v = p[0] & 0x7f;
+  return p[0] & 0x80 ? -v : v;
+}
+
+static int S16(const unsigned char* p) {
+  int v = (p[0] & 0x7f) << 8 | p[1];
+  return p[0] & 0x80 ? -v : v;
+}
+
+static int S24(const unsigned char* p) {
+  int v = (p[0] & 0x7f) << 16 | p[1] << 8 | p[2];
+  return p[0] & 0x80 ? -v : v;
+}
+
+static int S32(const unsigned char* p) {
+  int v = (p[0] & 0x7f) << 24 | p[1] << 16 | p[2] << 8 | p[3];
+  return p[0] & 0x80 ? -v : v;
+}
+
+static double IBMFloat(const unsigned char* p) {
+  int exponent = p[0] & 0x7f;
+  double mantissa = U24(p + 1);
+  double v = ldexp(mantissa, 4 * (exponent - 64) - 24);
+  return p[0] & 0x80 ? -v : v;
+}
+
+static double IEEEFloat(const unsigned char* p) {
+  unsigned int bits = U32(p);
+  float f;
+  memcpy(&f, &bits, sizeof f);
+  return f;
+}
+
+// Seconds in the GRIB time unit (GRIB1 table 4, GRIB2 code table 4.4)
+static int TimeUnit(int edition, int unit) {
+  switch (unit) {
+    case 0:
+      return 60;
+    case 1:
+      return 3600;
+    case 2:
+      return 86400;
+    case 10:
+      return 3 * 3600;
+    case 11:
+      return 6 * 3600;
+    case 12:
+      return 12 * 3600;
+    case 13:
+      return edition == 1 ? 15 * 60 : 1;
+    case 14:
+      return edition == 1 ? 30 * 60 : 0;
+    case 254:
+      return edition == 1 ? 1 : 0;
+  }
+  return 0;
+}
+
+static time_t MakeDate(int year, int month, int day, int hour, int minute,
+                       int second) {
+  // days from civil, proleptic Gregorian
+  year -= month <= 2;
+  int era = (year >= 0 ? year : year - 399) / 400;
+  int yoe = year - era * 400;
+  int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  long days = (long)era * 146097 + doe - 719468;
+  return (time_t)days * 86400 + hour * 3600 + minute * 60 + second;
+}
+
+// Unpacks n values of nbits each, big endian, from p
+static void Unpack(const unsigned char* p, const unsigned char* end, int nbits,
+                   size_t n, std::vector<unsigned int>& out) {
+  out.resize(n);
+  unsigned long long acc = 0;
+  int have = 0;
+  for (size_t k = 0; k < n; k++) {
+    while (have < nbits) {
+      acc = acc << 8 | (p < end ? *p++ : 0);
+      have += 8;
+    }
+    have -= nbits;
+    out[k] = (unsigned int)(acc >> have) & (nbits == 32 ? 0xffffffffu
+                                                       : (1u << nbits) - 1);
+  }
+}
+
+static unsigned int s_NextID = 0x10000;
+
+GribCurrentReader::GribCurrentReader() : m_Data(NULL), m_Size(0), m_ID(0) {}
+
+GribCurrentReader::~GribCurrentReader() { Close(); }
+
+bool GribCurrentReader::Open(const std::string& filename) {
+  Close();
+  if (!m_File.Open(filename)) return false;
+
+  m_Data = m_File.Data();
+  m_Size = m_File.Size();
+  m_FileName = filename;
+  m_ID = s_NextID++;
+  Scan();
+
+  if (m_Times.empty()) {
+    Close();
+    return false;
+  }
+  return true;
+}
+
+void GribCurrentReader::Close() {
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Sets.clear();
+  }
+  m_U.clear();
+  m_V.clear();
+  m_Times.clear();
+  m_FileName.clear();
+
+  m_File.Close();
+  m_Data = NULL;
+  m_Size = 0;
+}
+
+// Finds the messages in the file and indexes the current fields
+void GribCurrentReader::Scan() {
+  size_t pos = 0;
+  while (pos + 16 <= m_Size) {
+    const unsigned char* msg = m_Data + pos;
+    if (memcmp(msg, "GRIB", 4) != 0) {
+      pos++;  // skip anything between messages
+      continue;
+    }
+
+    // GRIB2 lengths are 64 bits, wider than size_t on 32 bit targets
+    uint64_t len = 0;
+    if (msg[7] == 1)
+      len = U24(msg + 4);
+    else if (msg[7] == 2)
+      len = (uint64_t)U32(msg + 8) << 32 | U32(msg + 12);
+    if (len < 16 || len > m_Size - pos) {
+      pos += 4;
+      continue;
+    }
+
+    if (msg[7] == 1)
+      ScanGrib1(msg, (size_t)len);
+    else
+      ScanGrib2(msg, (size_t)len);
+    pos += (size_t)len;
+  }
+
+  for (std::map<time_t, Field>::iterator it = m_U.begin(); it != m_U.end();
+       it++)
+    if (m_V.count(it->first)) m_Times.push_back(it->first);
+}
+
+void GribCurrentReader::ScanGrib1(const unsigned char* msg, size_t len) {
+  const unsigned char* end = msg + len;
+  const unsigned char* pds = msg + 8;
+  if (pds + 28 > end) return;
+  size_t pdsLen = U24(pds);
+
+  int parameter = pds[8];
+  if (parameter != GRB_UOGRD && parameter != GRB_VOGRD) return;
+  if (!(pds[7] & 0x80)) return;  // needs a grid description
+
+  const unsigned char* gds = pds + pdsLen;
+  if (gds + 32 > end || gds[5] != 0) return;  // regular lat/lon only
+  const unsigned char* p = gds + U24(gds);
+
+  const unsigned char* bms = NULL;
+  if (pds[7] & 0x40) {
+    bms = p;
+    if (bms + 6 > end || U16(bms + 4) != 0) return;  // predefined bitmaps
+    p = bms + U24(bms);
+  }
+  const unsigned char* bds = p;
+  if (bds + 11 > end || bds + U24(bds) > end) return;
+  if (bds[3] & 0xc0) return;  // spherical harmonics, complex packing
+
+  int century = pds[24] ? pds[24] : 21;
+  int year = (century - 1) * 100 + pds[12];
+  time_t ref = MakeDate(year, pds[13], pds[14], pds[15], pds[16], 0);
+
+  int unit = TimeUnit(1, pds[17]);
+  int offset;
+  switch (pds[20]) {  // time range indicator
+    case 0:
+      offset = pds[18];
+      break;
+    case 1:
+      offset = 0;
+      break;
+    case 10:
+      offset = pds[18] << 8 | pds[19];
+      break;
+    default:
+      offset = pds[19];
+  }
+
+  Field f;
+  f.edition = 1;
+  f.dataType = parameter;
+  f.levelType = pds[9];
+  f.levelValue = U16(pds + 10);
+  f.level = f.levelValue;
+  f.refDate = ref;
+  f.curDate = ref + (time_t)offset * unit;
+  f.pds = pds;
+  f.gds = gds;
+  f.bms = bms;
+  f.bds = bds;
+  f.drs = NULL;
+  f.center = pds[4];
+  f.model = pds[5];
+  f.grid = pds[6];
+  AddField(f);
+}
+
+void GribCurrentReader::ScanGrib2(const unsigned char* msg, size_t len) {
+  const unsigned char* end = msg + len;
+  int discipline = msg[6];
+  if (discipline != 10) return;  // oceanographic products
+
+  const unsigned char *sec1 = NULL, *sec3 = NULL, *sec4 = NULL, *sec5 = NULL,
+                      *sec6 = NULL, *bitmap = NULL;
+  const unsigned char* p = msg + 16;
+  while (p + 5 <= end && memcmp(p, "7777", 4) != 0) {
+    size_t sectionLen = U32(p);
+    if (sectionLen < 5 || p + sectionLen > end) return;
+
+    switch (p[4]) {
+      case 1:
+        sec1 = p;
+        break;
+      case 3:
+        sec3 = p;
+        break;
+      case 4:
+        sec4 = p;
+        break;
+      case 5:
+        sec5 = p;
+        break;
+      case 6:
+        sec6 = p;
+        if (p[5] == 0)
+          bitmap = p;
+        else if (p[5] == 255)
+          bitmap = NULL;  // 254 keeps the bitmap defined before
+        break;
+      case 7:
+        if (sec1 && sec3 && sec4 && sec5 && sec6 && sectionLen > 5 &&
+            U32(sec1) >= 19 && U32(sec3) >= 72 && U32(sec4) >= 26 &&
+            U32(sec5) >= 21 && U16(sec3 + 12) == 0 && U16(sec5 + 9) == 0 &&
+            U16(sec4 + 7) <= 1 && sec4[9] == 1 &&
+            (sec4[10] == 2 || sec4[10] == 3)) {
+          time_t ref = MakeDate(U16(sec1 + 12), sec1[14], sec1[15], sec1[16],
+                                sec1[17], sec1[18]);
+
+          Field f;
+          f.edition = 2;
+          f.dataType = sec4[10] == 2 ? GRB_UOGRD : GRB_VOGRD;
+          // The level is a scaled value, all ones for none
+          f.levelType = sec4[22];
+          f.level = 0;
+          if (sec4[23] != 0xff && U32(sec4 + 24) != 0xffffffff)
+            f.level = S32(sec4 + 24) * pow(10.0, -S8(sec4 + 23));
+          f.levelValue = (int)floor(f.level + 0.5);
+          f.refDate = ref;
+          f.curDate = ref + (time_t)U32(sec4 + 18) * TimeUnit(2, sec4[17]);
+          f.pds = sec4;
+          f.gds = sec3;
+          f.bms = bitmap;
+          f.bds = p;
+          f.drs = sec5;
+          f.center = U16(sec1 + 5);
+          f.model = sec4[13];
+          f.grid = 0;
+          AddField(f);
+        }
+        break;
+    }
+    p += sectionLen;
+  }
+}
+
+// Keeps the shallowest field of each component for each time
+void GribCurrentReader::AddField(const Field& field) {
+  std::map<time_t, Field>& fields = field.dataType == GRB_UOGRD ? m_U : m_V;
+  std::map<time_t, Field>::iterator it = fields.find(field.curDate);
+  if (it == fields.end() || field.level < it->second.level)
+    fields[field.curDate] = field;
+}
+
+GribRecord* GribCurrentReader::Decode(const Field& f) {
+  int ni, nj, scan, d, e, nbits;
+  double la1, lo1, la2, lo2, r;
+  const unsigned char *bitmap = NULL, *packed, *packedEnd;
+
+  if (f.edition == 1) {
+    ni = U16(f.gds + 6);
+    nj = U16(f.gds + 8);
+    la1 = S24(f.gds + 10) / 1000.0;
+    lo1 = S24(f.gds + 13) / 1000.0;
+    la2 = S24(f.gds + 17) / 1000.0;
+    lo2 = S24(f.gds + 20) / 1000.0;
+    scan = f.gds[27];
+
+    d = S16(f.pds + 26);
+    e = S16(f.bds + 4);
+    r = IBMFloat(f.bds + 6);
+    nbits = f.bds[10];
+    if (f.bms) bitmap = f.bms + 6;
+    packed = f.bds + 11;
+    packedEnd = f.bds + U24(f.bds);
+  } else {
+    ni = U32(f.gds + 30);
+    nj = U32(f.gds + 34);
+    unsigned int angle = U32(f.gds + 38), subdiv = U32(f.gds + 42);
+    double unit = angle == 0 || angle == 0xffffffff || subdiv == 0 ||
+                          subdiv == 0xffffffff
+                      ? 1e-6
+                      : (double)angle / subdiv;
+    la1 = S32(f.gds + 46) * unit;
+    lo1 = S32(f.gds + 50) * unit;
+    la2 = S32(f.gds + 55) * unit;
+    lo2 = S32(f.gds + 59) * unit;
+    scan = f.gds[71];
+
+    r = IEEEFloat(f.drs + 11);
+    e = S16(f.drs + 15);
+    d = S16(f.drs + 17);
+    nbits = f.drs[19];
+    if (f.bms) bitmap = f.bms + 6;
+    packed = f.bds + 5;
+    packedEnd = f.bds + U32(f.bds);
+  }
+  if (ni < 1 || nj < 1 || nbits > 32) return NULL;
+
+  size_t n = (size_t)ni * nj, count = n;
+  if (bitmap) {
+    count = 0;
+    for (size_t k = 0; k < n; k++)
+      if (bitmap[k >> 3] & (0x80 >> (k & 7))) count++;
+  }
+  if (packed + (count * nbits + 7) / 8 > packedEnd) return NULL;
+
+  std::vector<unsigned int> x;
+  Unpack(packed, packedEnd, nbits, count, x);
+
+  // i from west to east, j in the order of the file
+  bool iNegative = scan & 0x80, jConsecutive = scan & 0x20;
+  if (iNegative) std::swap(lo1, lo2);
+  if (lo2 < lo1) lo2 += 360;
+
+  double scale = pow(10.0, -d), e2 = ldexp(1.0, e);
+  double* values = new double[n];
+  size_t v = 0;
+  for (size_t k = 0; k < n; k++) {
+    int fi = jConsecutive ? k / nj : k % ni;
+    int fj = jConsecutive ? k % nj : k / ni;
+    int i = iNegative ? ni - 1 - fi : fi;
+
+    if (bitmap && !(bitmap[k >> 3] & (0x80 >> (k & 7))))
+      values[fj * ni + i] = GRIB_NOTDEF;
+    else
+      values[fj * ni + i] = (r + x[v++] * e2) * scale;
+  }
+
+  // GribRecord keeps the GRIB1 byte, as the GRIB plugin's records whose
+  // layout it shares. A GRIB2 centre past it is given as 255, missing.
+  unsigned char center = f.center > 255 ? 255 : f.center;
+  return new GribReaderRecord(f.edition, f.dataType, f.levelType,
+                              f.levelValue, center, f.model, f.grid,
+                              f.refDate, f.curDate, ni, nj, la1, lo1, la2,
+                              lo2, values);
+}
+
+GribRecordSetPtr GribCurrentReader::GetRecordSet(time_t t) {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+
+  std::map<time_t, GribRecordSetPtr>::iterator it = m_Sets.find(t);
+  if (it != m_Sets.end()) return it->second;
+
+  GribRecordSetPtr set;
+  std::map<time_t, Field>::iterator u = m_U.find(t), v = m_V.find(t);
+  if (u != m_U.end() && v != m_V.end()) {
+    GribRecord* vx = Decode(u->second);
+    GribRecord* vy = Decode(v->second);
+    if (vx && vy) {
+      set.reset(new GribRecordSet(m_ID));
+      set->m_Reference_Time = u->second.refDate;
+      set->SetUnRefGribRecord(Idx_SEACURRENT_VX, vx);
+      set->SetUnRefGribRecord(Idx_SEACURRENT_VY, vy);
+    } else {
+      delete vx;
+      delete vy;
+    }
+  }
+
+  m_Sets[t] = set;
+  return set;
+}
+
+// Same as GribCurrent in otidalroute_pi.h
+static bool CurrentAt(const GribRecordSet* set, double lat, double lon,
+                      double& C, double& VC) {
+  if (!set ||
+      !GribRecord::getInterpolatedValues(
+          VC, C, set->m_GribRecordPtrArray[Idx_SEACURRENT_VX],
+          set->m_GribRecordPtrArray[Idx_SEACURRENT_VY], lon, lat))
+    return false;
+
+  VC *= 3.6 / 1.852;  // knots
+
+  C += 180;
+  if (C > 360) C -= 360;
+  return true;
+}
+
+bool GribCurrentReader::GetCurrent(time_t t, double lat, double lon,
+                                   double& rate, double& set) {
+  if (m_Times.empty()) return false;
+
+  // Held at the first and last steps of the file
+  std::vector<time_t>::const_iterator it =
+      std::upper_bound(m_Times.begin(), m_Times.end(), t);
+  if (it == m_Times.begin() || it == m_Times.end() || *(it - 1) == t) {
+    time_t step = it == m_Times.begin() ? m_Times.front() : *(it - 1);
+    return CurrentAt(GetRecordSet(step).get(), lat, lon, set, rate);
+  }
+
+  time_t before = *(it - 1), after = *it;
+  double dir1, spd1, dir2, spd2;
+  if (!CurrentAt(GetRecordSet(before).get(), lat, lon, dir1, spd1) ||
+      !CurrentAt(GetRecordSet(after).get(), lat, lon, dir2, spd2))
+    return false;
+
+  double d = (double)(t - before) / (after - before);
+  double turn = dir2 - dir1;
+  if (turn > 180)
+    turn -= 360;
+  else if (turn < -180)
+    turn += 360;
+
+  rate = (1 - d) * spd1 + d * spd2;
+  set = dir1 + d * turn;
+  if (set < 0)
+    set += 360;
+  else if (set >= 360)
+    set -= 360;
+  return true;
+}
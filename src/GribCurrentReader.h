@@ -0,0 +1,106 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  otidalroute Plugin
+ * Author:   Mike Rossiter
+ *
+ ***************************************************************************
+ *   Copyright (C) 2016 by Mike Rossiter  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+
+#ifndef _GRIBCURRENTREADER_H_
+#define _GRIBCURRENTREADER_H_
+
+#include <time.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "GribCurrentCache.h"
+#include "MappedFile.h"
+#include "TidalPassageEngine.h"
+
+// Reads the sea current (UOGRD/VOGRD) records of a GRIB1 or GRIB2 file
+// without the OpenCPN GRIB plugin. The file is memory mapped and only the
+// headers are scanned when it is opened. The grid and data sections of a
+// forecast step are decoded the first time the step is used.
+//
+// GRIB1 grid type 0 and GRIB2 template 3.0 (regular lat/lon grids) with
+// simple packing (GRIB2 template 5.0) are supported. Other records are
+// skipped.
+//
+// As a CurrentSampler it interpolates like the GRIB plugin path in
+// otidalrouteUIDialog::GetGribSpdDir, blending the steps either side of
+// the time. It may be used from several threads at once.
+class GribCurrentReader : public CurrentSampler {
+public:
+  GribCurrentReader();
+  ~GribCurrentReader();
+
+  bool Open(const std::string& filename);
+  void Close();
+  bool IsOpen() const { return m_Data != NULL; }
+
+  // Forecast steps that have both current components, ascending
+  const std::vector<time_t>& Times() const { return m_Times; }
+
+  // Record set for a forecast step, decoded on first use. Empty if t is
+  // not a step of the file or the records cannot be decoded.
+  GribRecordSetPtr GetRecordSet(time_t t);
+
+  bool GetCurrent(time_t t, double lat, double lon, double& rate,
+                  double& set);
+
+  std::string m_FileName;
+
+private:
+  // Where the sections of one current field are in the mapped file
+  struct Field {
+    int edition;
+    int dataType;  // GRB_UOGRD or GRB_VOGRD
+    int levelType, levelValue;
+    double level;  // levelValue with the GRIB2 scale factor applied
+    time_t refDate, curDate;
+    const unsigned char *pds, *gds, *bms, *bds;  // GRIB2 sections 4, 3, 6, 7
+    const unsigned char *drs;                    // GRIB2 section 5
+    unsigned int center;  // 16 bits in GRIB2
+    unsigned char model, grid;
+  };
+
+  void Scan();
+  void ScanGrib1(const unsigned char* msg, size_t len);
+  void ScanGrib2(const unsigned char* msg, size_t len);
+  void AddField(const Field& field);
+  GribRecord* Decode(const Field& field);
+
+  MappedFile m_File;
+  const unsigned char* m_Data;
+  size_t m_Size;
+
+  std::map<time_t, Field> m_U, m_V;
+  std::vector<time_t> m_Times;
+
+  std::mutex m_Mutex;  // guards m_Sets
+  std::map<time_t, GribRecordSetPtr> m_Sets;
+  unsigned int m_ID;
+};
+
+#endif
@@ -25,6 +25,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //#include "dychart.h"        // for some compile time fixups
 //#include "cutil.h"
 #include <stdlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 //#include <QDateTime>
 
@@ -876,3 +879,165 @@ bool GribRecord::getInterpolatedValues(double &M, double &A,
     return val;
 #endif
 }
+
+#ifdef __SSE2__
+//-------------------------------------------------------------------------------
+// atan2(y, x) for two lanes, the Cephes double precision atan with the
+// quadrant taken from the signs of x and y. Within a few ulp of atan2().
+//-------------------------------------------------------------------------------
+static inline __m128d atan2_pd(__m128d y, __m128d x)
+{
+    const __m128d sign = _mm_set1_pd(-0.0), zero = _mm_setzero_pd();
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128d pi = _mm_set1_pd(M_PI), pi_2 = _mm_set1_pd(M_PI/2), pi_4 = _mm_set1_pd(M_PI/4);
+
+    __m128d ay = _mm_andnot_pd(sign, y), ax = _mm_andnot_pd(sign, x);
+
+    // a = min/max in [0, 1]
+    __m128d swap = _mm_cmpgt_pd(ay, ax);
+    __m128d num = _mm_or_pd(_mm_and_pd(swap, ax), _mm_andnot_pd(swap, ay));
+    __m128d den = _mm_or_pd(_mm_and_pd(swap, ay), _mm_andnot_pd(swap, ax));
+    __m128d a = _mm_and_pd(_mm_div_pd(num, den), _mm_cmpneq_pd(den, zero));
+
+    // atan(a) = pi/4 + atan((a-1)/(a+1)) above 0.66
+    __m128d big = _mm_cmpgt_pd(a, _mm_set1_pd(0.66));
+    __m128d t = _mm_div_pd(_mm_sub_pd(a, one), _mm_add_pd(a, one));
+    a = _mm_or_pd(_mm_and_pd(big, t), _mm_andnot_pd(big, a));
+
+    __m128d z = _mm_mul_pd(a, a);
+    __m128d p = _mm_set1_pd(-8.750608600031904122785E-1);
+    p = _mm_add_pd(_mm_mul_pd(p, z), _mm_set1_pd(-1.615753718733365076637E1));
+    p = _mm_add_pd(_mm_mul_pd(p, z), _mm_set1_pd(-7.500855792314704667340E1));
+    p = _mm_add_pd(_mm_mul_pd(p, z), _mm_set1_pd(-1.228866684490136173410E2));
+    p = _mm_add_pd(_mm_mul_pd(p, z), _mm_set1_pd(-6.485021904942025371773E1));
+    __m128d q = _mm_add_pd(z, _mm_set1_pd(2.485846490142306297962E1));
+    q = _mm_add_pd(_mm_mul_pd(q, z), _mm_set1_pd(1.650270098316988542046E2));
+    q = _mm_add_pd(_mm_mul_pd(q, z), _mm_set1_pd(4.328810604912902668951E2));
+    q = _mm_add_pd(_mm_mul_pd(q, z), _mm_set1_pd(4.853903996359136964868E2));
+    q = _mm_add_pd(_mm_mul_pd(q, z), _mm_set1_pd(1.945506571482613964425E2));
+    __m128d r = _mm_add_pd(_mm_mul_pd(a, _mm_div_pd(_mm_mul_pd(z, p), q)), a);
+    r = _mm_add_pd(r, _mm_and_pd(big, pi_4));
+
+    r = _mm_or_pd(_mm_and_pd(swap, _mm_sub_pd(pi_2, r)), _mm_andnot_pd(swap, r));
+    __m128d left = _mm_cmplt_pd(x, zero);
+    r = _mm_or_pd(_mm_and_pd(left, _mm_sub_pd(pi, r)), _mm_andnot_pd(left, r));
+    return _mm_or_pd(r, _mm_and_pd(sign, y));  // sign of y
+}
+#endif
+
+//-------------------------------------------------------------------------------
+// Batch version of getInterpolatedValues for n points (px[k], py[k]).
+// Points with the four surrounding grid values defined take the fast path,
+// two at a time with SSE2. Any other point goes through the single point
+// routine. ok[k] tells if M[k], A[k] were set. Magnitudes are the same as
+// getInterpolatedValues gives, angles agree to a few ulp.
+//-------------------------------------------------------------------------------
+void GribRecord::getInterpolatedValues(int n, double *M, double *A, bool *ok,
+                                       const GribRecord *GRX, const GribRecord *GRY,
+                                       const double *px, const double *py)
+{
+    if(!GRX || !GRY || !GRX->ok || !GRY->ok || GRX->Di==0 || GRX->Dj==0
+       || GRX->Ni != GRY->Ni || GRX->Nj != GRY->Nj) {
+        for (int k=0; k<n; k++)
+            ok[k] = getInterpolatedValues(M[k], A[k], GRX, GRY, px[k], py[k]);
+        return;
+    }
+
+    const int CHUNK = 64;
+    int    lane[CHUNK];             // point of each fast lane
+    double wx[CHUNK], wy[CHUNK];    // hermite weights
+    double cx[4][CHUNK], cy[4][CHUNK];  // corners 00 10 01 11
+    double m[CHUNK], ca[4][CHUNK];
+
+    for (int base=0; base<n; base+=CHUNK) {
+        int cn = n-base < CHUNK ? n-base : CHUNK;
+
+        // Grid cell and weights of each point
+        int nf = 0;
+        for (int k=base; k<base+cn; k++) {
+            double x = px[k], y = py[k];
+            if (!GRX->isPointInMap(x,y) || !GRY->isPointInMap(x,y)) {
+                ok[k] = getInterpolatedValues(M[k], A[k], GRX, GRY, px[k], py[k]);
+                continue;
+            }
+
+            double pi = (x-GRX->Lo1)/GRX->Di;
+            double pj = (y-GRX->La1)/GRX->Dj;
+            int i0 = (int) pi;
+            int j0 = (int) pj;
+            unsigned int i1 = pi+1, j1 = pj+1;
+            if(i1 >= GRX->Ni)
+                i1 = i0;
+            if(j1 >= GRX->Nj)
+                j1 = j0;
+
+            const int ci[4] = {i0, (int)i1, i0, (int)i1};
+            const int cj[4] = {j0, j0, (int)j1, (int)j1};
+            bool defined = true;
+            for (int c=0; c<4; c++) {
+                cx[c][nf] = GRX->getValue(ci[c], cj[c]);
+                cy[c][nf] = GRY->getValue(ci[c], cj[c]);
+                if (cx[c][nf] == GRIB_NOTDEF || cy[c][nf] == GRIB_NOTDEF)
+                    defined = false;
+            }
+            if (!defined) {
+                ok[k] = getInterpolatedValues(M[k], A[k], GRX, GRY, px[k], py[k]);
+                continue;
+            }
+
+            double dx = pi-i0;
+            double dy = pj-j0;
+            wx[nf] = (3.0 - 2.0*dx)*dx*dx;   // pseudo hermite interpolation
+            wy[nf] = (3.0 - 2.0*dy)*dy*dy;
+            lane[nf++] = k;
+        }
+
+        // Magnitudes
+        int f = 0;
+#ifdef __SSE2__
+        const __m128d one = _mm_set1_pd(1.0);
+        for (; f+2 <= nf; f+=2) {
+            __m128d c[4];
+            for (int i=0; i<4; i++) {
+                __m128d x = _mm_loadu_pd(&cx[i][f]), y = _mm_loadu_pd(&cy[i][f]);
+                c[i] = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(x, x), _mm_mul_pd(y, y)));
+            }
+            __m128d dx = _mm_loadu_pd(&wx[f]), dy = _mm_loadu_pd(&wy[f]);
+            __m128d ex = _mm_sub_pd(one, dx), ey = _mm_sub_pd(one, dy);
+            __m128d x0m = _mm_add_pd(_mm_mul_pd(ex, c[0]), _mm_mul_pd(dx, c[1]));
+            __m128d x1m = _mm_add_pd(_mm_mul_pd(ex, c[2]), _mm_mul_pd(dx, c[3]));
+            _mm_storeu_pd(&m[f], _mm_add_pd(_mm_mul_pd(ey, x0m), _mm_mul_pd(dy, x1m)));
+        }
+#endif
+        for (; f<nf; f++) {
+            double c[4];
+            for (int i=0; i<4; i++)
+                c[i] = sqrt(cx[i][f]*cx[i][f] + cy[i][f]*cy[i][f]);
+            double x0m = (1-wx[f])*c[0] + wx[f]*c[1];
+            double x1m = (1-wx[f])*c[2] + wx[f]*c[3];
+            m[f] = (1-wy[f])*x0m + wy[f]*x1m;
+        }
+
+        // Angles
+        f = 0;
+#ifdef __SSE2__
+        for (; f+2 <= nf; f+=2)
+            for (int i=0; i<4; i++)
+                _mm_storeu_pd(&ca[i][f], atan2_pd(_mm_loadu_pd(&cx[i][f]),
+                                                  _mm_loadu_pd(&cy[i][f])));
+#endif
+        for (; f<nf; f++)
+            for (int i=0; i<4; i++)
+                ca[i][f] = atan2(cx[i][f], cy[i][f]);
+
+        for (f=0; f<nf; f++) {
+            double x0a = interp_angle(ca[0][f], ca[1][f], wx[f], M_PI);
+            double x1a = interp_angle(ca[2][f], ca[3][f], wx[f], M_PI);
+
+            int k = lane[f];
+            M[k] = m[f];
+            A[k] = interp_angle(x0a, x1a, wy[f], M_PI) * (180 / M_PI) + 180;
+            ok[k] = true;
+        }
+    }
+}
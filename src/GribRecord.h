@@ -202,6 +202,10 @@ class GribRecord
         static bool getInterpolatedValues(double &M, double &A,
                                           const GribRecord *GRX, const GribRecord *GRY,
                                           double px, double py, bool numericalInterpolation=true);
+        // Same for a batch of n points
+        static void getInterpolatedValues(int n, double *M, double *A, bool *ok,
+                                          const GribRecord *GRX, const GribRecord *GRY,
+                                          const double *px, const double *py);
         
         // coordiantes of grid point
         inline double  getX(int i) const   { return Lo1+i*Di;}
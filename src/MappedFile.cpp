@@ -0,0 +1,117 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  otidalroute Plugin
+ * Author:   Mike Rossiter
+ *
+ ***************************************************************************
+ *   Copyright (C) 2016 by Mike Rossiter  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+
+#include "MappedFile.h"
+
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+    : m_Data(NULL),
+      m_Size(0),
+#ifdef _WIN32
+      m_File(NULL),
+      m_Mapping(NULL) {
+}
+#else
+      m_File(-1) {
+}
+#endif
+
+MappedFile::~MappedFile() { Close(); }
+
+bool MappedFile::Open(const std::string& filename) {
+  Close();
+
+#ifdef _WIN32
+  int len = MultiByteToWideChar(CP_UTF8, 0, filename.c_str(), -1, NULL, 0);
+  std::vector<wchar_t> wname(len > 0 ? len : 1);
+  MultiByteToWideChar(CP_UTF8, 0, filename.c_str(), -1, &wname[0], len);
+
+  HANDLE file = CreateFileW(&wname[0], GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) return false;
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+    CloseHandle(file);
+    return false;
+  }
+  HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  const void* data =
+      mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+  if (!data) {
+    if (mapping) CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+  m_File = file;
+  m_Mapping = mapping;
+  m_Size = (size_t)size.QuadPart;
+#else
+  int file = open(filename.c_str(), O_RDONLY);
+  if (file < 0) return false;
+  struct stat st;
+  if (fstat(file, &st) != 0 || st.st_size == 0) {
+    close(file);
+    return false;
+  }
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+  if (data == MAP_FAILED) {
+    close(file);
+    return false;
+  }
+  m_File = file;
+  m_Size = st.st_size;
+#endif
+
+  m_Data = (const unsigned char*)data;
+  return true;
+}
+
+void MappedFile::Close() {
+  if (!m_Data) return;
+#ifdef _WIN32
+  UnmapViewOfFile(m_Data);
+  CloseHandle(m_Mapping);
+  CloseHandle(m_File);
+  m_Mapping = m_File = NULL;
+#else
+  munmap((void*)m_Data, m_Size);
+  close(m_File);
+  m_File = -1;
+#endif
+  m_Data = NULL;
+  m_Size = 0;
+}
@@ -33,7 +33,6 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <math.h>
-#include <wx/msgdlg.h>
 
 
 #ifndef PI
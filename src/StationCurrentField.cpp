@@ -0,0 +1,153 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  otidalroute Plugin
+ * Author:   Mike Rossiter
+ *
+ ***************************************************************************
+ *   Copyright (C) 2016 by Mike Rossiter  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+
+#include "StationCurrentField.h"
+
+#include <algorithm>
+#include <math.h>
+
+#include "wx/wx.h"
+#include "tcmgr.h"
+
+static double deg2rad(double degrees) { return M_PI * degrees / 180.0; }
+
+// Nodes closer than this to a station take their weight from this distance
+static const double MIN_DIST = 0.01;  // NM
+
+StationCurrentField::StationCurrentField()
+    : m_Radius(20),
+      m_Neighbours(4),
+      m_Power(2),
+      m_Spacing(1),
+      m_Step(900),
+      m_MaxNodes(4096),
+      m_Stations(0) {}
+
+bool StationCurrentField::Build(TCMgr& tcmgr,
+                                const std::vector<PassageWaypoint>& waypoints,
+                                time_t first, time_t last, CurrentCube& cube) {
+  m_Stations = 0;
+  if (waypoints.empty() || last < first || m_Step <= 0) return false;
+
+  // Box around the route legs, out to the stations that reach them
+  double latMin = 90, latMax = -90, lonMin = 180, lonMax = -180;
+  for (size_t i = 0; i < waypoints.size(); i++) {
+    latMin = std::min(latMin, waypoints[i].lat);
+    latMax = std::max(latMax, waypoints[i].lat);
+    lonMin = std::min(lonMin, waypoints[i].lon);
+    lonMax = std::max(lonMax, waypoints[i].lon);
+  }
+  if (lonMax - lonMin > 180) return false;  // crosses the date line
+
+  double maxLat = std::min(89.0, std::max(fabs(latMin), fabs(latMax)) +
+                                     2 * m_Radius / 60);
+  double bufLat = m_Radius / 60, bufLon = bufLat / cos(deg2rad(maxLat));
+  std::vector<int> near;
+  tcmgr.GetStationIndex().InBox(latMin - 2 * bufLat, lonMin - 2 * bufLon,
+                                latMax + 2 * bufLat, lonMax + 2 * bufLon,
+                                STATION_ALL_CURRENTS, near);
+
+  // Current of each station with directions on the time grid, east and
+  // north in knots
+  int nt = (last - first + m_Step - 1) / m_Step + 1;
+  std::vector<time_t> times(nt);
+  for (int k = 0; k < nt; k++) times[k] = first + (time_t)k * m_Step;
+
+  std::vector<StationRef> refs;
+  std::vector<float> su, sv;  // station x time
+  std::vector<float> value(nt), dir(nt);
+  for (size_t i = 0; i < near.size(); i++) {
+    IDX_entry* pIDX = tcmgr.GetIDX_entry(near[i]);
+    if (pIDX->IDX_flood_dir == pIDX->IDX_ebb_dir) continue;
+    if (!tcmgr.GetTideOrCurrent(first, m_Step, nt, near[i], value.data(),
+                                dir.data()))
+      continue;
+
+    StationRef r = {(int)refs.size(), pIDX->IDX_lat, pIDX->IDX_lon, 'c'};
+    refs.push_back(r);
+    for (int k = 0; k < nt; k++) {
+      double rate = fabs(value[k]), a = deg2rad(dir[k]);
+      su.push_back(rate * sin(a));
+      sv.push_back(rate * cos(a));
+    }
+  }
+  m_Stations = refs.size();
+  if (refs.empty()) return false;
+
+  StationIndex stations;
+  stations.Build(refs);
+
+  // Grid over the route box and the stations' reach
+  latMin -= bufLat;
+  latMax += bufLat;
+  lonMin -= bufLon;
+  lonMax += bufLon;
+  double coslat = cos(deg2rad((latMin + latMax) / 2));
+  double spacing = m_Spacing;
+  for (;;) {
+    double nlat = (latMax - latMin) * 60 / spacing + 1;
+    double nlon = (lonMax - lonMin) * 60 * coslat / spacing + 1;
+    if (nlat * nlon <= m_MaxNodes) break;
+    spacing *= 1.25;
+  }
+  double dlat = spacing / 60, dlon = dlat / coslat;
+  int nj = (int)ceil((latMax - latMin) / dlat) + 1;
+  int ni = (int)ceil((lonMax - lonMin) / dlon) + 1;
+  cube.Init(latMin, lonMin, dlat, dlon, nj, ni, times);
+
+  // Weights of the nearest stations at each node, then the current of each
+  // step as their weighted sum
+  std::vector<StationHit> hits;
+  std::vector<double> w;
+  for (int j = 0; j < nj; j++) {
+    for (int i = 0; i < ni; i++) {
+      stations.Nearest(latMin + j * dlat, lonMin + i * dlon, m_Neighbours,
+                       STATION_ALL, hits, m_Radius);
+      if (hits.empty()) continue;
+
+      double sum = 0;
+      w.resize(hits.size());
+      for (size_t h = 0; h < hits.size(); h++) {
+        w[h] = pow(std::max(hits[h].dist, MIN_DIST), -m_Power);
+        sum += w[h];
+      }
+      for (size_t h = 0; h < hits.size(); h++)
+        w[h] *= 1.852 / 3.6 / sum;  // knots to m/s
+
+      for (int k = 0; k < nt; k++) {
+        double u = 0, v = 0;
+        for (size_t h = 0; h < hits.size(); h++) {
+          size_t n = (size_t)hits[h].idx * nt + k;
+          u += w[h] * su[n];
+          v += w[h] * sv[n];
+        }
+        cube.Set(k, j, i, u, v);
+      }
+    }
+  }
+  return true;
+}
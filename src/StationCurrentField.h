@@ -0,0 +1,67 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  otidalroute Plugin
+ * Author:   Mike Rossiter
+ *
+ ***************************************************************************
+ *   Copyright (C) 2016 by Mike Rossiter  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+
+#ifndef _STATIONCURRENTFIELD_H_
+#define _STATIONCURRENTFIELD_H_
+
+#include <time.h>
+#include <vector>
+
+#include "CurrentCube.h"
+#include "TidalPassageEngine.h"
+
+class TCMgr;
+
+// The tidal current of the harmonic current stations near a route, for
+// when there is no current GRIB. Each station's current is predicted on a
+// time grid, flowing towards its flood or ebb direction, and spread over
+// a lat/lon grid around the route by inverse distance weighting of the
+// nearest stations. The result is packed in a CurrentCube, so sampling it
+// costs the same as sampling a GRIB cube.
+//
+// Only stations with flood and ebb directions are used: the secondary
+// stations of the OpenCPN index. Reference stations have none.
+class StationCurrentField {
+public:
+  StationCurrentField();
+
+  // Fills cube with the current around the waypoints from first to last.
+  // Returns false if there is no current station near the route. Nodes
+  // with no station within m_Radius have no data.
+  bool Build(TCMgr& tcmgr, const std::vector<PassageWaypoint>& waypoints,
+             time_t first, time_t last, CurrentCube& cube);
+
+  double m_Radius;    // NM, the furthest station used for a node
+  int m_Neighbours;   // stations blended at each node
+  double m_Power;     // of the inverse distance weights
+  double m_Spacing;   // NM between grid nodes, at least
+  int m_Step;         // seconds between time steps
+  int m_MaxNodes;     // the spacing grows to keep to this many nodes
+  int m_Stations;     // stations used by the last Build
+};
+
+#endif
@@ -0,0 +1,229 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  otidalroute Plugin
+ * Author:   Mike Rossiter
+ *
+ ***************************************************************************
+ *   Copyright (C) 2016 by Mike Rossiter  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+
+#include "StationIndex.h"
+
+#include <algorithm>
+#include <math.h>
+
+// Stations in a leaf of the tree
+static const int LEAF_SIZE = 8;
+
+static double deg2rad(double degrees) { return M_PI * degrees / 180.0; }
+
+// Haversine of an angle in degrees. Distances are compared as the
+// haversine of the central angle, which grows with the distance.
+static double hav(double degrees) {
+  double s = sin(deg2rad(degrees) / 2);
+  return s * s;
+}
+
+// Degrees east from lon0 to lon1, 0 to 360
+static double east(double lon0, double lon1) {
+  double d = fmod(lon1 - lon0, 360);
+  return d < 0 ? d + 360 : d;
+}
+
+static bool ByDistance(const StationHit& a, const StationHit& b) {
+  return a.dist < b.dist;
+}
+
+unsigned StationIndex::TypeFlag(char type) {
+  switch (type) {
+    case 'T':
+      return STATION_TIDE;
+    case 't':
+      return STATION_TIDE_SECONDARY;
+    case 'C':
+      return STATION_CURRENT;
+    case 'c':
+      return STATION_CURRENT_SECONDARY;
+  }
+  return 0;
+}
+
+void StationIndex::Build(const std::vector<StationRef>& stations) {
+  Clear();
+  for (size_t i = 0; i < stations.size(); i++) {
+    Point p;
+    p.type = TypeFlag(stations[i].type);
+    if (!p.type || !(fabs(stations[i].lat) <= 90)) continue;
+    p.lat = stations[i].lat;
+    p.lon = east(-180, stations[i].lon) - 180;  // -180 to 180
+    p.idx = stations[i].idx;
+    m_Points.push_back(p);
+  }
+  if (m_Points.empty()) return;
+
+  m_Nodes.reserve(2 * m_Points.size() / LEAF_SIZE + 1);
+  BuildNode(0, m_Points.size());
+}
+
+void StationIndex::Clear() {
+  m_Points.clear();
+  m_Nodes.clear();
+}
+
+int StationIndex::BuildNode(int begin, int end) {
+  Node node;
+  node.latMin = node.lonMin = 1e9;
+  node.latMax = node.lonMax = -1e9;
+  node.types = 0;
+  for (int i = begin; i < end; i++) {
+    const Point& p = m_Points[i];
+    node.latMin = std::min(node.latMin, p.lat);
+    node.latMax = std::max(node.latMax, p.lat);
+    node.lonMin = std::min(node.lonMin, p.lon);
+    node.lonMax = std::max(node.lonMax, p.lon);
+    node.types |= p.type;
+  }
+  node.begin = begin;
+  node.end = end;
+  node.left = node.right = -1;
+
+  int n = m_Nodes.size();
+  m_Nodes.push_back(node);
+  if (end - begin <= LEAF_SIZE) return n;
+
+  // Split at the median of the longer side, in NM rather than degrees
+  double coslat = cos(deg2rad((node.latMin + node.latMax) / 2));
+  bool byLat = node.latMax - node.latMin >= (node.lonMax - node.lonMin) * coslat;
+  int mid = (begin + end) / 2;
+  std::nth_element(m_Points.begin() + begin, m_Points.begin() + mid,
+                   m_Points.begin() + end,
+                   [byLat](const Point& a, const Point& b) {
+                     return byLat ? a.lat < b.lat : a.lon < b.lon;
+                   });
+
+  int left = BuildNode(begin, mid);
+  int right = BuildNode(mid, end);
+  m_Nodes[n].left = left;
+  m_Nodes[n].right = right;
+  return n;
+}
+
+void StationIndex::Nearest(double lat, double lon, size_t k, unsigned types,
+                           std::vector<StationHit>& hits,
+                           double maxDist) const {
+  hits.clear();
+  if (m_Nodes.empty() || k == 0) return;
+
+  // Farthest hit kept at the front of the heap
+  double bound = maxDist > 0 ? hav(std::min(maxDist / 60, 180.0)) : 2;
+  NearestNode(0, lat, lon, cos(deg2rad(lat)), k, types, hits, bound);
+
+  std::sort_heap(hits.begin(), hits.end(), ByDistance);
+  for (size_t i = 0; i < hits.size(); i++)
+    hits[i].dist = 2 * asin(sqrt(std::min(hits[i].dist, 1.0))) * 180 / M_PI * 60;
+}
+
+void StationIndex::NearestNode(int n, double lat, double lon, double coslat,
+                               size_t k, unsigned types,
+                               std::vector<StationHit>& heap,
+                               double& bound) const {
+  const Node& node = m_Nodes[n];
+
+  if (node.left < 0) {
+    for (int i = node.begin; i < node.end; i++) {
+      const Point& p = m_Points[i];
+      if (!(p.type & types)) continue;
+      StationHit hit;
+      hit.idx = p.idx;
+      hit.dist = hav(p.lat - lat) +
+                 coslat * cos(deg2rad(p.lat)) * hav(p.lon - lon);
+      if (hit.dist > bound) continue;
+      if (heap.size() == k) {
+        std::pop_heap(heap.begin(), heap.end(), ByDistance);
+        heap.pop_back();
+      }
+      heap.push_back(hit);
+      std::push_heap(heap.begin(), heap.end(), ByDistance);
+      if (heap.size() == k) bound = std::min(bound, heap.front().dist);
+    }
+    return;
+  }
+
+  // Nearer child first, skipping those with nothing closer than the bound
+  // or no stations of the kinds wanted
+  double lb[2];
+  int child[2] = {node.left, node.right};
+  for (int c = 0; c < 2; c++) {
+    const Node& cn = m_Nodes[child[c]];
+    double dlat = lat < cn.latMin   ? cn.latMin - lat
+                  : lat > cn.latMax ? lat - cn.latMax
+                                    : 0;
+    double dlon = 0;
+    if (lon < cn.lonMin || lon > cn.lonMax)
+      dlon = std::min(east(lon, cn.lonMin), east(cn.lonMax, lon));
+    double cosmin = std::min(cos(deg2rad(cn.latMin)), cos(deg2rad(cn.latMax)));
+    lb[c] = cn.types & types
+                ? hav(dlat) + coslat * cosmin * hav(std::min(dlon, 180.0))
+                : 3;
+  }
+  int first = lb[1] < lb[0];
+  if (lb[first] <= bound)
+    NearestNode(child[first], lat, lon, coslat, k, types, heap, bound);
+  if (lb[!first] <= bound)
+    NearestNode(child[!first], lat, lon, coslat, k, types, heap, bound);
+}
+
+void StationIndex::InBox(double latMin, double lonMin, double latMax,
+                         double lonMax, unsigned types,
+                         std::vector<int>& idx) const {
+  idx.clear();
+  if (m_Nodes.empty()) return;
+
+  lonMin = east(-180, lonMin) - 180;
+  lonMax = east(-180, lonMax) - 180;
+  if (lonMin <= lonMax)
+    InBoxNode(0, latMin, lonMin, latMax, lonMax, types, idx);
+  else {  // across the antimeridian
+    InBoxNode(0, latMin, lonMin, latMax, 180, types, idx);
+    InBoxNode(0, latMin, -180, latMax, lonMax, types, idx);
+  }
+}
+
+void StationIndex::InBoxNode(int n, double latMin, double lonMin,
+                             double latMax, double lonMax, unsigned types,
+                             std::vector<int>& idx) const {
+  const Node& node = m_Nodes[n];
+  if (!(node.types & types) || node.latMin > latMax || node.latMax < latMin ||
+      node.lonMin > lonMax || node.lonMax < lonMin)
+    return;
+
+  if (node.left < 0) {
+    for (int i = node.begin; i < node.end; i++) {
+      const Point& p = m_Points[i];
+      if (p.type & types && p.lat >= latMin && p.lat <= latMax &&
+          p.lon >= lonMin && p.lon <= lonMax)
+        idx.push_back(p.idx);
+    }
+    return;
+  }
+  InBoxNode(node.left, latMin, lonMin, latMax, lonMax, types, idx);
+  InBoxNode(node.right, latMin, lonMin, latMax, lonMax, types, idx);
+}
@@ -0,0 +1,109 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  otidalroute Plugin
+ * Author:   Mike Rossiter
+ *
+ ***************************************************************************
+ *   Copyright (C) 2016 by Mike Rossiter  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+
+#ifndef _STATIONINDEX_H_
+#define _STATIONINDEX_H_
+
+#include <stddef.h>
+#include <vector>
+
+// A k-d tree over the tide and current stations of the harmonic index,
+// built once and then queried for the stations nearest a position or
+// inside a lat/lon box. Each node keeps the lat/lon bounds of its stations
+// and the kinds of station below it, so a query only visits the parts of
+// the tree that may hold a wanted station.
+//
+// The index does not change after Build, so it may be queried from
+// several threads at the same time.
+
+// Kinds of station, for the type filters
+enum {
+  STATION_TIDE = 1,               // T, reference tide station
+  STATION_TIDE_SECONDARY = 2,     // t
+  STATION_CURRENT = 4,            // C, reference current station
+  STATION_CURRENT_SECONDARY = 8,  // c
+  STATION_ALL_TIDES = STATION_TIDE | STATION_TIDE_SECONDARY,
+  STATION_ALL_CURRENTS = STATION_CURRENT | STATION_CURRENT_SECONDARY,
+  STATION_ALL = STATION_ALL_TIDES | STATION_ALL_CURRENTS
+};
+
+struct StationRef {
+  int idx;  // TCMgr index of the station
+  double lat, lon;
+  char type;  // IDX_type, one of TtCc
+};
+
+struct StationHit {
+  int idx;
+  double dist;  // NM, great circle
+};
+
+class StationIndex {
+public:
+  StationIndex() {}
+
+  // Stations of other types than TtCc are left out
+  void Build(const std::vector<StationRef>& stations);
+  void Clear();
+  size_t Size() const { return m_Points.size(); }
+
+  // The k stations of the given kinds nearest lat/lon, closest first,
+  // no further than maxDist NM if it is more than 0
+  void Nearest(double lat, double lon, size_t k, unsigned types,
+               std::vector<StationHit>& hits, double maxDist = 0) const;
+  // Stations of the given kinds in the box, in no particular order.
+  // The box crosses the antimeridian if lonMin is more than lonMax.
+  void InBox(double latMin, double lonMin, double latMax, double lonMax,
+             unsigned types, std::vector<int>& idx) const;
+
+  static unsigned TypeFlag(char type);
+
+private:
+  struct Point {
+    double lat, lon;
+    int idx;
+    unsigned type;
+  };
+  struct Node {
+    double latMin, latMax, lonMin, lonMax;
+    unsigned types;      // kinds of station below the node
+    int begin, end;      // its points
+    int left, right;     // children, -1 for a leaf
+  };
+
+  int BuildNode(int begin, int end);
+  void NearestNode(int n, double lat, double lon, double coslat, size_t k,
+                   unsigned types, std::vector<StationHit>& heap,
+                   double& bound) const;
+  void InBoxNode(int n, double latMin, double lonMin, double latMax,
+                 double lonMax, unsigned types, std::vector<int>& idx) const;
+
+  std::vector<Point> m_Points;
+  std::vector<Node> m_Nodes;
+};
+
+#endif
@@ -0,0 +1,334 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  otidalroute Plugin
+ * Author:   Mike Rossiter
+ *
+ ***************************************************************************
+ *   Copyright (C) 2016 by Mike Rossiter  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+#include "TidalPassageEngine.h"
+#include "NavFunc.h"
+
+#include <algorithm>
+#include <math.h>
+
+static double deg2rad(double degrees) { return M_PI * degrees / 180.0; }
+
+static double rad2deg(double radians) { return 180.0 * radians / M_PI; }
+
+static void CTSWithCurrent(double BG, double& VBG, double C, double VC,
+                           double& BC, double VBC) {
+  if (VC == 0) {  // short-cut if no current
+    BC = BG, VBG = VBC;
+    return;
+  }
+
+  // Thanks to Geoff Sargent at "tidalstreams.net"
+
+  double B5 = VC / VBC;
+  double C1 = deg2rad(BG);
+  double C2 = deg2rad(C);
+
+  double C6 = asin(B5 * sin(C1 - C2));
+  double B6 = rad2deg(C6);
+  if ((BG + B6) > 360) {
+    BC = BG + B6 - 360;
+  } else if ((BG + B6) < 0) {
+    BC = BG + B6 + 360;
+  } else {
+    BC = BG + B6;
+  }
+  VBG = (VBC * cos(C6)) + (VC * cos(C1 - C2));
+}
+
+// Same truncation to whole seconds as otidalrouteUIDialog::AdvanceSeconds
+static time_t AdvanceHours(time_t t, double hours) {
+  int secondsToAdvance = hours * 3600;
+  return t + secondsToAdvance;
+}
+
+static void AddPoint(PassageResult& result, double lat, double lon, time_t t,
+                     int waypoint, int epNumber, double distTo, double brgTo,
+                     double cts, double smg, double set, double rate) {
+  PassagePoint p;
+  p.lat = lat;
+  p.lon = lon;
+  p.time = t;
+  p.waypoint = waypoint;
+  p.epNumber = epNumber;
+  p.distTo = distTo;
+  p.brgTo = brgTo;
+  p.cts = cts;
+  p.smg = smg;
+  p.set = set;
+  p.rate = rate;
+
+  result.points.push_back(p);
+  result.distance += distTo;
+}
+
+TidalPassageEngine::TidalPassageEngine(double speed, CurrentSampler* sampler,
+                                       double tolerance)
+    : m_Speed(speed), m_Sampler(sampler), m_Tolerance(tolerance) {}
+
+bool TidalPassageEngine::Steer(time_t t, double lat, double lon, double brg,
+                               double& cts, double& smg, double& set,
+                               double& rate, PassageResult& result) const {
+  set = 0;
+  rate = 0;
+  if (m_Sampler) {
+    result.samples++;
+    if (!m_Sampler->GetCurrent(t, lat, lon, rate, set)) {
+      result.status = PASSAGE_NO_CURRENT;
+      return false;
+    }
+  }
+
+  CTSWithCurrent(brg, smg, set, rate, cts, m_Speed);
+
+  // Cross current stronger than the boat speed, or a head current that
+  // stops us making ground towards the next waypoint
+  if (!(smg > 0)) {
+    result.status = PASSAGE_CURRENT_TOO_STRONG;
+    return false;
+  }
+  return true;
+}
+
+PassageResult TidalPassageEngine::Run(
+    const std::vector<PassageWaypoint>& waypoints, time_t start) const {
+  PassageResult result;
+  result.status = PASSAGE_OK;
+  result.start = start;
+  result.end = start;
+  result.distance = 0;
+  result.steps = 0;
+  result.samples = 0;
+
+  if (waypoints.size() < 2 || !(m_Speed > 0)) {
+    result.status = PASSAGE_BAD_INPUT;
+    return result;
+  }
+  for (size_t i = 0; i < waypoints.size(); i++) {
+    if (fabs(waypoints[i].lat) > 90 || fabs(waypoints[i].lon) > 180) {
+      result.status = PASSAGE_BAD_INPUT;
+      return result;
+    }
+  }
+
+  if (m_Tolerance > 0) return RunAdaptive(waypoints, result);
+  return RunHourly(waypoints, result);
+}
+
+PassageResult TidalPassageEngine::RunHourly(
+    const std::vector<PassageWaypoint>& waypoints,
+    PassageResult& result) const {
+  int n = waypoints.size() - 1;
+  time_t now = result.start;
+
+  double timeToRun = 1;  // part of the hour still to run before the next EP
+  double ptrDist = 0;    // distance run since the last plotted point
+  double brg = 0, cts = 0, smg = m_Speed, set = 0, rate = 0;
+  double waypointDistance = 0, timeToWaypoint = 0;
+  int epNumber = 0;
+
+  for (int wpn = 0; wpn < n; wpn++) {
+    const PassageWaypoint& from = waypoints[wpn];
+    const PassageWaypoint& to = waypoints[wpn + 1];
+
+    double brgIn = brg;
+    DistanceBearingMercator(to.lat, to.lon, from.lat, from.lon,
+                            &waypointDistance, &brg);
+
+    // For the tidal current we use the position at the waypoint and the
+    // current time. This is an approximation.
+    if (!Steer(now, from.lat, from.lon, brg, cts, smg, set, rate, result))
+      return result;
+
+    AddPoint(result, from.lat, from.lon, now, wpn, 0, wpn == 0 ? 0 : ptrDist,
+             brgIn, cts, smg, set, rate);
+
+    timeToWaypoint = waypointDistance / smg;
+
+    if (timeToWaypoint < timeToRun) {
+      // No space for an EP. The next position plotted is the route waypoint.
+      timeToRun = timeToRun - timeToWaypoint;
+      now = AdvanceHours(now, timeToWaypoint);
+      ptrDist = waypointDistance;
+      continue;
+    }
+
+    // Plot an EP every hour until we are less than an hour from the next
+    // waypoint. The first EP of the leg uses what is left of the hour.
+    double lat = from.lat, lon = from.lon;
+    double run = timeToRun;
+    for (;;) {
+      double brgRun = brg;
+      ptrDist = run * smg;
+      if (!destLoxodrome(lat, lon, brgRun, ptrDist, &lat, &lon)) {
+        result.status = PASSAGE_BAD_INPUT;
+        return result;
+      }
+      now = AdvanceHours(now, run);
+
+      DistanceBearingMercator(to.lat, to.lon, lat, lon, &waypointDistance,
+                              &brg);  // how far to the next waypoint?
+
+      if (!Steer(now, lat, lon, brg, cts, smg, set, rate, result))
+        return result;
+
+      epNumber++;
+      AddPoint(result, lat, lon, now, -1, epNumber, ptrDist, brgRun, cts, smg,
+               set, rate);
+
+      timeToWaypoint = waypointDistance / smg;
+      if (timeToWaypoint < 1) break;  // no time for another EP
+      run = 1;
+    }
+
+    timeToRun = 1 - timeToWaypoint;
+    now = AdvanceHours(now, timeToWaypoint);
+    ptrDist = waypointDistance;
+  }
+
+  // The last waypoint
+  AddPoint(result, waypoints[n].lat, waypoints[n].lon, now, n, 0, ptrDist, brg,
+           cts, smg, set, rate);
+  result.end = now;
+  result.steps = result.points.size() - 1;
+
+  return result;
+}
+
+// Integrates the distance run along each leg, ds/dt = speed made good, with
+// the adaptive Bogacki-Shampine 3(2) pair. The step grows in slack water and
+// shrinks where the current changes quickly, keeping the estimated ETA error
+// inside the tolerance. EPs are still plotted every hour of the passage.
+PassageResult TidalPassageEngine::RunAdaptive(
+    const std::vector<PassageWaypoint>& waypoints,
+    PassageResult& result) const {
+  int n = waypoints.size() - 1;
+
+  // Spread the allowed ETA error over the expected passage time
+  double routeDist = 0, legDist, legBrg;
+  for (int i = 0; i < n; i++) {
+    DistanceBearingMercator(waypoints[i + 1].lat, waypoints[i + 1].lon,
+                            waypoints[i].lat, waypoints[i].lon, &legDist,
+                            &legBrg);
+    routeDist += legDist;
+  }
+  double expected = std::max(routeDist / m_Speed, 1.0);
+  double tol = m_Tolerance / 60 / expected;  // hours of error per hour run
+
+  const double hMin = 1.0 / 60, hMax = 1;
+  double t = 0;       // hours since the start
+  double nextEP = 1;  // time of the next EP
+  double h = 0.25;
+  double ptrDist = 0;  // distance run since the last plotted point
+  double brgIn = 0, cts = 0, smg = m_Speed, set = 0, rate = 0;
+  int epNumber = 0;
+
+  for (int wpn = 0; wpn < n; wpn++) {
+    const PassageWaypoint& from = waypoints[wpn];
+    const PassageWaypoint& to = waypoints[wpn + 1];
+
+    double L, brg;
+    DistanceBearingMercator(to.lat, to.lon, from.lat, from.lon, &L, &brg);
+
+    time_t now = result.start + (time_t)floor(t * 3600 + 0.5);
+    if (!Steer(now, from.lat, from.lon, brg, cts, smg, set, rate, result))
+      return result;
+    AddPoint(result, from.lat, from.lon, now, wpn, 0, wpn == 0 ? 0 : ptrDist,
+             brgIn, cts, smg, set, rate);
+    ptrDist = 0;
+
+    // Speed made good at time tt, distance s along the leg. The last
+    // evaluation is kept for plotting an EP.
+    double lat, lon, fcts, fset, frate;
+    auto flow = [&](double tt, double s, double& v) -> bool {
+      if (!destLoxodrome(from.lat, from.lon, brg, s, &lat, &lon)) {
+        result.status = PASSAGE_BAD_INPUT;
+        return false;
+      }
+      return Steer(result.start + (time_t)floor(tt * 3600 + 0.5), lat, lon,
+                   brg, fcts, v, fset, frate, result);
+    };
+
+    double s = 0, k1 = smg, k2, k3, k4;
+    while (s < L) {
+      double hTry = std::min(h, nextEP - t);
+      if (!flow(t + hTry / 2, s + hTry / 2 * k1, k2)) return result;
+      if (!flow(t + hTry * 3 / 4, s + hTry * 3 / 4 * k2, k3)) return result;
+      double s3 = s + hTry * (2 * k1 / 9 + k2 / 3 + 4 * k3 / 9);
+      if (!flow(t + hTry, s3, k4)) return result;
+      double s2 = s + hTry * (7 * k1 / 24 + k2 / 4 + k3 / 3 + k4 / 8);
+
+      double err = fabs(s3 - s2) / ((s3 - s) / hTry);  // hours of ETA
+      double allowed = tol * hTry;
+
+      if (err > allowed && hTry > hMin) {  // reject the step
+        h = std::max(hMin, hTry * std::max(0.2, 0.9 * cbrt(allowed / err)));
+        continue;
+      }
+
+      result.steps++;
+      h = err > 0 ? std::min(hMax,
+                             hTry * std::min(5.0, 0.9 * cbrt(allowed / err)))
+                  : hMax;
+
+      if (s3 >= L) {
+        // Passed the waypoint during the step
+        t += hTry * (L - s) / (s3 - s);
+        ptrDist += L - s;
+        break;
+      }
+
+      ptrDist += s3 - s;
+      s = s3;
+      t += hTry;
+      k1 = k4;  // first same as last
+
+      if (t >= nextEP - 1e-9) {
+        t = nextEP;
+        nextEP += 1;
+
+        cts = fcts;
+        smg = k4;
+        set = fset;
+        rate = frate;
+
+        epNumber++;
+        AddPoint(result, lat, lon,
+                 result.start + (time_t)floor(t * 3600 + 0.5), -1, epNumber,
+                 ptrDist, brg, cts, smg, set, rate);
+        ptrDist = 0;
+      }
+    }
+    brgIn = brg;
+  }
+
+  // The last waypoint
+  result.end = result.start + (time_t)floor(t * 3600 + 0.5);
+  AddPoint(result, waypoints[n].lat, waypoints[n].lon, result.end, n, 0,
+           ptrDist, brgIn, cts, smg, set, rate);
+
+  return result;
+}
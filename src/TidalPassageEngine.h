@@ -0,0 +1,113 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  otidalroute Plugin
+ * Author:   Mike Rossiter
+ *
+ ***************************************************************************
+ *   Copyright (C) 2016 by Mike Rossiter  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+#ifndef _TIDALPASSAGEENGINE_H_
+#define _TIDALPASSAGEENGINE_H_
+
+#include <stddef.h>
+#include <time.h>
+#include <vector>
+
+// The passage engine has no wxWidgets or OpenCPN dependencies so that it can
+// be run off the GUI thread, in batch jobs and in benchmarks.
+
+struct PassageWaypoint {
+  double lat, lon;
+};
+
+// Source of the tidal current along the passage.
+// set is the direction the current is flowing towards (degrees true),
+// rate is in knots. Returns false if no current is available for the
+// time/position.
+class CurrentSampler {
+public:
+  virtual ~CurrentSampler() {}
+  virtual bool GetCurrent(time_t t, double lat, double lon, double& rate,
+                          double& set) = 0;
+};
+
+// One plotted position of the passage: a route waypoint or an hourly EP.
+struct PassagePoint {
+  double lat, lon;
+  time_t time;
+  int waypoint;  // index into the route waypoints, -1 for an EP
+  int epNumber;  // 1 for the first EP, 0 for a waypoint
+  double distTo;  // NM run from the previous point
+  double brgTo;   // course made good from the previous point
+  double cts;     // course to steer from this point
+  double smg;     // speed made good from this point
+  double set, rate;
+};
+
+enum PassageStatus {
+  PASSAGE_OK = 0,
+  PASSAGE_BAD_INPUT,
+  PASSAGE_NO_CURRENT,
+  PASSAGE_CURRENT_TOO_STRONG
+};
+
+struct PassageResult {
+  PassageStatus status;
+  std::vector<PassagePoint> points;
+  time_t start, end;
+  double distance;  // NM
+  int steps;    // integration steps taken
+  int samples;  // current samples used
+
+  double Hours() const { return (double)((end - start) / 60) / 60; }
+};
+
+class TidalPassageEngine {
+public:
+  // A NULL sampler gives a DR passage (no current)
+  TidalPassageEngine(double speed, CurrentSampler* sampler = NULL,
+                     double tolerance = 0);
+
+  // Runs the passage from the first to the last waypoint, plotting an EP
+  // for every hour of the passage. Does not modify the engine, so one
+  // engine may be run for several departures.
+  PassageResult Run(const std::vector<PassageWaypoint>& waypoints,
+                    time_t start) const;
+
+  double m_Speed;  // boat speed through the water (kts)
+  CurrentSampler* m_Sampler;
+  // Allowed ETA error (minutes) for the adaptive integrator.
+  // 0 steps a whole hour at a time with the current sampled at the start
+  // of each hour.
+  double m_Tolerance;
+
+private:
+  bool Steer(time_t t, double lat, double lon, double brg, double& cts,
+             double& smg, double& set, double& rate,
+             PassageResult& result) const;
+
+  PassageResult RunHourly(const std::vector<PassageWaypoint>& waypoints,
+                          PassageResult& result) const;
+  PassageResult RunAdaptive(const std::vector<PassageWaypoint>& waypoints,
+                            PassageResult& result) const;
+};
+
+#endif
@@ -38,6 +38,7 @@
 #include "otidalrouteUIDialog.h"
 #include "otidalrouteUIDialogBase.h"
 #include "otidalrouteOverlayFactory.h"
+#include <cmath>
 #include <vector>
 #include "bbox.h"
 
@@ -102,40 +103,152 @@ otidalrouteOverlayFactory::otidalrouteOverlayFactory(otidalrouteUIDialog &dlg)
   m_bShowFillColour = m_dlg.m_bUseFillColour;
 
   m_dtUseNew = m_dlg.m_dtNow;
+
+  m_glArrowBuilt = false;
+  m_labelFont = wxFont(12, wxFONTFAMILY_DEFAULT, wxFONTSTYLE_NORMAL,
+                       wxFONTWEIGHT_NORMAL);
+
+  // Set up the scaler
+  int mmx, mmy;
+  wxDisplaySizeMM(&mmx, &mmy);
+
+  int sx, sy;
+  wxDisplaySize(&sx, &sy);
+
+  double pix_per_mm = ((double)sx) / ((double)mmx);
+
+  int mm_per_knot = 10;
+  m_drawScaler = mm_per_knot * pix_per_mm * 100 / 100.0;
+
+  m_frameValid = false;
+  m_frameList = 0;
 }
 
-otidalrouteOverlayFactory::~otidalrouteOverlayFactory() {}
+otidalrouteOverlayFactory::~otidalrouteOverlayFactory() {
+#ifndef USE_GLSL
+  if (m_frameList) glDeleteLists(m_frameList, 1);
+#endif
+}
 
-void otidalrouteOverlayFactory::Reset() {}
+void otidalrouteOverlayFactory::Reset() {
+  m_frameValid = false;
+  m_glArrowBuilt = false;
+}
 
 bool otidalrouteOverlayFactory::RenderOverlay(piDC &dc, PlugIn_ViewPort &vp) {
   m_pdc = &dc;
 
-  if (!dc.GetDC()) {
-    if (!glQueried) {
-      glQueried = true;
-    }
+  if (!m_dlg.b_showTidalArrow) return true;
+
+  bool gl = !dc.GetDC();
+  bool valid = FrameValid(vp, gl);
+
+  if (!gl) {
+    RenderDCFrame(dc, vp, valid);
+    return true;
+  }
+
+  if (!glQueried) {
+    glQueried = true;
+  }
 #ifndef USE_GLSL
-    glPushAttrib(GL_LINE_BIT | GL_ENABLE_BIT | GL_HINT_BIT);  // Save state
+  glPushAttrib(GL_LINE_BIT | GL_ENABLE_BIT | GL_HINT_BIT);  // Save state
 
-    //      Enable anti-aliased lines, at best quality
-    glEnable(GL_LINE_SMOOTH);
-    glHint(GL_LINE_SMOOTH_HINT, GL_NICEST);
+  //      Enable anti-aliased lines, at best quality
+  glEnable(GL_LINE_SMOOTH);
+  glHint(GL_LINE_SMOOTH_HINT, GL_NICEST);
 
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 #endif
-    glEnable(GL_BLEND);
-  }
+  glEnable(GL_BLEND);
+
+  m_pdc->SetFont(m_labelFont);
 
-  wxFont font(12, wxFONTFAMILY_DEFAULT, wxFONTSTYLE_NORMAL,
-              wxFONTWEIGHT_NORMAL);
-  m_pdc->SetFont(font);
+#ifndef USE_GLSL
+  // The frame is kept in a display list. The glyph texture has to be made
+  // beforehand, or its upload would be recorded in the list too.
+  bool keep = !(m_bShowRate || m_bShowDirection) || m_glyphs.Build(m_labelFont);
+  if (keep && valid)
+    glCallList(m_frameList);
+  else if (keep) {
+    if (!m_frameList) m_frameList = glGenLists(1);
+    glNewList(m_frameList, GL_COMPILE_AND_EXECUTE);
+    DrawAllCurrentsInViewPort(&vp, false, false, false, m_dtUseNew);
+    glEndList();
+    FrameDrawn(vp, gl);
+  } else {
+    DrawAllCurrentsInViewPort(&vp, false, false, false, m_dtUseNew);
+    m_frameValid = false;
+  }
 
-  wxColour myColour = wxColour("RED");
+  glPopAttrib();
+#else
   DrawAllCurrentsInViewPort(&vp, false, false, false, m_dtUseNew);
+#endif
   return true;
 }
 
+// Whether the kept frame shows what vp would now
+bool otidalrouteOverlayFactory::FrameValid(PlugIn_ViewPort &vp, bool gl) {
+  if (!m_frameValid || m_frameGL != gl ||
+      m_frameSerial != m_dlg.m_arrowSerial || m_frameRate != m_bShowRate ||
+      m_frameDirection != m_bShowDirection ||
+      m_frameFillColour != m_bShowFillColour)
+    return false;
+
+  for (int i = 0; i < 5; i++)
+    if (m_frameColours[i] != m_dlg.myUseColour[i]) return false;
+
+  const PlugIn_ViewPort &f = m_frameVp;
+  return vp.clat == f.clat && vp.clon == f.clon &&
+         vp.view_scale_ppm == f.view_scale_ppm && vp.rotation == f.rotation &&
+         vp.skew == f.skew && vp.pix_width == f.pix_width &&
+         vp.pix_height == f.pix_height &&
+         vp.m_projection_type == f.m_projection_type;
+}
+
+void otidalrouteOverlayFactory::FrameDrawn(PlugIn_ViewPort &vp, bool gl) {
+  m_frameValid = true;
+  m_frameGL = gl;
+  m_frameVp = vp;
+  m_frameSerial = m_dlg.m_arrowSerial;
+  m_frameRate = m_bShowRate;
+  m_frameDirection = m_bShowDirection;
+  m_frameFillColour = m_bShowFillColour;
+  for (int i = 0; i < 5; i++) m_frameColours[i] = m_dlg.myUseColour[i];
+}
+
+// Without GL the frame is kept in a bitmap, masked where nothing was drawn
+void otidalrouteOverlayFactory::RenderDCFrame(piDC &dc, PlugIn_ViewPort &vp,
+                                              bool valid) {
+  static const wxColour mask(1, 1, 1);
+
+  if (vp.pix_width <= 0 || vp.pix_height <= 0) return;
+
+  if (!valid || !m_frameBitmap.IsOk()) {
+    if (!m_frameBitmap.IsOk() || m_frameBitmap.GetWidth() != vp.pix_width ||
+        m_frameBitmap.GetHeight() != vp.pix_height)
+      m_frameBitmap.Create(vp.pix_width, vp.pix_height);
+    m_frameBitmap.SetMask(NULL);
+
+    wxMemoryDC mdc(m_frameBitmap);
+    mdc.SetBackground(wxBrush(mask));
+    mdc.Clear();
+
+    piDC pdc(mdc);
+    pdc.SetFont(m_labelFont);
+    m_pdc = &pdc;
+    DrawAllCurrentsInViewPort(&vp, false, false, false, m_dtUseNew);
+    m_pdc = &dc;
+
+    mdc.SelectObject(wxNullBitmap);
+    m_frameBitmap.SetMask(new wxMask(m_frameBitmap, mask));
+    FrameDrawn(vp, false);
+  }
+
+  dc.DrawBitmap(m_frameBitmap, 0, 0, true);
+}
+
 void otidalrouteOverlayFactory::DrawMessageWindow(wxString msg, int x, int y,
                                                   wxFont *mfont) {
   if (msg.empty()) return;
@@ -286,6 +399,157 @@ void otidalrouteOverlayFactory::drawCurrentArrow(int x, int y, double rot_angle,
   }
 }
 
+// The arrows to draw at the scale of vp, merged cell by cell when they
+// would crowd each other
+void otidalrouteOverlayFactory::ArrowsAtScale(PlugIn_ViewPort *vp,
+                                              const std::vector<Arrow> *&arrows,
+                                              const StationIndex *&index) {
+  int level = m_dlg.ArrowLevelFor(vp->view_scale_ppm);
+  if (level < 0) {
+    arrows = &m_dlg.m_arrowList;
+    index = &m_dlg.m_arrowIndex;
+  } else {
+    arrows = &m_dlg.m_arrowLevels[level].arrows;
+    index = &m_dlg.m_arrowLevels[level].index;
+  }
+}
+
+bool otidalrouteOverlayFactory::GLArrowsValid(PlugIn_ViewPort *vp,
+                                              float draw_scaler) {
+  if (!m_glArrowBuilt || m_glArrowSerial != m_dlg.m_arrowSerial ||
+      m_glArrowScale != vp->view_scale_ppm ||
+      m_glArrowProjection != vp->m_projection_type ||
+      m_glArrowScaler != draw_scaler ||
+      m_glArrowFillColour != m_bShowFillColour)
+    return false;
+
+  for (int i = 0; i < 5; i++)
+    if (m_glArrowColours[i] != m_dlg.myUseColour[i]) return false;
+
+  // Only in Mercator does a pan move all the pixels alike
+  if (vp->m_projection_type != PI_PROJECTION_MERCATOR &&
+      (vp->clat != m_glArrowLat || vp->clon != m_glArrowLon))
+    return false;
+
+  return vp->lat_min >= m_glArrowLatMin && vp->lat_max <= m_glArrowLatMax &&
+         vp->lon_min >= m_glArrowLonMin && vp->lon_max <= m_glArrowLonMax;
+}
+
+void otidalrouteOverlayFactory::BuildGLArrows(PlugIn_ViewPort *vp,
+                                              float draw_scaler) {
+  m_glArrowFill.clear();
+  m_glArrowLines.clear();
+
+  m_glArrowBuilt = true;
+  m_glArrowSerial = m_dlg.m_arrowSerial;
+  m_glArrowScale = vp->view_scale_ppm;
+  m_glArrowProjection = vp->m_projection_type;
+  m_glArrowScaler = draw_scaler;
+  m_glArrowFillColour = m_bShowFillColour;
+  for (int i = 0; i < 5; i++) m_glArrowColours[i] = m_dlg.myUseColour[i];
+
+  // The pixels of the viewport without its rotation, which is left to GL
+  PlugIn_ViewPort nvp = *vp;
+  nvp.rotation = 0;
+  m_glArrowLat = vp->clat;
+  m_glArrowLon = vp->clon;
+  GetCanvasPixLL(&nvp, &m_glArrowCentre, vp->clat, vp->clon);
+
+  // Cover half the viewport again on each side, so most pans need nothing
+  double latSpan = vp->lat_max - vp->lat_min;
+  double lonSpan = vp->lon_max - vp->lon_min;
+  m_glArrowLatMin = vp->lat_min - latSpan / 2;
+  m_glArrowLatMax = vp->lat_max + latSpan / 2;
+  m_glArrowLonMin = vp->lon_min - lonSpan / 2;
+  m_glArrowLonMax = vp->lon_max + lonSpan / 2;
+
+  double lonMin = m_glArrowLonMin, lonMax = m_glArrowLonMax;
+  if (lonMax - lonMin >= 360) {
+    lonMin = -180;
+    lonMax = 180;
+  }
+  const std::vector<Arrow> *arrows;
+  const StationIndex *index;
+  ArrowsAtScale(vp, arrows, index);
+  index->InBox(m_glArrowLatMin, lonMin, m_glArrowLatMax, lonMax, STATION_ALL,
+               m_visibleArrows);
+
+  for (size_t i = 0; i < m_visibleArrows.size(); i++) {
+    const Arrow &arrow = (*arrows)[m_visibleArrows[i]];
+
+    // As drawCurrentArrow, the rotation of the chart aside
+    double scale = draw_scaler * log10(arrow.m_force * 5) / 30;
+    if (!std::isfinite(scale)) continue;
+
+    wxPoint pix;
+    GetCanvasPixLL(&nvp, &pix, arrow.m_lat, arrow.m_lon);
+
+    wxColour colour = GetSpeedColour(arrow.m_force);
+    float sin_rot = sin((arrow.m_dir - 90) * PI / 180.);
+    float cos_rot = cos((arrow.m_dir - 90) * PI / 180.);
+
+    GLArrowVertex p[NUM_CURRENT_ARROW_POINTS];
+    for (int ip = 0; ip < NUM_CURRENT_ARROW_POINTS; ip++) {
+      float xt = CurrentArrowArray[ip].x;
+      float yt = CurrentArrowArray[ip].y;
+      p[ip].x = pix.x + ((xt * cos_rot) - (yt * sin_rot)) * scale;
+      p[ip].y = pix.y + ((xt * sin_rot) + (yt * cos_rot)) * scale;
+      p[ip].r = colour.Red();
+      p[ip].g = colour.Green();
+      p[ip].b = colour.Blue();
+      p[ip].a = 255;
+    }
+
+    for (int ip = 1; ip < NUM_CURRENT_ARROW_POINTS; ip++) {
+      m_glArrowLines.push_back(p[ip - 1]);
+      m_glArrowLines.push_back(p[ip]);
+    }
+
+    if (m_bShowFillColour) {  // the head, then the shaft
+      static const int fill[] = {3, 4, 5, 1, 2, 6, 1, 6, 7};
+      for (size_t f = 0; f < sizeof fill / sizeof fill[0]; f++)
+        m_glArrowFill.push_back(p[fill[f]]);
+    }
+  }
+}
+
+void otidalrouteOverlayFactory::DrawGLArrows(PlugIn_ViewPort *vp,
+                                             float draw_scaler) {
+#ifndef USE_GLSL
+  if (!GLArrowsValid(vp, draw_scaler)) BuildGLArrows(vp, draw_scaler);
+  if (m_glArrowLines.empty()) return;
+
+  // Where the centre they were built around is now, and the rotation
+  wxPoint centre;
+  GetCanvasPixLL(vp, &centre, m_glArrowLat, m_glArrowLon);
+
+  glPushMatrix();
+  glTranslated(centre.x, centre.y, 0);
+  glRotated(vp->rotation * 180 / M_PI, 0, 0, 1);
+  glTranslated(-m_glArrowCentre.x, -m_glArrowCentre.y, 0);
+
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_COLOR_ARRAY);
+
+  if (!m_glArrowFill.empty()) {
+    glVertexPointer(2, GL_FLOAT, sizeof(GLArrowVertex), &m_glArrowFill[0].x);
+    glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(GLArrowVertex),
+                   &m_glArrowFill[0].r);
+    glDrawArrays(GL_TRIANGLES, 0, m_glArrowFill.size());
+  }
+
+  glLineWidth(2);
+  glVertexPointer(2, GL_FLOAT, sizeof(GLArrowVertex), &m_glArrowLines[0].x);
+  glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(GLArrowVertex),
+                 &m_glArrowLines[0].r);
+  glDrawArrays(GL_LINES, 0, m_glArrowLines.size());
+
+  glDisableClientState(GL_COLOR_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+  glPopMatrix();
+#endif
+}
+
 wxImage &otidalrouteOverlayFactory::DrawGLText(double value, int precision) {
   wxString labels;
 
@@ -849,19 +1113,8 @@ void otidalrouteOverlayFactory::DrawAllCurrentsInViewPort(
 
   double rot_vp = BBox->rotation * 180 / M_PI;
 
-  // Set up the scaler
-  int mmx, mmy;
-  wxDisplaySizeMM(&mmx, &mmy);
-
-  int sx, sy;
-  wxDisplaySize(&sx, &sy);
-
-  double m_pix_per_mm = ((double)sx) / ((double)mmx);
-
-  int mm_per_knot = 10;
-  float current_draw_scaler = mm_per_knot * m_pix_per_mm * 100 / 100.0;
-
-  // End setting up scaler
+  // The scaler, worked out with the display size once
+  float current_draw_scaler = m_drawScaler;
 
   double tcvalue, dir;
   bool bnew_val = true;
@@ -872,18 +1125,39 @@ void otidalrouteOverlayFactory::DrawAllCurrentsInViewPort(
   double myLat;
   double myLon;
 
-  for (std::list<Arrow>::iterator it = m_dlg.m_arrowList.begin();
-       it != m_dlg.m_arrowList.end(); it++) {
-    myLat = (*it).m_lat;
-    myLon = (*it).m_lon;
-    dir = (*it).m_dir;
-    tcvalue = (*it).m_force;
-
-    myLLBox = new LLBBox;
-    wxBoundingBox LLBBox(BBox->lon_min, BBox->lat_min, BBox->lon_max,
-                         BBox->lat_max);
+  // With GL the arrows go in a few draw calls, and the labels in one
+  bool bGLArrows = false, bGLLabels = false;
+#ifndef USE_GLSL
+  if (!m_pdc->GetDC()) {
+    DrawGLArrows(BBox, current_draw_scaler);
+    if (!m_bShowRate && !m_bShowDirection) return;
+    bGLArrows = true;
+    bGLLabels = m_glyphs.Build(m_labelFont);
+    m_glLabelQuads.clear();
+  }
+#endif
 
-    // if( LLBBox.PointInBox( myLon, myLat, 0 )   )  {
+  // Only the arrows in the viewport, with a margin for those drawn across
+  // its edges
+  double latPad = (BBox->lat_max - BBox->lat_min) * 0.1;
+  double lonPad = (BBox->lon_max - BBox->lon_min) * 0.1;
+  double lonMin = BBox->lon_min - lonPad, lonMax = BBox->lon_max + lonPad;
+  if (lonMax - lonMin >= 360) {
+    lonMin = -180;
+    lonMax = 180;
+  }
+  const std::vector<Arrow> *arrows;
+  const StationIndex *index;
+  ArrowsAtScale(BBox, arrows, index);
+  index->InBox(BBox->lat_min - latPad, lonMin, BBox->lat_max + latPad, lonMax,
+               STATION_ALL, m_visibleArrows);
+
+  for (size_t i = 0; i < m_visibleArrows.size(); i++) {
+    const Arrow &arrow = (*arrows)[m_visibleArrows[i]];
+    myLat = arrow.m_lat;
+    myLon = arrow.m_lon;
+    dir = arrow.m_dir;
+    tcvalue = arrow.m_force;
 
     int pixxc, pixyc;
     wxPoint cpoint;
@@ -898,7 +1172,8 @@ void otidalrouteOverlayFactory::DrawAllCurrentsInViewPort(
     double a2 = log10(a1);
     double scale = current_draw_scaler * a2;
 
-    drawCurrentArrow(pixxc, pixyc, dir - 90 + rot_vp, scale / 30, tcvalue);
+    if (!bGLArrows)
+      drawCurrentArrow(pixxc, pixyc, dir - 90 + rot_vp, scale / 30, tcvalue);
 
     int shift = 10;
 
@@ -906,15 +1181,21 @@ void otidalrouteOverlayFactory::DrawAllCurrentsInViewPort(
 
     if (m_bShowRate) {
       snprintf(sbuf, 19, "%3.1f", fabs(tcvalue));
-      m_pdc->DrawText(wxString(sbuf, wxConvUTF8), pixxc, pixyc);
+      if (bGLLabels)
+        m_glyphs.AddString(sbuf, pixxc, pixyc, m_glLabelQuads);
+      else
+        m_pdc->DrawText(wxString(sbuf, wxConvUTF8), pixxc, pixyc);
       shift = 23;
     }
 
     if (m_bShowDirection) {
       snprintf(sbuf, 19, "%03.0f", dir);
-      m_pdc->DrawText(wxString(sbuf, wxConvUTF8), pixxc, pixyc + shift);
+      if (bGLLabels)
+        m_glyphs.AddString(sbuf, pixxc, pixyc + shift, m_glLabelQuads);
+      else
+        m_pdc->DrawText(wxString(sbuf, wxConvUTF8), pixxc, pixyc + shift);
     }
-
-    // }
   }
+
+  if (bGLLabels) m_glyphs.Draw(m_glLabelQuads, *wxBLACK);
 }
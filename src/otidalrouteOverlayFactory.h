@@ -25,8 +25,10 @@
  */
 
 #include <map>
+#include <vector>
 #include <wx/string.h>
 #include "bbox.h"
+#include "GlyphAtlas.h"
 #include "pidc.h"
 #include "tcmgr.h"
 
@@ -64,6 +66,7 @@ public:
 //----------------------------------------------------------------------------------------------------------
 
 class otidalrouteUIDialog;
+struct Arrow;
 
 class otidalrouteOverlayFactory {
 public:
@@ -117,6 +120,55 @@ public:
 private:
   bool inGL;
 
+  // The arrows for GL as one vertex array each of fills and outlines, in
+  // the pixels of the unrotated viewport they were built for. Panning and
+  // rotating the chart only moves them, they are built again when the
+  // arrows, the scale, the projection or the colours change, or the
+  // viewport leaves the area they cover.
+  struct GLArrowVertex {
+    float x, y;
+    unsigned char r, g, b, a;
+  };
+  void ArrowsAtScale(PlugIn_ViewPort *vp, const std::vector<Arrow> *&arrows,
+                     const StationIndex *&index);
+  bool GLArrowsValid(PlugIn_ViewPort *vp, float draw_scaler);
+  void BuildGLArrows(PlugIn_ViewPort *vp, float draw_scaler);
+  void DrawGLArrows(PlugIn_ViewPort *vp, float draw_scaler);
+
+  std::vector<GLArrowVertex> m_glArrowFill, m_glArrowLines;
+  bool m_glArrowBuilt;
+  unsigned int m_glArrowSerial;
+  double m_glArrowScale;
+  int m_glArrowProjection;
+  float m_glArrowScaler;
+  bool m_glArrowFillColour;
+  wxString m_glArrowColours[5];
+  double m_glArrowLat, m_glArrowLon;  // viewport centre when built
+  wxPoint m_glArrowCentre;            // and its pixel
+  double m_glArrowLatMin, m_glArrowLatMax, m_glArrowLonMin, m_glArrowLonMax;
+
+  // The last frame drawn, kept in a display list with GL or a bitmap
+  // without, and drawn again until the viewport, the arrows or the
+  // settings change
+  bool FrameValid(PlugIn_ViewPort &vp, bool gl);
+  void FrameDrawn(PlugIn_ViewPort &vp, bool gl);
+  void RenderDCFrame(piDC &dc, PlugIn_ViewPort &vp, bool valid);
+
+  float m_drawScaler;  // pixels per knot, from the display size
+  bool m_frameValid;
+  bool m_frameGL;
+  PlugIn_ViewPort m_frameVp;
+  unsigned int m_frameSerial;
+  bool m_frameRate, m_frameDirection, m_frameFillColour;
+  wxString m_frameColours[5];
+  GLuint m_frameList;
+  wxBitmap m_frameBitmap;
+
+  // The rate and direction labels for GL, as quads from the glyph atlas
+  wxFont m_labelFont;
+  GlyphAtlas m_glyphs;
+  std::vector<GlyphVertex> m_glLabelQuads;  // reused by each repaint
+
 
   void DrawMessageWindow(wxString msg, int x, int y, wxFont *mfont);
   double m_last_vp_scale;
@@ -146,7 +198,7 @@ private:
 
   TCMgr *ctcmgr;
   wxBoundingBox *myBox;
-  LLBBox *myLLBox;
+  std::vector<int> m_visibleArrows;  // reused by each repaint
 
   wxString *pTC_Dir;
 };
@@ -45,6 +45,10 @@
 #include <windows.h>
 #endif
 #include <memory.h>
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <thread>
 
 #include <wx/colordlg.h>
 #include <wx/event.h>
@@ -83,29 +87,6 @@ static double deg2rad(double degrees) { return M_PI * degrees / 180.0; }
 
 static double rad2deg(double radians) { return 180.0 * radians / M_PI; }
 
-static void CTSWithCurrent(double BG, double& VBG, double C, double VC,
-                           double& BC, double VBC) {
-  if (VC == 0) {  // short-cut if no current
-    BC = BG, VBG = VBC;
-    return;
-  }
-
-  // Thanks to Geoff Sargent at "tidalstreams.net"
-
-  double B5 = VC / VBC;
-  double C1 = deg2rad(BG);
-  double C2 = deg2rad(C);
-
-  double C6 = asin(B5 * sin(C1 - C2));
-  double B6 = rad2deg(C6);
-  if ((BG + B6) > 360) {
-    BC = BG + B6 - 360;
-  } else {
-    BC = BG + B6;
-  }
-  VBG = (VBC * cos(C6)) + (VC * cos(C1 - C2));
-}
-
 static void CMGWithCurrent(double& BG, double& VBG, double C, double VC,
                            double BC, double VBC) {
   if (VC == 0) {  // short-cut if no current
@@ -148,6 +129,7 @@ otidalrouteUIDialog::otidalrouteUIDialog(wxWindow* parent, otidalroute_pi* ppi)
                             wxDEFAULT_DIALOG_STYLE | wxRESIZE_BORDER) {
   pParent = parent;
   pPlugIn = ppi;
+  ptcmgr = NULL;
 
   wxFileConfig* pConf = GetOCPNConfigObject();
 
@@ -158,6 +140,10 @@ otidalrouteUIDialog::otidalrouteUIDialog(wxWindow* parent, otidalroute_pi* ppi)
     pConf->Read("otidalrouteUseDirection" , &m_bUseDirection);
     pConf->Read("otidalrouteUseFillColour" , &m_bUseFillColour);
 
+    bool useStations = false;
+    pConf->Read("otidalrouteUseStations", &useStations, false);
+    m_mUseStations->Check(useStations);
+
     pConf->Read("VColour0", &myVColour[0], myVColour[0]);
     pConf->Read("VColour1", &myVColour[1], myVColour[1]);
     pConf->Read("VColour2", &myVColour[2], myVColour[2]);
@@ -195,6 +181,8 @@ otidalrouteUIDialog::otidalrouteUIDialog(wxWindow* parent, otidalroute_pi* ppi)
   m_textCtrl1->SetValue(initStartDate);
 
   b_showTidalArrow = false;
+  m_arrowSerial = 0;
+  m_cancelSampling = false;
 
   DimeWindow(this);
 
@@ -203,6 +191,10 @@ otidalrouteUIDialog::otidalrouteUIDialog(wxWindow* parent, otidalroute_pi* ppi)
 }
 
 otidalrouteUIDialog::~otidalrouteUIDialog() {
+  CancelCalculation();  // the workers use the sampler and the dialog
+  m_sweep.Wait();
+  if (m_solverThread.joinable()) m_solverThread.join();
+
   wxFileConfig* pConf = GetOCPNConfigObject();
   ;
 
@@ -212,6 +204,7 @@ otidalrouteUIDialog::~otidalrouteUIDialog() {
     pConf->Write("otidalrouteUseRate" , m_bUseRate);
     pConf->Write("otidalrouteUseDirection" , m_bUseDirection);
     pConf->Write("otidalrouteUseFillColour" , m_bUseFillColour);
+    pConf->Write("otidalrouteUseStations", m_mUseStations->IsChecked());
 
     pConf->Write("VColour0", myVColour[0]);
     pConf->Write("VColour1", myVColour[1]);
@@ -220,6 +213,16 @@ otidalrouteUIDialog::~otidalrouteUIDialog() {
     pConf->Write("VColour4", myVColour[4]);
   }
   SaveXML(m_default_configuration_path);
+
+  // For sizing the 15 minute cache of the stations
+  if (ptcmgr) {
+    unsigned long hits, misses;
+    ptcmgr->GetCacheStats15(hits, misses);
+    wxLogMessage("otidalroute_pi: 15 minute tide values %lu cached, %lu days "
+                 "worked out",
+                 hits, misses);
+  }
+  delete ptcmgr;
 }
 
 void otidalrouteUIDialog::SetCursorLatLon(double lat, double lon) {
@@ -257,6 +260,118 @@ void otidalrouteUIDialog::OnDeleteAllRoutes(wxCommandEvent& event) {
 
   GetParent()->Refresh();
 }
+
+void otidalrouteUIDialog::OnOpenGribFile(wxCommandEvent& event) {
+  wxFileDialog dlg(this, _("Open GRIB File"), wxEmptyString, wxEmptyString,
+                   "GRIB files (*.grb;*.grb2;*.grib;*.grib2)|"
+                   "*.grb;*.grb2;*.grib;*.grib2|All files (*.*)|*.*",
+                   wxFD_OPEN | wxFD_FILE_MUST_EXIST);
+  if (!CheckNotCalculating() || dlg.ShowModal() == wxID_CANCEL) return;
+
+  if (!m_gribReader.Open(std::string(dlg.GetPath().ToUTF8()))) {
+    wxMessageBox(_("No sea current records (UOGRD/VOGRD) found in the "
+                   "GRIB file"));
+    return;
+  }
+  wxLogMessage("otidalroute_pi: GRIB file %s, %d current steps",
+               dlg.GetPath(), (int)m_gribReader.Times().size());
+}
+
+void otidalrouteUIDialog::OnCloseGribFile(wxCommandEvent& event) {
+  if (!CheckNotCalculating()) return;
+  m_gribReader.Close();
+  m_cubeFile.reset();
+}
+
+// Saves the current along the route for the departure window, as the
+// sweep would sample it
+void otidalrouteUIDialog::OnExportCube(wxCommandEvent& event) {
+  if (!CheckNotCalculating()) return;
+
+  if (m_textCtrl1->GetValue() == wxEmptyString) {
+    wxMessageBox(_("Open the GRIB plugin and select a time!"));
+    return;
+  }
+
+  double hours;
+  if (!m_tSweepHours->GetValue().ToDouble(&hours) || hours < 0) {
+    wxMessageBox(_("Please enter the departure window and interval"));
+    return;
+  }
+
+  gotMyGPXFile = false;
+  if (!OpenXML(gotMyGPXFile)) return;
+
+  wxFileDialog dlg(this, _("Export Current Cube"), wxEmptyString,
+                   wxEmptyString,
+                   "Current cube (*.cube)|*.cube|"
+                   "Compact current cube, 16 bit (*.cube)|*.cube",
+                   wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+  if (dlg.ShowModal() == wxID_CANCEL) return;
+
+  double speed = 0;
+  if (!this->m_tSpeed->GetValue().ToDouble(&speed)) {
+    speed = 5.0;
+  }  // 5 kts default speed
+
+  wxDateTime dt;
+  dt.ParseDateTime(m_textCtrl1->GetValue());  // first departure
+
+  std::vector<PassageWaypoint> waypoints;
+  GetPassageWaypoints(waypoints);
+
+  // Worked out again as StartSampling would for a sweep, from the tidal
+  // current stations when they are used and from the GRIB otherwise, but
+  // never from a cube already open
+  std::unique_ptr<CurrentCube> cubeFile(std::move(m_cubeFile));
+  StartSampling(waypoints, speed, dt.GetTicks(),
+                dt.GetTicks() + (time_t)(hours * 3600));
+  bool saved = m_cube && m_cube->Save(std::string(dlg.GetPath().ToUTF8()),
+                                      dlg.GetFilterIndex() == 1);
+  StopSampling();
+  m_cubeFile = std::move(cubeFile);
+
+  if (!saved) wxMessageBox(_("No current along the route to export"));
+}
+
+void otidalrouteUIDialog::OnOpenCube(wxCommandEvent& event) {
+  wxFileDialog dlg(this, _("Open Current Cube"), wxEmptyString, wxEmptyString,
+                   "Current cube (*.cube)|*.cube|All files (*.*)|*.*",
+                   wxFD_OPEN | wxFD_FILE_MUST_EXIST);
+  if (!CheckNotCalculating() || dlg.ShowModal() == wxID_CANCEL) return;
+
+  std::unique_ptr<CurrentCube> cube(new CurrentCube);
+  if (!cube->Map(std::string(dlg.GetPath().ToUTF8()))) {
+    wxMessageBox(_("Not a current cube file"));
+    return;
+  }
+  m_cubeFile = std::move(cube);
+  wxLogMessage("otidalroute_pi: current cube %s, %d steps x %d x %d",
+               dlg.GetPath(), (int)m_cubeFile->m_Times.size(),
+               m_cubeFile->m_NLat, m_cubeFile->m_NLon);
+}
+
+void otidalrouteUIDialog::OnUseStations(wxCommandEvent& event) {
+  if (!CheckNotCalculating()) {
+    m_mUseStations->Check(!m_mUseStations->IsChecked());
+    return;
+  }
+  if (m_mUseStations->IsChecked() && !OpenStations()) {
+    wxMessageBox(_("No tide and current station data (HARMONIC, "
+                   "HARMONIC.IDX) found"));
+    m_mUseStations->Check(false);
+  }
+}
+
+// The current source must not change under a sweep or search
+bool otidalrouteUIDialog::CheckNotCalculating() {
+  if (m_sweep.IsRunning() || m_solverThread.joinable()) {
+    wxMessageBox(_("Please wait for the calculation to finish"));
+    return false;
+  }
+  return true;
+}
+
 void otidalrouteUIDialog::OnMove(wxMoveEvent& event) {
   //    Record the dialog position
   wxPoint p = GetPosition();
@@ -521,6 +636,7 @@ void otidalrouteUIDialog::GetTides(wxString myRoute) {
   }
 
   m_arrowList.clear();  // Prepare for drawing tidal arrows
+  m_arrowIndex.Clear();
   Arrow m_arrow;
 
   int in = 0;
@@ -558,9 +674,134 @@ void otidalrouteUIDialog::GetTides(wxString myRoute) {
       }
     }
   }
+
+  // Index the arrows so that each repaint only visits those in view
+  std::vector<StationRef> refs(m_arrowList.size());
+  for (size_t i = 0; i < m_arrowList.size(); i++) {
+    refs[i].idx = i;
+    refs[i].lat = m_arrowList[i].m_lat;
+    refs[i].lon = m_arrowList[i].m_lon;
+    refs[i].type = 'C';
+  }
+  m_arrowIndex.Build(refs);
+  BuildArrowLevels();
+  m_arrowSerial++;
+
   b_showTidalArrow = true;
 }
 
+// Merge the arrows cell by cell at each level of the quadtree, from the
+// finest up, each level from the one below it. The levels fine enough
+// to hold one arrow per cell are left to m_arrowList.
+void otidalrouteUIDialog::BuildArrowLevels() {
+  struct Cell {
+    uint32_t x, y;  // at the level being built
+    double u, v;    // sum of the rates east and north
+    double lat;     // sum of the latitudes
+    double lon0;    // longitude of the cell's first arrow
+    double dlon;    // sum of the offsets from lon0, each -180 to 180
+    int count;
+    bool operator<(const Cell& c) const {
+      return x < c.x || (x == c.x && y < c.y);
+    }
+  };
+
+  m_arrowLevels.clear();
+  if (m_arrowList.empty()) return;
+
+  const int deepest = ARROW_LEVELS - 1;
+  vector<Cell> cells(m_arrowList.size());
+  for (size_t i = 0; i < m_arrowList.size(); i++) {
+    const Arrow& a = m_arrowList[i];
+    double lat = wxMax(-85.0, wxMin(85.0, a.m_lat));
+    double mercator = log(tan(M_PI / 4 + deg2rad(lat) / 2));
+    double fx = (a.m_lon + 180) / 360 - floor((a.m_lon + 180) / 360);
+    double fy = (1 - mercator / M_PI) / 2;
+    Cell& c = cells[i];
+    c.x = wxMin(fx * (1u << deepest), (1u << deepest) - 1.0);
+    c.y = wxMin(fy * (1u << deepest), (1u << deepest) - 1.0);
+    c.u = a.m_force * sin(deg2rad(a.m_dir));
+    c.v = a.m_force * cos(deg2rad(a.m_dir));
+    c.lat = a.m_lat;
+    c.lon0 = a.m_lon;
+    c.dlon = 0;
+    c.count = 1;
+  }
+
+  vector<vector<Arrow> > levels(ARROW_LEVELS);
+  size_t finest = ARROW_LEVELS;  // the first level merging any arrows
+  for (int level = deepest; level >= 0; level--) {
+    if (level < deepest)
+      for (size_t i = 0; i < cells.size(); i++) {
+        cells[i].x >>= 1;
+        cells[i].y >>= 1;
+      }
+    std::sort(cells.begin(), cells.end());
+
+    size_t n = 0;
+    for (size_t i = 0; i < cells.size(); i++) {
+      if (n && !(cells[n - 1] < cells[i])) {
+        Cell& c = cells[n - 1];
+        c.u += cells[i].u;
+        c.v += cells[i].v;
+        c.lat += cells[i].lat;
+        // Offsets rather than longitudes, so that a cell astride the date
+        // line is not averaged to the other side of the world
+        double offset = cells[i].lon0 - c.lon0;
+        offset -= 360 * floor((offset + 180) / 360);
+        c.dlon += cells[i].dlon + cells[i].count * offset;
+        c.count += cells[i].count;
+      } else
+        cells[n++] = cells[i];
+    }
+    cells.resize(n);
+    if (n == m_arrowList.size()) continue;  // no merging yet
+    if (finest == (size_t)ARROW_LEVELS) finest = level + 1;
+
+    vector<Arrow>& arrows = levels[level];
+    arrows.resize(n);
+    for (size_t i = 0; i < n; i++) {
+      const Cell& c = cells[i];
+      Arrow& a = arrows[i];
+      a.m_lat = c.lat / c.count;
+      a.m_lon = c.lon0 + c.dlon / c.count;
+      a.m_lon -= 360 * floor((a.m_lon + 180) / 360);
+      a.m_force = sqrt(c.u * c.u + c.v * c.v) / c.count;
+      a.m_dir = rad2deg(atan2(c.u, c.v));
+      if (a.m_dir < 0) a.m_dir += 360;
+      a.m_cts = a.m_tforce = 0;
+    }
+  }
+
+  if (finest == (size_t)ARROW_LEVELS) return;  // every arrow has its cell
+  m_arrowLevels.resize(finest);
+  for (size_t level = 0; level < finest; level++) {
+    ArrowLevel& l = m_arrowLevels[level];
+    l.arrows.swap(levels[level]);
+
+    std::vector<StationRef> refs(l.arrows.size());
+    for (size_t i = 0; i < l.arrows.size(); i++) {
+      refs[i].idx = i;
+      refs[i].lat = l.arrows[i].m_lat;
+      refs[i].lon = l.arrows[i].m_lon;
+      refs[i].type = 'C';
+    }
+    l.index.Build(refs);
+  }
+}
+
+// The level whose cells are at least ARROW_CELL_PX pixels across at this
+// scale, or -1 for the arrows themselves
+int otidalrouteUIDialog::ArrowLevelFor(double view_scale_ppm) const {
+  // Round the world at the equator, in the pixels of the chart
+  double world = view_scale_ppm * 2 * M_PI * 6378137.0;
+  if (!(world > 0)) return -1;
+
+  int level = (int)floor(log2(world / ARROW_CELL_PX));
+  if (level >= (int)m_arrowLevels.size()) return -1;
+  return wxMax(level, 0);
+}
+
 void otidalrouteUIDialog::AddChartRoute(wxString myRoute) {
 
   PlugIn_Route* newRoute =
@@ -640,23 +881,53 @@ void otidalrouteUIDialog::RequestGrib(wxDateTime time) {
 void otidalrouteUIDialog::DRCalculate(wxCommandEvent& event) {
   bool fGPX = m_cbGPX->GetValue();
   if (fGPX) {
-    CalcDR(event, true, 1);
+    CalcDR(event, true);
   } else {
-    CalcDR(event, false, 1);
+    CalcDR(event, false);
   }
 }
 
 void otidalrouteUIDialog::ETACalculate(wxCommandEvent& event) {
   bool fGPX = m_cbGPX->GetValue();
   if (fGPX) {
-    CalcETA(event, true, 1);
+    CalcETA(event, true);
   } else {
-    CalcETA(event, false, 1);
+    CalcETA(event, false);
+  }
+}
+
+bool GribCurrentSampler::GetCurrent(time_t t, double lat, double lon,
+                                    double& rate, double& set) {
+  if (wxThread::IsMain())
+    return m_dlg->GetGribSpdDir(wxDateTime(t), lat, lon, rate, set);
+
+  // Worker thread: hand the sample to the GUI thread and wait for it
+  struct GribSample {
+    bool ok;
+    double rate, set;
+    std::promise<void> done;
+  };
+  std::shared_ptr<GribSample> sample(new GribSample);
+  std::future<void> done = sample->done.get_future();
+
+  otidalrouteUIDialog* dlg = m_dlg;
+  dlg->CallAfter([dlg, sample, t, lat, lon]() {
+    sample->ok = dlg->GetGribSpdDir(wxDateTime(t), lat, lon, sample->rate,
+                                    sample->set);
+    sample->done.set_value();
+  });
+
+  while (done.wait_for(std::chrono::milliseconds(50)) !=
+         std::future_status::ready) {
+    if (m_cancel && *m_cancel) return false;
   }
+
+  rate = sample->rate;
+  set = sample->set;
+  return sample->ok;
 }
 
-void otidalrouteUIDialog::CalcDR(wxCommandEvent& event, bool write_file,
-                                 int Pattern) {
+void otidalrouteUIDialog::CalcDR(wxCommandEvent& event, bool write_file) {
   if (m_tRouteName->GetValue() == wxEmptyString) {
     wxMessageBox(_("Please enter a name for the route!"));
     return;
@@ -665,745 +936,356 @@ void otidalrouteUIDialog::CalcDR(wxCommandEvent& event, bool write_file,
   m_choiceDepartureTimes->SetStringSelection("1");  // we only need one DR route
 
   TidalRoute tr;  // tidal route for saving in the config file
-  PlugIn_Route* newRoute = new PlugIn_Route;  // for immediate use as a route on
+  wxString m_RouteName = m_tRouteName->GetValue() + "." + "DR";
 
-  Position ptr;
-
-  wxString m_RouteName;
-
-  gotMyGPXFile = false;  // only load the raw gpx file once for a DR route
-
-  if (m_TidalRoutes.empty()) {
-    m_RouteName = m_tRouteName->GetValue() + "." + "DR";
-    tr.Name = m_RouteName;
-    tr.Type = "DR";
-  } else {
-    for (std::list<TidalRoute>::iterator it = m_TidalRoutes.begin();
-         it != m_TidalRoutes.end(); it++) {
-      m_RouteName = m_tRouteName->GetValue() + "." + "DR";
-      if ((*it).Name == m_RouteName) {
-        wxMessageBox(_("Route name already exists, please edit the name"));
-        return;
-      } else {
-        tr.m_positionslist.clear();
-        tr.Name = m_RouteName;
-        tr.Type = "DR";
-      }
+  for (std::list<TidalRoute>::iterator it = m_TidalRoutes.begin();
+       it != m_TidalRoutes.end(); it++) {
+    if ((*it).Name == m_RouteName) {
+      wxMessageBox(_("Route name already exists, please edit the name"));
+      return;
     }
   }
+  tr.Name = m_RouteName;
+  tr.Type = "DR";
 
-  newRoute->m_NameString = tr.Name;
-  newRoute->m_GUID =
-      wxString::Format("%i", (int)GetRandomNumber(1, 4000000));
-
-  tr.Start = "Start";
-  tr.End = "End";
-  tr.m_GUID = newRoute->m_GUID;
+  gotMyGPXFile = false;  // only load the raw gpx file once for a DR route
 
   if (OpenXML(gotMyGPXFile)) {
-    bool error_occured = false;
-
-    double lat1, lon1;
-
-    int num_hours = 1;
-    int n = 0;
-
-    lat1 = 0.0;
-    lon1 = 0.0;
-
     wxString s;
-    if (write_file) {
-      wxFileDialog dlg(this, _("Export DR Positions in GPX file as"),
-                       wxEmptyString, wxEmptyString,
-                       "GPX files (*.gpx)|*.gpx|All files (*.*)|*.*",
-                       wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
-      if (dlg.ShowModal() == wxID_CANCEL) {
-        error_occured = true;  // the user changed idea...
-        return;
-      }
+    if (write_file && !GetGPXFileName(_("Export DR Positions in GPX file as"), s))
+      return;
 
-      s = dlg.GetPath();
-      if (dlg.GetPath() == wxEmptyString) {
-        error_occured = true;
-        if (dbg) printf("Empty Path\n");
-      }
-    }
+    double speed = 0;
+    if (!this->m_tSpeed->GetValue().ToDouble(&speed)) {
+      speed = 5.0;
+    }  // 5 kts default speed
 
-    // Validate input ranges
-    if (!error_occured) {
-      if (std::abs(lat1) > 90) {
-        error_occured = true;
-      }
-      if (std::abs(lon1) > 180) {
-        error_occured = true;
-      }
-      if (error_occured) wxMessageBox(_("error in input range validation"));
-    }
+    wxDateTime dt;
+    dt.ParseDateTime(m_textCtrl1->GetValue());  // date/time route starts
+    m_textCtrl1->SetValue(dt.Format("%Y-%m-%d  %H:%M "));
 
-    // Start writing GPX
-    TiXmlDocument doc;
-    TiXmlDeclaration* decl = new TiXmlDeclaration("1.0", "utf-8", "");
-    doc.LinkEndChild(decl);
-    TiXmlElement* root = new TiXmlElement("gpx");
-    TiXmlElement* Route = new TiXmlElement("rte");
-    TiXmlElement* RouteName = new TiXmlElement("name");
-    TiXmlText* text4 = new TiXmlText(this->m_tRouteName->GetValue().ToUTF8());
-
-    if (write_file) {
-      doc.LinkEndChild(root);
-      root->SetAttribute("version", "0.1");
-      root->SetAttribute("creator", "otidalroute_pi by Rasbats");
-      root->SetAttribute("xmlns:xsi",
-                         "http://www.w3.org/2001/XMLSchema-instance");
-      root->SetAttribute("xmlns:gpxx",
-                         "http://www.garmin.com/xmlschemas/GpxExtensions/v3");
-      root->SetAttribute("xsi:schemaLocation",
-                         "http://www.topografix.com/GPX/1/1 "
-                         "http://www.topografix.com/GPX/1/1/gpx.xsd");
-      root->SetAttribute("xmlns:opencpn", "http://www.opencpn.org");
-      Route->LinkEndChild(RouteName);
-      RouteName->LinkEndChild(text4);
+    std::vector<PassageWaypoint> waypoints;
+    GetPassageWaypoints(waypoints);
+
+    TidalPassageEngine engine(speed);  // no current for DR
+    PassageResult result = engine.Run(waypoints, dt.GetTicks());
+    if (result.status != PASSAGE_OK) {
+      ReportPassageError(result.status);
+      return;
     }
 
-    switch (Pattern) {
-      case 1: {
-        if (dbg) cout << "DR Calculation\n";
-        double speed = 0;
+    AddPassage(result, tr, "DR", "Symbol-X-Large-Magenta");
+    if (write_file)
+      WritePassageGPX(s, result, "DR", "Symbol-X-Large-Magenta");
+  }
+  GetParent()->Refresh();
+  pPlugIn->m_potidalrouteDialog->Show();
 
-        if (!this->m_tSpeed->GetValue().ToDouble(&speed)) {
-          speed = 5.0;
-        }  // 5 kts default speed
+  wxMessageBox(_("DR Route has been calculated!"));
+}
 
-        double lati, loni;
-        double latN[200], lonN[200];
-        double latF, lonF;
+void otidalrouteUIDialog::CalcETA(wxCommandEvent& event, bool write_file) {
+  if (m_tRouteName->GetValue() == wxEmptyString) {
+    wxMessageBox(_("Please enter a name for the route!"));
+    return;
+  }
 
-        Position my_point;
+  if (m_textCtrl1->GetValue() == wxEmptyString) {
+    wxMessageBox(_("Open the GRIB plugin and select a time!"));
+    return;
+  }
 
-        double value, value1;
+  wxString s_departureTimes = m_choiceDepartureTimes->GetStringSelection();
+  int m_departureTimes = wxAtoi(s_departureTimes);
+  if (!CheckSweepNames(m_departureTimes)) return;
 
-        for (std::vector<Position>::iterator it = my_positions.begin();
-             it != my_positions.end(); it++) {
-          if (!(*it).lat.ToDouble(&value)) { /* error! */
-          }
-          lati = value;
-          if (!(*it).lon.ToDouble(&value1)) { /* error! */
-          }
-          loni = value1;
+  gotMyGPXFile = false;  // only load the raw gpx file once
+  if (OpenXML(gotMyGPXFile)) {
+    m_sweepGPX = wxEmptyString;
+    if (write_file &&
+        !GetGPXFileName(_("Export ETA Positions in GPX file as"), m_sweepGPX))
+      return;
 
-          waypointName[n] = (*it).name;
-          // wxMessageBox(waypointName[n]);
+    double speed = 0;
+    if (!this->m_tSpeed->GetValue().ToDouble(&speed)) {
+      speed = 5.0;
+    }  // 5 kts default speed
 
-          latN[n] = lati;
-          lonN[n] = loni;
+    wxDateTime dt;
+    dt.ParseDateTime(m_textCtrl1->GetValue());  // date/time route starts
+    m_textCtrl1->SetValue(dt.Format("%Y-%m-%d  %H:%M "));
 
-          n++;
-        }
+    std::vector<PassageWaypoint> waypoints;
+    GetPassageWaypoints(waypoints);
 
-        // my_positions.clear();
-        n--;
+    // Each departure is one hour after the last
+    StartSweep(waypoints, speed, dt, 3600, m_departureTimes, false);
+  }
+}
 
-        int routepoints = n + 1;
+void otidalrouteUIDialog::SweepCalculate(wxCommandEvent& event) {
+  if (m_sweep.IsRunning()) {  // the button cancels a running sweep
+    CancelCalculation();
+    return;
+  }
 
-        double myDist, myBrng;
-        myBrng = 0;
-        myDist = 0;
+  if (m_tRouteName->GetValue() == wxEmptyString) {
+    wxMessageBox(_("Please enter a name for the route!"));
+    return;
+  }
 
-        double myLast, route_dist;
+  if (m_textCtrl1->GetValue() == wxEmptyString) {
+    wxMessageBox(_("Open the GRIB plugin and select a time!"));
+    return;
+  }
 
-        route_dist = 0;
-        myLast = 0;
-        double total_dist = 0;
-        int i, c;
+  double hours, interval;
+  if (!m_tSweepHours->GetValue().ToDouble(&hours) || hours < 0 ||
+      !m_tSweepInterval->GetValue().ToDouble(&interval) || interval < 1) {
+    wxMessageBox(_("Please enter the departure window and interval"));
+    return;
+  }
 
-        lati = latN[0];
-        loni = lonN[0];
+  int step = interval * 60;
+  int count = (int)(hours * 3600 / step) + 1;
+  if (!CheckSweepNames(count)) return;
 
-        double spd, dir;
-        spd = 0;
-        dir = 0;
+  gotMyGPXFile = false;
+  if (OpenXML(gotMyGPXFile)) {
+    double speed = 0;
+    if (!this->m_tSpeed->GetValue().ToDouble(&speed)) {
+      speed = 5.0;
+    }  // 5 kts default speed
 
-        double VBG, BC, VBG1;
-        VBG = speed;
-        VBG1 = 0;
-        int tc_index = 0;
-        c = 0;
+    wxDateTime dt;
+    dt.ParseDateTime(m_textCtrl1->GetValue());  // first departure
+    m_textCtrl1->SetValue(dt.Format("%Y-%m-%d  %H:%M "));
 
-        double iDist = 0;
-        double tdist = 0;  // For accumulating the total distance by adding
-                           // the distance for each leg
-        double ptrDist = 0;
-        int epNumber = 0;
-        wxString epName;
+    std::vector<PassageWaypoint> waypoints;
+    GetPassageWaypoints(waypoints);
 
-        wxDateTime dt, dtCurrent;
+    m_sweepGPX = wxEmptyString;  // no GPX for hundreds of departures
+    StartSweep(waypoints, speed, dt, step, count, true);
+  }
+}
 
-        wxString ddt, sdt;
-        wxTimeSpan HourSpan;
-        HourSpan = wxTimeSpan::Hours(1);
+double otidalrouteUIDialog::GetETATolerance() {
+  double tolerance = 0;
+  if (!m_tTolerance->GetValue().ToDouble(&tolerance) || tolerance < 0) {
+    tolerance = 0;
+  }  // hourly steps
+  return tolerance;
+}
 
-        wxDateTime dtStart, dtEnd;
-        wxTimeSpan trTime;
-        double trTimeHours;
+wxString otidalrouteUIDialog::SweepRouteName(int index) {
+  return m_tRouteName->GetValue() + wxT(".") +
+         wxString::Format(wxT("%i"), index) + wxT(".") + wxT("EP");
+}
 
-        sdt = m_textCtrl1->GetValue();  // date/time route starts
-        dt.ParseDateTime(sdt);
+bool otidalrouteUIDialog::CheckSweepNames(int count) {
+  for (std::list<TidalRoute>::iterator it = m_TidalRoutes.begin();
+       it != m_TidalRoutes.end(); it++) {
+    for (int r = 0; r < count; r++) {
+      if ((*it).Name == SweepRouteName(r)) {
+        wxMessageBox(_("Route name already exists, please edit the name"));
+        return false;
+      }
+    }
+  }
+  return true;
+}
 
-        sdt = dt.Format("%Y-%m-%d  %H:%M ");
-        m_textCtrl1->SetValue(sdt);
+void otidalrouteUIDialog::StartSweep(
+    const std::vector<PassageWaypoint>& waypoints, double speed,
+    wxDateTime first, int step, int count, bool show_table) {
+  m_sweepFailed = 0;
+  m_sweepError = PASSAGE_OK;
+  m_sweepBest = -1;
+  m_sweepBestHours = 0;
+  m_sweepResults.clear();
+
+  if (show_table) {
+    TableRoutes* tableroutes = new TableRoutes(
+        this, 7000, " Departure Sweep", wxPoint(200, 200), wxSize(650, 400),
+        wxDEFAULT_DIALOG_STYLE | wxRESIZE_BORDER);
+    tableroutes->m_wpList->Connect(
+        wxEVT_COMMAND_LIST_ITEM_ACTIVATED,
+        wxListEventHandler(otidalrouteUIDialog::OnSweepRowActivated), NULL,
+        this);
+    tableroutes->Show();
+    m_sweepTable = tableroutes;
+    m_sweepResults.resize(count);
+    for (int i = 0; i < count; i++)
+      m_sweepResults[i].status = PASSAGE_BAD_INPUT;  // not worked out yet
+  } else {
+    m_sweepTable = NULL;
+  }
 
-        tr.StartTime = sdt;
+  m_bCalcDR->Disable();
+  m_bCalcETA->Disable();
+  m_bBestDeparture->Disable();
+  m_bSweep->SetLabel(_("Cancel Sweep"));
+
+  CurrentSampler* sampler =
+      StartSampling(waypoints, speed, first.GetTicks(),
+                    first.GetTicks() + (time_t)(count - 1) * step);
+  TidalPassageEngine engine(speed, sampler, GetETATolerance());
+
+  // Results arrive on the worker threads, the route list is updated on the
+  // GUI thread as each one finishes
+  m_sweep.Start(
+      engine, waypoints, first.GetTicks(), step, count,
+      [this](int index, const PassageResult& result) {
+        CallAfter([this, index, result]() { OnSweepResult(index, result); });
+      },
+      [this]() { CallAfter([this]() { OnSweepFinished(); }); });
+}
 
-        dtStart = dt;
-        dtCurrent = dt;
+void otidalrouteUIDialog::OnSweepResult(int index,
+                                        const PassageResult& result) {
+  if (result.status != PASSAGE_OK) {
+    if (!m_sweep.IsCancelled()) {
+      m_sweepFailed++;
+      if (m_sweepError == PASSAGE_OK) m_sweepError = result.status;
+    }
+    return;
+  }
 
-        //
-        // Time iso distance (3 mins) logic
-        //
+  TidalRoute tr;
+  tr.Name = SweepRouteName(index);
+  tr.Type = _("ETA");
+  if (m_sweepResults.empty()) {
+    AddPassage(result, tr, "EP", "Triangle", false);
+  } else {
+    // Only shown in the table, hundreds of routes would swamp the list
+    FillPassage(result, tr, "EP", "Triangle");
+    m_sweepResults[index] = result;
+  }
 
-        /*
-                      // We are trying to do three things:
-                      //
-                      // **Make ptr points on the tidal route for making a
-                         route table etc
-                      //
-                      // **Option to save a GPX file of the calculated route
-                      //
-                      // **Making a new OpenCPN route for display on the chart
-                      //
-         */
-        int wpn = 0;  // waypoint number
-        double timeToRun = 0;
-        double timeToWaypoint = 0;
-        double waypointDistance;
-        double fractpart, intpart;
-        int numEP;
-
-        //
-        // Loop through the waypoints of the route
-        //
-        for (wpn; wpn < n; wpn++) {  // loop through the waypoints
-
-          DistanceBearingMercator_Plugin(latN[wpn + 1], lonN[wpn + 1],
-                                         latN[wpn], lonN[wpn], &myBrng,
-                                         &myDist);
-
-          //
-          // set up the waypoint
-          //
-          //
-
-          PlugIn_Waypoint* newPoint;
-
-          newPoint = new PlugIn_Waypoint(
-              latN[wpn], lonN[wpn], "Symbol-Empty", waypointName[wpn]);
-
-          newPoint->m_GUID =
-              wxString::Format("%i", (int)GetRandomNumber(1, 4000000));
-          newPoint->m_MarkDescription =
-              dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-          newRoute->pWaypointList->Append(newPoint);
-
-          //
-          // Save the GPX file routepoint
-          //
-
-          my_point.lat = wxString::Format("%f", latN[wpn]);
-          my_point.lon = wxString::Format("%f", lonN[wpn]);
-          my_point.routepoint = 1;
-          my_point.wpt_num = waypointName[wpn].mb_str();
-          my_point.name = waypointName[wpn].mb_str();
-          my_point.time = dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-          my_points.push_back(my_point);
-
-          //
-          // Save the route point for the route table
-          //
-
-          ptr.name = waypointName[wpn].mb_str();
-          ptr.time = dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-          ptr.lat = wxString::Format("%8.4f", latN[wpn]);
-          ptr.lon = wxString::Format("%8.4f", lonN[wpn]);
-          ptr.guid = newPoint->m_GUID;
-          ptr.CTS = wxString::Format("%03.0f", myBrng);
-          ptr.SMG = wxString::Format("%5.1f", VBG);
-
-          if (wpn == 0) {
-            ptr.distTo = "----";
-            ptr.brgTo = "----";
-            VBG1 = VBG;
-          } else {
-            tdist += ptrDist;
-            ptr.distTo = wxString::Format("%.4f", ptrDist);
-            ptr.brgTo = wxString::Format("%03.0f", myBrng);
-          }
+  if (m_sweepGPX != wxEmptyString) {
+    wxString path = m_sweepGPX;
+    if (m_sweep.Count() > 1) {
+      wxFileName fn(m_sweepGPX);
+      fn.SetName(fn.GetName() + wxString::Format(".%i", index));
+      path = fn.GetFullPath();
+    }
+    WritePassageGPX(path, result, "EP", "Triangle");
+  }
 
-          ptr.set = wxString::Format("%03.0f", dir);
-          ptr.rate = wxString::Format("%5.1f", spd);
-          ptr.icon_name = "Circle";
-
-          tr.m_positionslist.push_back(ptr);
-
-          latF = latN[wpn];  // Position of the last waypoint
-          lonF = lonN[wpn];
-
-          if (wpn == 0) {            
-            DistanceBearingMercator_Plugin(
-                latN[wpn + 1], lonN[wpn + 1], latN[wpn], lonN[wpn], &myBrng,
-                &waypointDistance);  // how far to the next waypoint?
-
-            timeToWaypoint = waypointDistance / VBG;
-
-            if (timeToWaypoint < 1) {
-              // no space for an EP
-
-              timeToRun = 1 - timeToWaypoint;
-              //
-              // timeToRun is the part of one hour remaining to run after
-              // passing the waypoint
-              //
-              tr.Start = waypointName[wpn].mb_str();
-              dtCurrent = AdvanceSeconds(dtCurrent, timeToWaypoint);
-              ptrDist = waypointDistance;
-
-            } else {
-              tr.Start = waypointName[wpn].mb_str();  // name does not change
-
-              // Move to the EP on this leg with initial VBG (VBG1)
-              PositionBearingDistanceMercator_Plugin(
-                  latN[wpn], lonN[wpn], myBrng, VBG, &lati, &loni);
-
-              // Move on one hour to the first EP
-              dtCurrent = dtCurrent.Add(HourSpan);
-
-              epNumber++;
-              epName = "DR" + wxString::Format("%i", epNumber);
-              PlugIn_Waypoint* epPoint = new PlugIn_Waypoint(
-                  lati, loni, "Symbol-X-Large-Magenta", epName);
-              epPoint->m_IconName = "Symbol-X-Large-Magenta";
-              epPoint->m_GUID =
-                  wxString::Format("%i", (int)GetRandomNumber(1, 4000000));
-              newRoute->pWaypointList->Append(
-                  epPoint);  // for the OpenCPN display route
-
-              // print DR for the GPX file
-              my_point.lat = wxString::Format("%f", lati);
-              my_point.lon = wxString::Format("%f", loni);
-              my_point.routepoint = 0;
-              my_point.wpt_num =
-                  "EP" + wxString::Format("%i", epNumber);
-              my_point.name = "EP" + wxString::Format("%i", epNumber);
-              my_point.time = dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-              my_points.push_back(my_point);
-
-              // print DR for the config file
-
-              ptrDist = VBG;
-              tdist += ptrDist;
-              ptr.name = epName;
-              ptr.lat = wxString::Format("%8.4f", lati);
-              ptr.lon = wxString::Format("%8.4f", loni);
-              ptr.time = dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-              ptr.guid = epPoint->m_GUID;
-              ptr.distTo = wxString::Format("%.4f", ptrDist);
-              ptr.brgTo = wxString::Format("%03.0f", myBrng);
-              ptr.CTS = wxString::Format("%03.0f", myBrng);
-              ptr.SMG = wxString::Format("%5.1f", VBG);
-              ptr.set = wxString::Format("%03.0f", dir);
-              ptr.rate = wxString::Format("%5.1f", spd);
-              ptr.icon_name = "Symbol-X-Large-Magenta";
-              tr.m_positionslist.push_back(ptr);
-
-              // work out the number of DR
-              // must be more than one DR as we have worked this out already
-
-              DistanceBearingMercator_Plugin(
-                  latN[wpn + 1], lonN[wpn + 1], lati, loni, &myBrng,
-                  &waypointDistance);  // how far to the next waypoint?
-
-              // How many DR are possible on the first leg?
-
-              timeToWaypoint = waypointDistance / VBG;
-              fractpart = modf(timeToWaypoint, &intpart);
-              numEP = intpart;  // was intpart + 1
-
-              if (numEP == 0) {
-                timeToRun = 1 - timeToWaypoint;
-                dtCurrent = AdvanceSeconds(dtCurrent, timeToWaypoint);
-                ptrDist = timeToWaypoint * VBG;
-
-                //
-                // dtCurrent is now the time at waypoint 1
-                //
-              }
-
-              else {
-                latF = lati;
-                lonF = loni;
-
-                for (int z = 0; z <= numEP; z++) {
-                  ptrDist = VBG;
-
-                  PositionBearingDistanceMercator_Plugin(
-                      latF, lonF, myBrng, VBG, &lati,
-                      &loni);  // first waypoint of the leg
-
-                  // Time at the next plotted EP
-                  dtCurrent = dtCurrent.Add(HourSpan);                 
-
-                  epNumber++;  // Add a DR
-                  epName = "DR" + wxString::Format("%i", epNumber);
-                  PlugIn_Waypoint* epPoint = new PlugIn_Waypoint(
-                      lati, loni, "Symbol-X-Large-Magenta", epName);
-                  epPoint->m_IconName = "Symbol-X-Large-Magenta";
-                  // epPoint->m_MarkDescription = ddt;
-                  epPoint->m_GUID = wxString::Format(
-                      "%i", (int)GetRandomNumber(1, 4000000));
-                  newRoute->pWaypointList->Append(
-                      epPoint);  // for the OpenCPN display route
-
-                  // print mid points for the GPX file
-                  my_point.lat = wxString::Format(wxT("%f"), lati);
-                  my_point.lon = wxString::Format(wxT("%f"), loni);
-                  my_point.routepoint = 0;
-                  my_point.wpt_num =
-                      "DR" + wxString::Format("%i", epNumber);
-                  my_point.name =
-                      "DR" + wxString::Format("%i", epNumber);
-                  my_point.time = dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-                  my_points.push_back(my_point);
-
-                  // print EP for the config file
-                  // ptrDist = VBG;
-                  tdist += ptrDist;
-                  ptr.name = epName;
-                  ptr.lat = wxString::Format("%8.4f", lati);
-                  ptr.lon = wxString::Format("%8.4f", loni);
-                  ptr.time = dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-                  ptr.guid = epPoint->m_GUID;
-                  ptr.distTo = wxString::Format("%.4f", ptrDist);
-                  ptr.brgTo = wxString::Format("%03.0f", myBrng);
-                  ptr.CTS = wxString::Format("%03.0f", myBrng);
-                  ptr.SMG = wxString::Format("%5.1f", VBG);
-                  ptr.set = wxString::Format("%03.0f", dir);
-                  ptr.rate = wxString::Format("%5.1f", spd);
-                  ptr.icon_name = "Symbol-X-Large-Magenta";
-                  tr.m_positionslist.push_back(ptr);
-
-                  DistanceBearingMercator_Plugin(
-                      latN[wpn + 1], lonN[wpn + 1], lati, loni, &myBrng,
-                      &waypointDistance);  // how far to the next waypoint?
-
-                  timeToWaypoint = waypointDistance / VBG;
-
-                  if (timeToWaypoint < 1) {  // No time for another EP
-
-                    z = numEP + 1;  // to stop the next EP being made
-
-                    timeToRun = 1 - timeToWaypoint;
-                    dtCurrent = AdvanceSeconds(dtCurrent, timeToWaypoint);
-                    ptrDist = timeToWaypoint * VBG;
-                  }
-
-                  latF = lati;
-                  lonF = loni;
-                }
-              }
-            }
-          }
+  if (m_sweepBest < 0 || result.Hours() < m_sweepBestHours) {
+    m_sweepBest = index;
+    m_sweepBestHours = result.Hours();
+    m_sweepBestStart = tr.StartTime;
+  }
 
-          else {  // *************** After waypoint zero **********
-                  // **********************************************
-
-            DistanceBearingMercator_Plugin(
-                latN[wpn + 1], lonN[wpn + 1], latN[wpn], lonN[wpn], &myBrng,
-                &waypointDistance);  // how far to the next waypoint?
-
-            timeToWaypoint = waypointDistance / VBG;
-
-            if (timeToWaypoint < timeToRun) {
-              timeToRun = timeToRun - timeToWaypoint;
-              dtCurrent = AdvanceSeconds(dtCurrent, timeToWaypoint);
-              ptrDist = timeToWaypoint * VBG;
-              // Do not add an EP. The next position plotted is the route wpt.
-
-            } else {
-              // space for an EP
-              // we need the position for the first EP on the new leg ...
-              // latloni
-              //
-              double distEP = timeToRun * VBG;
-
-              PositionBearingDistanceMercator_Plugin(
-                  latN[wpn], lonN[wpn], myBrng, distEP, &lati,
-                  &loni);  // first DR of the new leg
-
-              //
-              // Time at the first DR of the leg
-              //
-              dtCurrent = AdvanceSeconds(dtCurrent, timeToRun);
-              ptrDist = timeToRun * VBG;            
-
-              epNumber++;  // Add an EP
-              epName = "DR" + wxString::Format("%i", epNumber);
-              PlugIn_Waypoint* epPoint = new PlugIn_Waypoint(
-                  lati, loni, "Symbol-X-Large-Magenta", epName);
-              epPoint->m_IconName = "Symbol-X-Large-Magenta";
-              epPoint->m_GUID =
-                  wxString::Format("%i", (int)GetRandomNumber(1, 4000000));
-              newRoute->pWaypointList->Append(
-                  epPoint);  // for the OpenCPN display route
-
-              // print DR for the GPX file
-              my_point.lat = wxString::Format("%f", lati);
-              my_point.lon = wxString::Format("%f", loni);
-              my_point.routepoint = 0;
-              my_point.wpt_num =
-                  "DR" + wxString::Format("%i", epNumber);
-              my_point.name = "DR" + wxString::Format("%i", epNumber);
-              my_point.time = dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-              my_points.push_back(my_point);
-
-              // print DR for the config file
-              tdist += ptrDist;
-              ptr.name = epName;
-              ptr.lat = wxString::Format("%8.4f", lati);
-              ptr.lon = wxString::Format("%8.4f", loni);
-              ptr.time = dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-              ptr.guid = epPoint->m_GUID;
-              ptr.distTo = wxString::Format("%.1f", ptrDist);
-              ptr.brgTo = wxString::Format("%03.0f", myBrng);
-              ptr.CTS = wxString::Format("%03.0f", myBrng);
-              ptr.SMG = wxString::Format("%5.1f", VBG);
-              ptr.set = wxString::Format("%03.0f", dir);
-              ptr.rate = wxString::Format("%5.1f", spd);
-              ptr.icon_name = "Symbol-X-Large-Magenta";
-              tr.m_positionslist.push_back(ptr);
-
-              DistanceBearingMercator_Plugin(
-                  latN[wpn + 1], lonN[wpn + 1], lati, loni, &myBrng,
-                  &waypointDistance);  // how far to the next waypoint?
-
-              latF = lati;
-              lonF = loni;
-
-              // Find out if any space for more EP
-              timeToWaypoint = waypointDistance / VBG;
-              fractpart = modf(timeToWaypoint, &intpart);
-              numEP = intpart;
-
-              if (numEP == 0) {
-                timeToRun = 1 - timeToWaypoint;
-                dtCurrent = AdvanceSeconds(dtCurrent, timeToWaypoint);
-                ptrDist = timeToWaypoint * VBG;
-
-              } else {
-                for (int z = 0; z <= numEP; z++) {
-                  ptrDist = VBG;
-
-                  PositionBearingDistanceMercator_Plugin(
-                      latF, lonF, myBrng, VBG, &lati,
-                      &loni);  // first waypoint of the leg
-
-                  dtCurrent = dtCurrent.Add(HourSpan);
-
-                  epNumber++;
-                  epName = "DR" + wxString::Format("%i", epNumber);
-                  PlugIn_Waypoint* epPoint = new PlugIn_Waypoint(
-                      lati, loni, "Symbol-X-Large-Magenta", epName);
-                  epPoint->m_IconName = "Symbol-X-Large-Magenta";
-                  epPoint->m_GUID = wxString::Format(
-                      "%i", (int)GetRandomNumber(1, 4000000));
-                  newRoute->pWaypointList->Append(
-                      epPoint);  // for the OpenCPN display route
-
-                  // print mid points for the GPX file
-                  my_point.lat = wxString::Format("%f", lati);
-                  my_point.lon = wxString::Format("%f", loni);
-                  my_point.routepoint = 0;
-                  my_point.wpt_num =
-                      "DR" + wxString::Format("%i", epNumber);
-                  my_point.name =
-                      "DR" + wxString::Format("%i", epNumber);
-                  my_point.time = dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-                  my_points.push_back(my_point);
-
-                  // print EP for the config file
-                  // ptrDist = VBG;
-                  tdist += ptrDist;
-                  ptr.name = epName;
-                  ptr.lat = wxString::Format("%8.4f", lati);
-                  ptr.lon = wxString::Format("%8.4f", loni);
-                  ptr.time = dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-                  ptr.guid = epPoint->m_GUID;
-                  ptr.distTo = wxString::Format("%.1f", ptrDist);
-                  ptr.brgTo = wxString::Format("%03.0f", myBrng);
-                  ptr.CTS = wxString::Format("%03.0f", myBrng);
-                  ptr.SMG = wxString::Format("%5.1f", VBG);
-                  ptr.set = wxString::Format("%03.0f", dir);
-                  ptr.rate = wxString::Format("%5.1f", spd);
-                  ptr.icon_name = "Symbol-X-Large-Magenta";
-                  tr.m_positionslist.push_back(ptr);
-
-                  DistanceBearingMercator_Plugin(
-                      latN[wpn + 1], lonN[wpn + 1], lati, loni, &myBrng,
-                      &waypointDistance);  // how far to the next waypoint?
-                  timeToWaypoint = waypointDistance / VBG;
-
-                  if (timeToWaypoint < 1) {
-                    z = numEP + 1;  // to stop the next EP being made
-
-                    timeToRun = 1 - timeToWaypoint;
-                    dtCurrent = AdvanceSeconds(dtCurrent, timeToWaypoint);
-                    ptrDist = timeToWaypoint * VBG;
-                  }
-
-                  latF = lati;
-                  lonF = loni;
-                }
-              }
-            }
-          }  // Finished the waypoints after zero
-        }    // Finished all waypoints
-
-        // print the last routepoint
-        PlugIn_Waypoint* endPoint = new PlugIn_Waypoint(
-            latN[wpn], lonN[wpn], "Circle", waypointName[wpn]);
-        endPoint->m_MarkName = waypointName[wpn];
-        endPoint->m_MarkDescription =
-            dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-        endPoint->m_GUID =
-            wxString::Format("%i", (int)GetRandomNumber(1, 4000000));
-        newRoute->pWaypointList->Append(endPoint);
-
-        //
-        // print the last my_point for writing GPX
-        //
-
-        my_point.lat = wxString::Format("%f", latN[wpn]);
-        my_point.lon = wxString::Format("%f", lonN[wpn]);
-        my_point.routepoint = 1;
-        my_point.wpt_num = waypointName[wpn].mb_str();
-        my_point.name = waypointName[wpn].mb_str();
-        my_point.time = dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-        my_points.push_back(my_point);
-
-        // print the last waypoint detail for the TidalRoute
-        tr.EndTime = dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-
-        trTime = dtCurrent - dtStart;
-        trTimeHours = (double)trTime.GetMinutes() / 60;
-        tr.Time = wxString::Format("%.1f", trTimeHours);
-
-        ptrDist = waypointDistance;
-        tdist += ptrDist;
-
-        tr.Distance = wxString::Format(_("%.1f"), tdist);
-
-        ptr.name = waypointName[wpn].mb_str();
-        ptr.lat = wxString::Format("%8.4f", latN[n]);
-        ptr.lon = wxString::Format("%8.4f", lonN[n]);
-        ptr.time = dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-        ptr.guid = endPoint->m_GUID;
-        ptr.set = "----";
-        ptr.rate = "----";
-        ptr.CTS = "----";
-        ptr.SMG = wxString::Format("%5.1f", VBG);
-        ptr.distTo = wxString::Format("%.1f", ptrDist);
-        ptr.brgTo = wxString::Format("%03.0f", myBrng);
-        ptr.icon_name = "Circle";
-
-        tr.m_positionslist.push_back(ptr);
-        tr.End = waypointName[wpn].mb_str();
-        tr.Type = "DR";
-        m_TidalRoutes.push_back(tr);
-
-        // AddPlugInRoute(newRoute); // add the route to OpenCPN routes
-        // and display the route on the chart
-
-        SaveXML(m_default_configuration_path);  // add the route and extra
-                                                // detail (times, CTS etc)
-                                                // to the configuration file
-
-        m_ConfigurationDialog.m_lRoutes->Append(tr.Name);
-        m_ConfigurationDialog.Refresh();
-        GetParent()->Refresh();
-
-        for (std::vector<Position>::iterator itOut = my_points.begin();
-             itOut != my_points.end(); itOut++) {
-
-          double value, value1;
-          if (!(*itOut).lat.ToDouble(&value)) { /* error! */
-          }
-          lati = value;
-          if (!(*itOut).lon.ToDouble(&value1)) { /* error! */
-          }
-          loni = value1;
+  if (m_sweepTable) {
+    wxListCtrl* list = m_sweepTable->m_wpList;
 
-          if ((*itOut).routepoint == 1) {
-            if (write_file) {
-              Addpoint(Route, wxString::Format("%f", lati),
-                       wxString::Format("%f", loni), (*itOut).name,
-                      "Diamond", "WPT");
-            }
-          } else {
-            if ((*itOut).routepoint == 0) {
-              if (write_file) {
-                Addpoint(Route, wxString::Format("%f", lati),
-                         wxString::Format("%f", loni), (*itOut).name,
-                         "Symbol-X-Large-Magenta", "WPT");
-              }
-            }
-          }
-        }
+    // Keep the rows in departure order
+    long in = 0;
+    while (in < list->GetItemCount() && (int)list->GetItemData(in) < index)
+      in++;
 
-        my_points.clear();
-        break;
-      }
+    list->InsertItem(in, "", -1);
+    list->SetItemData(in, index);
+    list->SetItem(in, 0, tr.Name);
+    list->SetItem(in, 1, tr.Start);
+    list->SetItem(in, 2, tr.End);
+    list->SetItem(in, 3, tr.StartTime);
+    list->SetItem(in, 4, tr.EndTime);
+    list->SetItem(in, 5, tr.Time);
+    list->SetItem(in, 6, tr.Distance);
+    list->SetItem(in, 7, tr.Type);
+  }
+}
 
-      default: {  // Note the colon, not a semicolon
-        cout << "Error, bad input, quitting\n";
-        break;
-      }
+void otidalrouteUIDialog::OnSweepFinished() {
+  m_sweep.Wait();
+  StopSampling();
+
+  m_bCalcDR->Enable();
+  m_bCalcETA->Enable();
+  m_bBestDeparture->Enable();
+  m_bSweep->SetLabel(_("Sweep Departures"));
+
+  if (m_sweepResults.empty())
+    SaveXML(m_default_configuration_path);  // add the ETA routes to the
+                                            // configuration file once
+  else if (m_sweepBest >= 0 && !m_sweep.IsCancelled())
+    AddSweepRoute(m_sweepBest, false);  // saved when the dialog closes
+
+  if (m_sweepTable && m_sweepBest >= 0) {
+    wxListCtrl* list = m_sweepTable->m_wpList;
+    long row = list->FindItem(-1, (wxUIntPtr)m_sweepBest);
+    if (row >= 0) {
+      list->SetItemState(row, wxLIST_STATE_SELECTED, wxLIST_STATE_SELECTED);
+      list->EnsureVisible(row);
     }
+  }
 
-    if (write_file) {
-      TiXmlElement* Extensions = new TiXmlElement("extensions");
+  GetParent()->Refresh();
+  pPlugIn->m_potidalrouteDialog->Show();
 
-      TiXmlElement* StartN = new TiXmlElement("opencpn:start");
-      TiXmlText* text5 = new TiXmlText(waypointName[0].ToUTF8());
-      Extensions->LinkEndChild(StartN);
-      StartN->LinkEndChild(text5);
+  if (m_sweepFailed) ReportPassageError(m_sweepError);
 
-      TiXmlElement* EndN = new TiXmlElement("opencpn:end");
-      TiXmlText* text6 = new TiXmlText(waypointName[n].ToUTF8());
-      Extensions->LinkEndChild(EndN);
-      EndN->LinkEndChild(text6);
+  wxLogMessage("otidalroute_pi: GRIB samples %lu cached, %lu requested",
+               pPlugIn->m_GribCache.m_Hits, pPlugIn->m_GribCache.m_Misses);
 
-      Route->LinkEndChild(Extensions);
+  if (m_sweep.IsCancelled()) {
+    wxMessageBox(_("Departure sweep cancelled"));
+  } else if (m_sweepTable && m_sweepBest >= 0) {
+    wxMessageBox(wxString::Format(
+        _("Fastest departure: %s (%.1f hours)\n\nDouble click a departure "
+          "in the table to add it as a route"),
+        m_sweepBestStart, m_sweepBestHours));
+  } else {
+    wxMessageBox(_("ETA Routes have been calculated!"));
+  }
+}
 
-      root->LinkEndChild(Route);
+// Adds departure index of the last sweep to the routes, false if it
+// failed or is there already
+bool otidalrouteUIDialog::AddSweepRoute(int index, bool save) {
+  if (index < 0 || index >= (int)m_sweepResults.size() ||
+      m_sweepResults[index].status != PASSAGE_OK)
+    return false;
 
-      wxCharBuffer buffer = s.ToUTF8();
-      if (dbg) std::cout << buffer.data() << std::endl;
-      doc.SaveFile(buffer.data());
-    }
+  TidalRoute tr;
+  tr.Name = SweepRouteName(index);
+  tr.Type = _("ETA");
+  for (std::list<TidalRoute>::iterator it = m_TidalRoutes.begin();
+       it != m_TidalRoutes.end(); it++) {
+    if ((*it).Name == tr.Name) return false;
+  }
+  AddPassage(m_sweepResults[index], tr, "EP", "Triangle", save);
+  return true;
+}
 
-    // end of if no error occured
+void otidalrouteUIDialog::OnSweepRowActivated(wxListEvent& event) {
+  // Rows of the table of an earlier sweep no longer have their results
+  if (!m_sweepTable || event.GetEventObject() != m_sweepTable->m_wpList)
+    return;
 
-    if (error_occured == true) {
-      wxLogMessage(_("Error in calculation. Please check input!"));
-      wxMessageBox(_("Error in calculation. Please check input!"));
-    }
-  }
-  GetParent()->Refresh();
-  pPlugIn->m_potidalrouteDialog->Show();
+  int index = (int)event.GetData();
+  if (AddSweepRoute(index, true))
+    wxMessageBox(wxString::Format(_("Route %s has been added"),
+                                  SweepRouteName(index)));
+  else
+    wxMessageBox(_("Route name already exists, please edit the name"));
+}
 
-  wxMessageBox(_("DR Route has been calculated!"));
+void otidalrouteUIDialog::CancelCalculation() {
+  m_cancelSampling = true;
+  m_sweep.Cancel();
+  if (m_solver) m_solver->Cancel();
 }
 
-void otidalrouteUIDialog::CalcETA(wxCommandEvent& event, bool write_file,
-                                  int Pattern) {
+void otidalrouteUIDialog::BestDeparture(wxCommandEvent& event) {
+  if (m_solverThread.joinable()) {  // the button cancels a running search
+    CancelCalculation();
+    return;
+  }
+
   if (m_tRouteName->GetValue() == wxEmptyString) {
     wxMessageBox(_("Please enter a name for the route!"));
     return;
@@ -1414,823 +1296,337 @@ void otidalrouteUIDialog::CalcETA(wxCommandEvent& event, bool write_file,
     return;
   }
 
-  wxString s_departureTimes = m_choiceDepartureTimes->GetStringSelection();
-  int m_departureTimes = wxAtoi(s_departureTimes);
-  int r = 0;
-  wxString m_RouteName;
-  gotMyGPXFile = false;  // only load the raw gpx file once
-  if (OpenXML(gotMyGPXFile)) {
-    for (r = 0; r < m_departureTimes; r++) {
-      TidalRoute tr;  // tidal route for saving in the config file
-      PlugIn_Route* newRoute =
-          new PlugIn_Route;  // for immediate use as a route
-                             // on OpenCPN chart display
-
-      Position ptr;
-
-      if (m_TidalRoutes.empty()) {
-        m_RouteName = m_tRouteName->GetValue() + wxT(".") +
-                      wxString::Format(wxT("%i"), r) + wxT(".") + wxT("EP");
-        tr.Name = m_RouteName;
-        tr.Type = _("ETA");
-      } else {
-        for (std::list<TidalRoute>::iterator it = m_TidalRoutes.begin();
-             it != m_TidalRoutes.end(); it++) {
-          m_RouteName = m_tRouteName->GetValue() + wxT(".") +
-                        wxString::Format(wxT("%i"), r) + wxT(".") + wxT("EP");
-          if ((*it).Name == m_RouteName) {
-            wxMessageBox(_("Route name already exists, please edit the name"));
-            return;
-          } else {
-            tr.m_positionslist.clear();
-            tr.Name = m_RouteName;
-            tr.Type = _("ETA");
-          }
-        }
-      }
-
-      newRoute->m_NameString = tr.Name;
-      newRoute->m_GUID =
-          wxString::Format("%i", (int)GetRandomNumber(1, 4000000));
-
-      tr.Start = wxT("Start");
-      tr.End = wxT("End");
-      tr.m_GUID = newRoute->m_GUID;
-
-      bool error_occured = false;
-
-      double lat1, lon1;
-
-      int num_hours = 1;
-      int n = 0;
-
-      lat1 = 0.0;
-      lon1 = 0.0;
-
-      wxString s;
-      if (write_file) {
-        wxFileDialog dlg(this, _("Export ETA Positions in GPX file as"),
-                         wxEmptyString, wxEmptyString,
-                         "GPX files (*.gpx)|*.gpx|All files (*.*)|*.*",
-                         wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
-        if (dlg.ShowModal() == wxID_CANCEL) {
-          error_occured = true;  // the user changed idea...
-          return;
-        }
-
-        s = dlg.GetPath();
-        if (dlg.GetPath() == wxEmptyString) {
-          error_occured = true;
-          if (dbg) printf("Empty Path\n");
-        }
-      }
-
-      // Validate input ranges
-      if (!error_occured) {
-        if (std::abs(lat1) > 90) {
-          error_occured = true;
-        }
-        if (std::abs(lon1) > 180) {
-          error_occured = true;
-        }
-        if (error_occured) wxMessageBox(_("error in input range validation"));
-      }
-
-      // Start writing GPX
-      TiXmlDocument doc;
-      TiXmlDeclaration* decl = new TiXmlDeclaration("1.0", "utf-8", "");
-      doc.LinkEndChild(decl);
-      TiXmlElement* root = new TiXmlElement("gpx");
-      TiXmlElement* Route = new TiXmlElement("rte");
-      TiXmlElement* RouteName = new TiXmlElement("name");
-      TiXmlText* text4 = new TiXmlText(this->m_tRouteName->GetValue().ToUTF8());
-
-      if (write_file) {
-        doc.LinkEndChild(root);
-        root->SetAttribute("version", "0.1");
-        root->SetAttribute("creator", "otidalroute_pi by Rasbats");
-        root->SetAttribute("xmlns:xsi",
-                           "http://www.w3.org/2001/XMLSchema-instance");
-        root->SetAttribute("xmlns:gpxx",
-                           "http://www.garmin.com/xmlschemas/GpxExtensions/v3");
-        root->SetAttribute("xsi:schemaLocation",
-                           "http://www.topografix.com/GPX/1/1 "
-                           "http://www.topografix.com/GPX/1/1/gpx.xsd");
-        root->SetAttribute("xmlns:opencpn", "http://www.opencpn.org");
-        Route->LinkEndChild(RouteName);
-        RouteName->LinkEndChild(text4);
-      }
+  double hours, interval;
+  if (!m_tSweepHours->GetValue().ToDouble(&hours) || hours < 0 ||
+      !m_tSweepInterval->GetValue().ToDouble(&interval) || interval < 1) {
+    wxMessageBox(_("Please enter the departure window and interval"));
+    return;
+  }
 
-      switch (Pattern) {
-        case 1: {
-          if (dbg) cout << "ETA Calculation\n";
-          double speed = 0;
+  // Optional arrival window
+  wxDateTime arriveAfter, arriveBefore;
+  if ((m_tArriveAfter->GetValue() != wxEmptyString &&
+       !arriveAfter.ParseDateTime(m_tArriveAfter->GetValue())) ||
+      (m_tArriveBefore->GetValue() != wxEmptyString &&
+       !arriveBefore.ParseDateTime(m_tArriveBefore->GetValue()))) {
+    wxMessageBox(_("Please enter the arrival window as yyyy-mm-dd hh:mm"));
+    return;
+  }
 
-          if (!this->m_tSpeed->GetValue().ToDouble(&speed)) {
-            speed = 5.0;
-          }  // 5 kts default speed
+  wxString m_RouteName = m_tRouteName->GetValue() + ".best.EP";
+  for (std::list<TidalRoute>::iterator it = m_TidalRoutes.begin();
+       it != m_TidalRoutes.end(); it++) {
+    if ((*it).Name == m_RouteName) {
+      wxMessageBox(_("Route name already exists, please edit the name"));
+      return;
+    }
+  }
 
-          double lati, loni;
-          double latN[200], lonN[200];
-          double latF, lonF;
+  gotMyGPXFile = false;
+  if (!OpenXML(gotMyGPXFile)) return;
+
+  double speed = 0;
+  if (!this->m_tSpeed->GetValue().ToDouble(&speed)) {
+    speed = 5.0;
+  }  // 5 kts default speed
+
+  wxDateTime dt;
+  dt.ParseDateTime(m_textCtrl1->GetValue());  // earliest departure
+  m_textCtrl1->SetValue(dt.Format("%Y-%m-%d  %H:%M "));
+
+  std::vector<PassageWaypoint> waypoints;
+  GetPassageWaypoints(waypoints);
+
+  time_t first = dt.GetTicks();
+  time_t last = first + (time_t)(hours * 3600);
+
+  m_solver.reset(new DepartureSolver(
+      TidalPassageEngine(speed, StartSampling(waypoints, speed, first, last),
+                         GetETATolerance()),
+      waypoints));
+  m_solver->SetArrivalWindow(
+      arriveAfter.IsValid() ? arriveAfter.GetTicks() : 0,
+      arriveBefore.IsValid() ? arriveBefore.GetTicks() : 0);
+
+  m_bCalcDR->Disable();
+  m_bCalcETA->Disable();
+  m_bSweep->Disable();
+  m_bBestDeparture->SetLabel(_("Cancel Search"));
+
+  // The solver samples the GRIB through the GUI thread, so it must not
+  // run on it
+  int step = interval * 60;
+  m_solverThread = std::thread([this, first, last, step]() {
+    m_solver->Solve(first, last, step, 60);
+    CallAfter([this]() { OnSolverFinished(); });
+  });
+}
 
-          Position my_point;
+void otidalrouteUIDialog::OnSolverFinished() {
+  m_solverThread.join();
 
-          double value, value1;
+  m_bCalcDR->Enable();
+  m_bCalcETA->Enable();
+  m_bSweep->Enable();
+  m_bBestDeparture->SetLabel(_("Best Departure"));
 
-          for (std::vector<Position>::iterator it = my_positions.begin();
-               it != my_positions.end(); it++) {
-            if (!(*it).lat.ToDouble(&value)) { /* error! */
-            }
-            lati = value;
-            if (!(*it).lon.ToDouble(&value1)) { /* error! */
-            }
-            loni = value1;
+  if (m_solver->IsCancelled()) {
+    StopSampling();
+    m_solver.reset();
+    wxMessageBox(_("Departure search cancelled"));
+    return;
+  }
 
-            waypointName[n] = (*it).name;
-            // wxMessageBox(waypointName[n]);
+  const DepartureSample& best = m_solver->m_Best;
+  if (!best.ok) {
+    StopSampling();
+    m_solver.reset();
+    wxMessageBox(_("No departure in the window gives a passage.\n"
+                   "Is the Grib available for the whole window?"));
+    return;
+  }
 
-            latN[n] = lati;
-            lonN[n] = loni;
+  // The ETA against departure curve
+  TableRoutes* tableroutes = new TableRoutes(
+      this, 7000, " Departure Times", wxPoint(200, 200), wxSize(650, 400),
+      wxDEFAULT_DIALOG_STYLE | wxRESIZE_BORDER);
 
-            n++;
-          }
+  for (size_t i = 0; i < m_solver->m_Curve.size(); i++) {
+    const DepartureSample& sample = m_solver->m_Curve[i];
+    wxString type = sample.refined ? _("Refined") : _("Coarse");
+    if (sample.departure == best.departure) type = _("Best");
+
+    tableroutes->m_wpList->InsertItem(i, "", -1);
+    tableroutes->m_wpList->SetItem(i, 3,
+                                   wxDateTime((time_t)sample.departure)
+                                       .Format("%Y-%m-%d  %H:%M "));
+    if (sample.ok) {
+      tableroutes->m_wpList->SetItem(i, 4,
+                                     wxDateTime((time_t)sample.arrival)
+                                         .Format(" %a %d-%b-%Y  %H:%M"));
+      tableroutes->m_wpList->SetItem(
+          i, 5, wxString::Format("%.1f", sample.hours));
+    } else {
+      tableroutes->m_wpList->SetItem(i, 4, "----");
+      tableroutes->m_wpList->SetItem(i, 5, "----");
+    }
+    tableroutes->m_wpList->SetItem(i, 7, type);
+  }
+  tableroutes->Show();
 
-          // my_positions.clear();
-          n--;
+  // Add the best departure as a route. We are on the GUI thread so the
+  // sampler goes straight to the GRIB plugin.
+  PassageResult result = m_solver->Run(best.departure);
+  if (result.status == PASSAGE_OK) {
+    TidalRoute tr;
+    tr.Name = m_tRouteName->GetValue() + ".best.EP";
+    tr.Type = _("ETA");
+    AddPassage(result, tr, "EP", "Triangle");
+  }
 
-          int routepoints = n + 1;
+  int window = m_solver->m_Curve.back().departure -
+               m_solver->m_Curve.front().departure;
+  wxMessageBox(wxString::Format(
+      _("Best departure: %s\nPassage time: %.1f hours\n"
+        "%i passages calculated (%i coarse), a one minute sweep would "
+        "take %i"),
+      wxDateTime((time_t)best.departure).Format("%Y-%m-%d  %H:%M"),
+      best.hours, m_solver->m_Evaluations, m_solver->m_CoarseEvaluations,
+      window / 60 + 1));
 
-          double myDist, myBrng;
-          myBrng = 0;
-          myDist = 0;
+  StopSampling();
+  m_solver.reset();
 
-          double myLast, route_dist;
+  GetParent()->Refresh();
+}
 
-          route_dist = 0;
-          myLast = 0;
-          double total_dist = 0;
-          int i, c;
+void otidalrouteUIDialog::GetPassageWaypoints(
+    std::vector<PassageWaypoint>& waypoints) {
+  PassageWaypoint wp;
+  double value, value1;
+  int n = 0;
+
+  // Every point of the route, however many
+  waypoints.clear();
+  waypointName.resize(my_positions.size());
+  for (std::vector<Position>::iterator it = my_positions.begin();
+       it != my_positions.end(); it++) {
+    if (!(*it).lat.ToDouble(&value)) { /* error! */
+    }
+    if (!(*it).lon.ToDouble(&value1)) { /* error! */
+    }
+    wp.lat = value;
+    wp.lon = value1;
+    waypoints.push_back(wp);
 
-          lati = latN[0];
-          loni = lonN[0];
+    waypointName[n] = (*it).name;
+    n++;
+  }
+}
 
-          double VBG, BC, VBG1;
-          VBG = 0;
-          VBG1 = 0;
-          int tc_index = 0;
-          c = 0;
+bool otidalrouteUIDialog::GetGPXFileName(wxString caption, wxString& path) {
+  wxFileDialog dlg(this, caption, wxEmptyString, wxEmptyString,
+                   "GPX files (*.gpx)|*.gpx|All files (*.*)|*.*",
+                   wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+  if (dlg.ShowModal() == wxID_CANCEL) {
+    return false;  // the user changed idea...
+  }
 
-          bool m_bGrib;
-          double spd, dir;
-          spd = 0;
-          dir = 0;
+  path = dlg.GetPath();
+  if (path == wxEmptyString) {
+    if (dbg) printf("Empty Path\n");
+    wxMessageBox(_("Error in calculation. Please check input!"));
+    return false;
+  }
+  return true;
+}
 
-          double iDist = 0;
-          double tdist = 0;  // For accumulating the total distance by adding
-                             // the distance for each leg
-          double ptrDist = 0;
-          int epNumber = 0;
-          wxString epName;
+void otidalrouteUIDialog::ReportPassageError(PassageStatus status) {
+  switch (status) {
+    case PASSAGE_NO_CURRENT:
+      wxMessageBox(
+          _("Route start date is not compatible with this Grib \n Or "
+            "Grib is not available for part of the route"));
+      break;
+    case PASSAGE_CURRENT_TOO_STRONG:
+      wxMessageBox(_("The tidal current is too strong for the boat speed"));
+      break;
+    default:
+      wxLogMessage(_("Error in calculation. Please check input!"));
+      wxMessageBox(_("Error in calculation. Please check input!"));
+      break;
+  }
+}
 
-          wxDateTime dt, dtCurrent;
+void otidalrouteUIDialog::FillPassage(const PassageResult& result,
+                                      TidalRoute& tr, wxString epPrefix,
+                                      wxString epIcon) {
+  Position ptr;
+  size_t last = result.points.size() - 1;
 
-          wxString ddt, sdt;
-          wxTimeSpan HourSpan;
-          HourSpan = wxTimeSpan::Hours(1);
+  tr.m_GUID = wxString::Format("%i", (int)GetRandomNumber(1, 4000000));
+  tr.m_positionslist.clear();
 
-          wxDateTime dtStart, dtEnd;
-          wxTimeSpan trTime;
-          double trTimeHours;
+  for (size_t i = 0; i < result.points.size(); i++) {
+    const PassagePoint& p = result.points[i];
+    wxDateTime dtCurrent((time_t)p.time);
 
-          sdt = m_textCtrl1->GetValue();  // date/time route starts
-          dt.ParseDateTime(sdt);
+    if (p.waypoint >= 0) {
+      ptr.name = waypointName[p.waypoint];
+      ptr.icon_name = "Circle";
+    } else {
+      ptr.name = epPrefix + wxString::Format("%i", p.epNumber);
+      ptr.icon_name = epIcon;
+    }
+    ptr.lat = wxString::Format("%8.4f", p.lat);
+    ptr.lon = wxString::Format("%8.4f", p.lon);
+    ptr.time = dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
+    ptr.guid = wxString::Format("%i", (int)GetRandomNumber(1, 4000000));
+    ptr.show_name = true;
+    ptr.SMG = wxString::Format("%5.1f", p.smg);
+
+    if (i == 0) {
+      ptr.distTo = "----";
+      ptr.brgTo = "----";
+    } else {
+      ptr.distTo = wxString::Format("%.1f", p.distTo);
+      ptr.brgTo = wxString::Format("%03.0f", p.brgTo);
+    }
 
-          if (r != 0) {
-            dt = dt + wxTimeSpan::Hours(1);
-          }
-          sdt = dt.Format("%Y-%m-%d  %H:%M ");
-          m_textCtrl1->SetValue(sdt);
-
-          tr.StartTime = sdt;
-
-          dtStart = dt;
-          dtCurrent = dt;
-
-          //
-          // Time iso distance (3 mins) logic
-          //
-
-          /*
-                        // We are trying to do three things:
-                        //
-                        // **Make ptr points on the tidal route for making a
-                           route table etc
-                        //
-                        // **Option to save a GPX file of the calculated route
-                        //
-                        // **Making a new OpenCPN route for display on the chart
-                        //
-           */
-          int wpn = 0;  // waypoint number
-          double timeToRun = 0;
-          double timeToWaypoint = 0;
-          double waypointDistance;
-          double fractpart, intpart;
-          int numEP;
-
-          //
-          // Loop through the waypoints of the route
-          //
-          for (wpn; wpn < n; wpn++) {  // loop through the waypoints
-
-            DistanceBearingMercator_Plugin(latN[wpn + 1], lonN[wpn + 1],
-                                           latN[wpn], lonN[wpn], &myBrng,
-                                           &myDist);
-
-            // For the tidal current we use the position at the waypoint to
-            // estimate the current and use the current time.
-            // This is an approximation.
-
-            m_bGrib = GetGribSpdDir(dtCurrent, latN[wpn], lonN[wpn], spd, dir);
-            if (!m_bGrib) {
-              wxMessageBox(
-                  _("Route start date is not compatible with this Grib \n Or "
-                    "Grib is not available for part of the route"));
-              return;
-            }
+    if (i == last) {
+      ptr.set = "----";
+      ptr.rate = "----";
+      ptr.CTS = "----";
+    } else {
+      ptr.set = wxString::Format("%03.0f", p.set);
+      ptr.rate = wxString::Format("%5.1f", p.rate);
+      ptr.CTS = wxString::Format("%03.0f", p.cts);
+    }
 
-            CTSWithCurrent(myBrng, VBG, dir, spd, BC,
-                           speed);  // VBG = velocity of boat over ground
-
-            //
-            // set up the waypoint
-            //
-            //
-
-            PlugIn_Waypoint* newPoint;
-
-            newPoint = new PlugIn_Waypoint(
-                latN[wpn], lonN[wpn], wxT("Symbol-Empty"), waypointName[wpn]);
-
-            newPoint->m_GUID =
-                wxString::Format("%i", (int)GetRandomNumber(1, 4000000));
-            newPoint->m_MarkDescription =
-                dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-            newRoute->pWaypointList->Append(newPoint);
-
-            //
-            // Save the GPX file routepoint
-            //
-
-            my_point.lat = wxString::Format("%f", latN[wpn]);
-            my_point.lon = wxString::Format("%f", lonN[wpn]);
-            my_point.routepoint = 1;
-            my_point.wpt_num = waypointName[wpn].mb_str();
-            my_point.name = waypointName[wpn].mb_str();
-            my_point.time = dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-            my_points.push_back(my_point);
-
-            //
-            // Save the route point for the route table
-            //
-
-            ptr.name = waypointName[wpn].mb_str();
-            ptr.time = dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-            ptr.lat = wxString::Format("%8.4f", latN[wpn]);
-            ptr.lon = wxString::Format("%8.4f", lonN[wpn]);
-            ptr.guid = newPoint->m_GUID;
-            ptr.CTS = wxString::Format("%03.0f", BC);
-            ptr.SMG = wxString::Format("%5.1f", VBG);
-
-            if (wpn == 0) {
-              ptr.distTo = "----";
-              ptr.brgTo = "----";
-              VBG1 = VBG;
-            } else {
-              tdist += ptrDist;
-              ptr.distTo = wxString::Format("%.4f", ptrDist);
-              ptr.brgTo = wxString::Format("%03.0f", myBrng);
-            }
+    tr.m_positionslist.push_back(ptr);
+  }
 
-            ptr.set = wxString::Format("%03.0f", dir);
-            ptr.rate = wxString::Format("%5.1f", spd);
-            ptr.icon_name = "Circle";
-
-            tr.m_positionslist.push_back(ptr);
-
-            latF = latN[wpn];  // Position of the last waypoint
-            lonF = lonN[wpn];
-
-            if (wpn == 0) {
-              VBG1 = VBG;
-              DistanceBearingMercator_Plugin(
-                  latN[wpn + 1], lonN[wpn + 1], latN[wpn], lonN[wpn], &myBrng,
-                  &waypointDistance);  // how far to the next waypoint?
-
-              timeToWaypoint = waypointDistance / VBG1;
-
-              if (timeToWaypoint < 1) {
-                // no space for an EP
-
-                timeToRun = 1 - timeToWaypoint;
-                //
-                // timeToRun is the part of one hour remaining to run after
-                // passing the waypoint
-                //
-                tr.Start = waypointName[wpn].mb_str();
-                dtCurrent = AdvanceSeconds(dtCurrent, timeToWaypoint);
-                ptrDist = waypointDistance;
-
-              } else {
-                tr.Start = waypointName[wpn].mb_str();  // name does not change
-
-                // Move to the EP on this leg with initial VBG (VBG1)
-                PositionBearingDistanceMercator_Plugin(
-                    latN[wpn], lonN[wpn], myBrng, VBG1, &lati, &loni);
-
-                // Move on one hour to the first EP
-                dtCurrent = dtCurrent.Add(HourSpan);
-
-                // Find the tidal current at the EP
-                m_bGrib = GetGribSpdDir(dtCurrent, lati, loni, spd, dir);
-                if (!m_bGrib) {
-                  wxMessageBox(
-                      _("Route start date is not compatible with this Grib "
-                        "\n Or "
-                        "Grib is not available for part of the route"));
-                  return;
-                }
-
-                CTSWithCurrent(myBrng, VBG, dir, spd, BC,
-                               speed);  // VBG = velocity of boat over ground
-
-                epNumber++;
-                epName = "EP" + wxString::Format(wxT("%i"), epNumber);
-                PlugIn_Waypoint* epPoint =
-                    new PlugIn_Waypoint(lati, loni, wxT("Triangle"), epName);
-                epPoint->m_IconName = wxT("Triangle");
-                epPoint->m_GUID = wxString::Format(
-                    "%i", (int)GetRandomNumber(1, 4000000));
-                newRoute->pWaypointList->Append(
-                    epPoint);  // for the OpenCPN display route
-
-                // print EP for the GPX file
-                my_point.lat = wxString::Format(wxT("%f"), lati);
-                my_point.lon = wxString::Format(wxT("%f"), loni);
-                my_point.routepoint = 0;
-                my_point.wpt_num =
-                    "EP" + wxString::Format("%i", epNumber);
-                my_point.name = "EP" + wxString::Format("%i", epNumber);
-                my_point.time = dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-                my_points.push_back(my_point);
-
-                // print EP for the config file
-
-                ptrDist = VBG1;
-                tdist += ptrDist;
-                ptr.name = epName;
-                ptr.lat = wxString::Format("%8.4f", lati);
-                ptr.lon = wxString::Format("%8.4f", loni);
-                ptr.time = dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-                ptr.guid = epPoint->m_GUID;
-                ptr.distTo = wxString::Format("%.4f", ptrDist);
-                ptr.brgTo = wxString::Format("%03.0f", myBrng);
-                ptr.CTS = wxString::Format("%03.0f", BC);
-                ptr.SMG = wxString::Format("%5.1f", VBG);
-                ptr.set = wxString::Format("%03.0f", dir);
-                ptr.rate = wxString::Format("%5.1f", spd);
-                ptr.icon_name = wxT("Triangle");
-                tr.m_positionslist.push_back(ptr);
-
-                // work out the number of EP
-                // must be more than one EP as we have worked this out already
-
-                DistanceBearingMercator_Plugin(
-                    latN[wpn + 1], lonN[wpn + 1], lati, loni, &myBrng,
-                    &waypointDistance);  // how far to the next waypoint?
-
-                // How many EP are possible on the first leg?
-
-                timeToWaypoint = waypointDistance / VBG;
-                fractpart = modf(timeToWaypoint, &intpart);
-                numEP = intpart;  // was intpart + 1
-
-                // wxString sSpeed = wxString::Format("%i", numEP);
-                // wxMessageBox(sSpeed);
-
-                if (numEP == 0) {
-                  timeToRun = 1 - timeToWaypoint;
-                  dtCurrent = AdvanceSeconds(dtCurrent, timeToWaypoint);
-                  ptrDist = timeToWaypoint * VBG;
-
-                  //
-                  // dtCurrent is now the time at waypoint 1
-                  //
-                }
-
-                else {
-                  latF = lati;
-                  lonF = loni;
-
-                  for (int z = 0; z <= numEP; z++) {
-                    ptrDist = VBG;
-
-                    PositionBearingDistanceMercator_Plugin(
-                        latF, lonF, myBrng, VBG, &lati,
-                        &loni);  // first waypoint of the leg
-
-                    // Time at the next plotted EP
-                    dtCurrent = dtCurrent.Add(HourSpan);
-
-                    // Find the tidal current at the EP
-                    m_bGrib = GetGribSpdDir(dtCurrent, lati, loni, spd, dir);
-                    if (!m_bGrib) {
-                      wxMessageBox(
-                          _("Route start date is not compatible with this Grib "
-                            "\n Or "
-                            "Grib is not available for part of the route"));
-                      return;
-                    }
-                    CTSWithCurrent(
-                        myBrng, VBG, dir, spd, BC,
-                        speed);  // VBG = velocity of boat over ground
-
-                    epNumber++;  // Add an EP
-                    epName = "EP" + wxString::Format(wxT("%i"), epNumber);
-                    PlugIn_Waypoint* epPoint = new PlugIn_Waypoint(
-                        lati, loni, wxT("Triangle"), epName);
-                    epPoint->m_IconName = wxT("Triangle");
-                    // epPoint->m_MarkDescription = ddt;
-                    epPoint->m_GUID = wxString::Format(
-                        "%i", (int)GetRandomNumber(1, 4000000));
-                    newRoute->pWaypointList->Append(
-                        epPoint);  // for the OpenCPN display route
-
-                    // print mid points for the GPX file
-                    my_point.lat = wxString::Format(wxT("%f"), lati);
-                    my_point.lon = wxString::Format(wxT("%f"), loni);
-                    my_point.routepoint = 0;
-                    my_point.wpt_num =
-                        "EP" + wxString::Format("%i", epNumber);
-                    my_point.name =
-                        "EP" + wxString::Format("%i", epNumber);
-                    my_point.time = dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-                    my_points.push_back(my_point);
-
-                    // print EP for the config file
-                    // ptrDist = VBG;
-                    tdist += ptrDist;
-                    ptr.name = epName;
-                    ptr.lat = wxString::Format("%8.4f", lati);
-                    ptr.lon = wxString::Format("%8.4f", loni);
-                    ptr.time = dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-                    ptr.guid = epPoint->m_GUID;
-                    ptr.distTo = wxString::Format("%.4f", ptrDist);
-                    ptr.brgTo = wxString::Format("%03.0f", myBrng);
-                    ptr.CTS = wxString::Format("%03.0f", BC);
-                    ptr.SMG = wxString::Format("%5.1f", VBG);
-                    ptr.set = wxString::Format("%03.0f", dir);
-                    ptr.rate = wxString::Format("%5.1f", spd);
-                    ptr.icon_name = wxT("Triangle");
-                    tr.m_positionslist.push_back(ptr);
-
-                    DistanceBearingMercator_Plugin(
-                        latN[wpn + 1], lonN[wpn + 1], lati, loni, &myBrng,
-                        &waypointDistance);  // how far to the next waypoint?
-
-                    timeToWaypoint = waypointDistance / VBG;
-
-                    if (timeToWaypoint < 1) {  // No time for another EP
-
-                      z = numEP + 1;  // to stop the next EP being made
-
-                      timeToRun = 1 - timeToWaypoint;
-                      dtCurrent = AdvanceSeconds(dtCurrent, timeToWaypoint);
-                      ptrDist = timeToWaypoint * VBG;
-                    }
-
-                    latF = lati;
-                    lonF = loni;
-                  }
-                }
-              }
-            }
+  tr.Start = waypointName[0];
+  tr.StartTime = wxDateTime((time_t)result.start).Format("%Y-%m-%d  %H:%M ");
+  tr.End = waypointName[result.points[last].waypoint];
+  tr.EndTime = wxDateTime((time_t)result.end).Format(" %a %d-%b-%Y  %H:%M");
+  tr.Time = wxString::Format("%.1f", result.Hours());
+  tr.Distance = wxString::Format("%.1f", result.distance);
+}
 
-            else {  // *************** After waypoint zero **********
-                    // **********************************************
-
-              DistanceBearingMercator_Plugin(
-                  latN[wpn + 1], lonN[wpn + 1], latN[wpn], lonN[wpn], &myBrng,
-                  &waypointDistance);  // how far to the next waypoint?
-
-              timeToWaypoint = waypointDistance / VBG;
-
-              if (timeToWaypoint < timeToRun) {
-                timeToRun = timeToRun - timeToWaypoint;
-                dtCurrent = AdvanceSeconds(dtCurrent, timeToWaypoint);
-                ptrDist = timeToWaypoint * VBG;
-                // Do not add an EP. The next position plotted is the route wpt.
-
-              } else {
-                // space for an EP
-                // we need the position for the first EP on the new leg ...
-                // latloni
-                //
-                double distEP = timeToRun * VBG;
-
-                PositionBearingDistanceMercator_Plugin(
-                    latN[wpn], lonN[wpn], myBrng, distEP, &lati,
-                    &loni);  // first EP of the new leg
-
-                //
-                // Time at the first EP of the leg
-                //
-                dtCurrent = AdvanceSeconds(dtCurrent, timeToRun);
-                ptrDist = timeToRun * VBG;
-                // Find the tidal current at the EP
-
-                m_bGrib = GetGribSpdDir(dtCurrent, lati, loni, spd, dir);
-                if (!m_bGrib) {
-                  wxMessageBox(
-                      _("Route start date is not compatible with this Grib "
-                        "\n Or "
-                        "Grib is not available for part of the route"));
-                  return;
-                }
-
-                CTSWithCurrent(myBrng, VBG, dir, spd, BC,
-                               speed);  // VBG = velocity of boat over ground
-
-                epNumber++;  // Add an EP
-                epName = "EP" + wxString::Format(wxT("%i"), epNumber);
-                PlugIn_Waypoint* epPoint =
-                    new PlugIn_Waypoint(lati, loni, wxT("Triangle"), epName);
-                epPoint->m_IconName = wxT("Triangle");
-                epPoint->m_GUID = wxString::Format(
-                    "%i", (int)GetRandomNumber(1, 4000000));
-                newRoute->pWaypointList->Append(
-                    epPoint);  // for the OpenCPN display route
-
-                // print EP for the GPX file
-                my_point.lat = wxString::Format(wxT("%f"), lati);
-                my_point.lon = wxString::Format(wxT("%f"), loni);
-                my_point.routepoint = 0;
-                my_point.wpt_num =
-                    "EP" + wxString::Format("%i", epNumber);
-                my_point.name = "EP" + wxString::Format("%i", epNumber);
-                my_point.time = dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-                my_points.push_back(my_point);
-
-                // print EP for the config file
-                tdist += ptrDist;
-                ptr.name = epName;
-                ptr.lat = wxString::Format("%8.4f", lati);
-                ptr.lon = wxString::Format("%8.4f", loni);
-                ptr.time = dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-                ptr.guid = epPoint->m_GUID;
-                ptr.distTo = wxString::Format("%.1f", ptrDist);
-                ptr.brgTo = wxString::Format("%03.0f", myBrng);
-                ptr.CTS = wxString::Format("%03.0f", BC);
-                ptr.SMG = wxString::Format("%5.1f", VBG);
-                ptr.set = wxString::Format("%03.0f", dir);
-                ptr.rate = wxString::Format("%5.1f", spd);
-                ptr.icon_name = wxT("Triangle");
-                tr.m_positionslist.push_back(ptr);
-
-                DistanceBearingMercator_Plugin(
-                    latN[wpn + 1], lonN[wpn + 1], lati, loni, &myBrng,
-                    &waypointDistance);  // how far to the next waypoint?
-
-                latF = lati;
-                lonF = loni;
-
-                // Find out if any space for more EP
-                timeToWaypoint = waypointDistance / VBG;
-                fractpart = modf(timeToWaypoint, &intpart);
-                numEP = intpart;
-
-                if (numEP == 0) {
-                  timeToRun = 1 - timeToWaypoint;
-                  dtCurrent = AdvanceSeconds(dtCurrent, timeToWaypoint);
-                  ptrDist = timeToWaypoint * VBG;
-
-                } else {
-                  for (int z = 0; z <= numEP; z++) {
-                    ptrDist = VBG;
-
-                    PositionBearingDistanceMercator_Plugin(
-                        latF, lonF, myBrng, VBG, &lati,
-                        &loni);  // first waypoint of the leg
-
-                    dtCurrent = dtCurrent.Add(HourSpan);
-
-                    m_bGrib = GetGribSpdDir(dtCurrent, lati, loni, spd, dir);
-
-                    if (!m_bGrib) {
-                      wxMessageBox(
-                          _("Route start date is not compatible with this Grib "
-                            "\n Or "
-                            "Grib is not available for part of the route"));
-                      return;
-                    }
-                    CTSWithCurrent(
-                        myBrng, VBG, dir, spd, BC,
-                        speed);  // VBG = velocity of boat over ground
-
-                    epNumber++;
-                    epName = "EP" + wxString::Format(wxT("%i"), epNumber);
-                    PlugIn_Waypoint* epPoint = new PlugIn_Waypoint(
-                        lati, loni, wxT("Triangle"), epName);
-                    epPoint->m_IconName = wxT("Triangle");
-                    epPoint->m_GUID = wxString::Format(
-                        "%i", (int)GetRandomNumber(1, 4000000));
-                    newRoute->pWaypointList->Append(
-                        epPoint);  // for the OpenCPN display route
-
-                    // print mid points for the GPX file
-                    my_point.lat = wxString::Format(wxT("%f"), lati);
-                    my_point.lon = wxString::Format(wxT("%f"), loni);
-                    my_point.routepoint = 0;
-                    my_point.wpt_num =
-                        "EP" + wxString::Format("%i", epNumber);
-                    my_point.name =
-                        "EP" + wxString::Format("%i", epNumber);
-                    my_point.time = dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-                    my_points.push_back(my_point);
-
-                    // print EP for the config file
-                    // ptrDist = VBG;
-                    tdist += ptrDist;
-                    ptr.name = epName;
-                    ptr.lat = wxString::Format("%8.4f", lati);
-                    ptr.lon = wxString::Format("%8.4f", loni);
-                    ptr.time = dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-                    ptr.guid = epPoint->m_GUID;
-                    ptr.distTo = wxString::Format("%.1f", ptrDist);
-                    ptr.brgTo = wxString::Format("%03.0f", myBrng);
-                    ptr.CTS = wxString::Format("%03.0f", BC);
-                    ptr.SMG = wxString::Format("%5.1f", VBG);
-                    ptr.set = wxString::Format("%03.0f", dir);
-                    ptr.rate = wxString::Format("%5.1f", spd);
-                    ptr.icon_name = wxT("Triangle");
-                    tr.m_positionslist.push_back(ptr);
-
-                    DistanceBearingMercator_Plugin(
-                        latN[wpn + 1], lonN[wpn + 1], lati, loni, &myBrng,
-                        &waypointDistance);  // how far to the next waypoint?
-                    timeToWaypoint = waypointDistance / VBG;
-
-                    if (timeToWaypoint < 1) {
-                      z = numEP + 1;  // to stop the next EP being made
-
-                      timeToRun = 1 - timeToWaypoint;
-                      dtCurrent = AdvanceSeconds(dtCurrent, timeToWaypoint);
-                      ptrDist = timeToWaypoint * VBG;
-                    }
-
-                    latF = lati;
-                    lonF = loni;
-                  }
-                }
-              }
-            }  // Finished the waypoints after zero
-          }    // Finished all waypoints
-
-          // print the last routepoint
-          PlugIn_Waypoint* endPoint = new PlugIn_Waypoint(
-              latN[wpn], lonN[wpn], wxT("Circle"), waypointName[wpn]);
-          endPoint->m_MarkName = waypointName[wpn];
-          endPoint->m_MarkDescription =
-              dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-          endPoint->m_GUID =
-              wxString::Format("%i", (int)GetRandomNumber(1, 4000000));
-          newRoute->pWaypointList->Append(endPoint);
-
-          //
-          // print the last my_point for writing GPX
-          //
-
-          my_point.lat = wxString::Format(wxT("%f"), latN[wpn]);
-          my_point.lon = wxString::Format(wxT("%f"), lonN[wpn]);
-          my_point.routepoint = 1;
-          my_point.wpt_num = waypointName[wpn].mb_str();
-          my_point.name = waypointName[wpn].mb_str();
-          my_point.time = dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-          my_points.push_back(my_point);
-
-          // print the last waypoint detail for the TidalRoute
-          tr.EndTime = dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-
-          trTime = dtCurrent - dtStart;
-          trTimeHours = (double)trTime.GetMinutes() / 60;
-          tr.Time = wxString::Format(_("%.1f"), trTimeHours);
-
-          ptrDist = waypointDistance;
-          tdist += ptrDist;
-
-          tr.Distance = wxString::Format(_("%.1f"), tdist);
-
-          ptr.name = waypointName[wpn].mb_str();
-          ptr.lat = wxString::Format("%8.4f", latN[n]);
-          ptr.lon = wxString::Format("%8.4f", lonN[n]);
-          ptr.time = dtCurrent.Format(" %a %d-%b-%Y  %H:%M");
-          ptr.guid = endPoint->m_GUID;
-          ptr.set = "----";
-          ptr.rate = "----";
-          ptr.CTS = "----";
-          ptr.SMG = wxString::Format("%5.1f", VBG);
-          ptr.distTo = wxString::Format("%.1f", ptrDist);
-          ptr.brgTo = wxString::Format("%03.0f", myBrng);
-          ptr.icon_name = wxT("Circle");
-
-          tr.m_positionslist.push_back(ptr);
-          tr.End = waypointName[wpn].mb_str();
-          tr.Type = wxT("ETA");
-          m_TidalRoutes.push_back(tr);
-
-          // AddPlugInRoute(newRoute); // add the route to OpenCPN routes
-          // and display the route on the chart
-
-          SaveXML(m_default_configuration_path);  // add the route and extra
-                                                  // detail (times, CTS etc)
-                                                  // to the configuration file
-
-          m_ConfigurationDialog.m_lRoutes->Append(tr.Name);
-          m_ConfigurationDialog.Refresh();
-          GetParent()->Refresh();
-
-          for (std::vector<Position>::iterator itOut = my_points.begin();
-               itOut != my_points.end(); itOut++) {
-
-            double value, value1;
-            if (!(*itOut).lat.ToDouble(&value)) { /* error! */
-            }
-            lati = value;
-            if (!(*itOut).lon.ToDouble(&value1)) { /* error! */
-            }
-            loni = value1;
-
-            if ((*itOut).routepoint == 1) {
-              if (write_file) {
-                Addpoint(Route, wxString::Format("%f", lati),
-                         wxString::Format("%f", loni), (*itOut).name,
-                         "Diamond", "WPT");
-              }
-            } else {
-              if ((*itOut).routepoint == 0) {
-                if (write_file) {
-                  Addpoint(Route, wxString::Format("%f", lati),
-                           wxString::Format(wxT("%f"), loni), (*itOut).name,
-                          "Triangle", "WPT");
-                }
-              }
-            }
-          }
+void otidalrouteUIDialog::AddPassage(const PassageResult& result,
+                                     TidalRoute& tr, wxString epPrefix,
+                                     wxString epIcon, bool save) {
+  FillPassage(result, tr, epPrefix, epIcon);
+  m_TidalRoutes.push_back(tr);
 
-          my_points.clear();
-          break;
-        }
+  if (save)
+    SaveXML(m_default_configuration_path);  // add the route and extra
+                                            // detail (times, CTS etc)
+                                            // to the configuration file
 
-        default: {  // Note the colon, not a semicolon
-          cout << "Error, bad input, quitting\n";
-          break;
-        }
-      }
+  m_ConfigurationDialog.m_lRoutes->Append(tr.Name);
+  m_ConfigurationDialog.Refresh();
+  GetParent()->Refresh();
+}
 
-      if (write_file) {
-        TiXmlElement* Extensions = new TiXmlElement("extensions");
+void otidalrouteUIDialog::WritePassageGPX(wxString filename,
+                                          const PassageResult& result,
+                                          wxString epPrefix, wxString epIcon) {
+  TiXmlDocument doc;
+  TiXmlDeclaration* decl = new TiXmlDeclaration("1.0", "utf-8", "");
+  doc.LinkEndChild(decl);
+  TiXmlElement* root = new TiXmlElement("gpx");
+  TiXmlElement* Route = new TiXmlElement("rte");
+  TiXmlElement* RouteName = new TiXmlElement("name");
+  TiXmlText* text4 = new TiXmlText(this->m_tRouteName->GetValue().ToUTF8());
 
-        TiXmlElement* StartN = new TiXmlElement("opencpn:start");
-        TiXmlText* text5 = new TiXmlText(waypointName[0].ToUTF8());
-        Extensions->LinkEndChild(StartN);
-        StartN->LinkEndChild(text5);
+  doc.LinkEndChild(root);
+  root->SetAttribute("version", "0.1");
+  root->SetAttribute("creator", "otidalroute_pi by Rasbats");
+  root->SetAttribute("xmlns:xsi", "http://www.w3.org/2001/XMLSchema-instance");
+  root->SetAttribute("xmlns:gpxx",
+                     "http://www.garmin.com/xmlschemas/GpxExtensions/v3");
+  root->SetAttribute("xsi:schemaLocation",
+                     "http://www.topografix.com/GPX/1/1 "
+                     "http://www.topografix.com/GPX/1/1/gpx.xsd");
+  root->SetAttribute("xmlns:opencpn", "http://www.opencpn.org");
+  Route->LinkEndChild(RouteName);
+  RouteName->LinkEndChild(text4);
+
+  for (size_t i = 0; i < result.points.size(); i++) {
+    const PassagePoint& p = result.points[i];
+    if (p.waypoint >= 0) {
+      Addpoint(Route, wxString::Format("%f", p.lat),
+               wxString::Format("%f", p.lon), waypointName[p.waypoint],
+               "Diamond", "WPT");
+    } else {
+      Addpoint(Route, wxString::Format("%f", p.lat),
+               wxString::Format("%f", p.lon),
+               epPrefix + wxString::Format("%i", p.epNumber), epIcon, "WPT");
+    }
+  }
 
-        TiXmlElement* EndN = new TiXmlElement("opencpn:end");
-        TiXmlText* text6 = new TiXmlText(waypointName[n].ToUTF8());
-        Extensions->LinkEndChild(EndN);
-        EndN->LinkEndChild(text6);
+  TiXmlElement* Extensions = new TiXmlElement("extensions");
 
-        Route->LinkEndChild(Extensions);
+  TiXmlElement* StartN = new TiXmlElement("opencpn:start");
+  TiXmlText* text5 = new TiXmlText(waypointName[0].ToUTF8());
+  Extensions->LinkEndChild(StartN);
+  StartN->LinkEndChild(text5);
 
-        root->LinkEndChild(Route);
+  TiXmlElement* EndN = new TiXmlElement("opencpn:end");
+  TiXmlText* text6 = new TiXmlText(
+      waypointName[result.points.back().waypoint].ToUTF8());
+  Extensions->LinkEndChild(EndN);
+  EndN->LinkEndChild(text6);
 
-        wxCharBuffer buffer = s.ToUTF8();
-        if (dbg) std::cout << buffer.data() << std::endl;
-        doc.SaveFile(buffer.data());
-      }
+  Route->LinkEndChild(Extensions);
 
-      // end of if no error occured
+  root->LinkEndChild(Route);
 
-      if (error_occured == true) {
-        wxLogMessage(_("Error in calculation. Please check input!"));
-        wxMessageBox(_("Error in calculation. Please check input!"));
-      }
-    }
-    GetParent()->Refresh();
-    pPlugIn->m_potidalrouteDialog->Show();
-  }
-  wxMessageBox(_("ETA Routes have been calculated!"));
+  wxCharBuffer buffer = filename.ToUTF8();
+  if (dbg) std::cout << buffer.data() << std::endl;
+  doc.SaveFile(buffer.data());
 }
 
 bool otidalrouteUIDialog::OpenXML(bool gotGPXFile) {
@@ -2384,20 +1780,288 @@ void otidalrouteUIDialog::Addpoint(TiXmlElement* Route, wxString ptlat,
   // done adding point
 }
 
+GribRecordSetPtr otidalrouteUIDialog::GetGribRecordSet(time_t t) {
+  if (m_gribReader.IsOpen()) return m_gribReader.GetRecordSet(t);
+
+  GribRecordSetPtr set;
+  if (pPlugIn->m_GribCache.Find(t, set)) return set;
+
+  pPlugIn->m_grib_time = t;
+  pPlugIn->m_bGribRequested = true;
+  pPlugIn->m_grib_set.reset();
+  RequestGrib(wxDateTime(t));
+  pPlugIn->m_bGribRequested = false;
+
+  set = pPlugIn->m_grib_set;
+  pPlugIn->m_grib_set.reset();
+  return set;
+}
+
+bool otidalrouteUIDialog::FindGribBracket(time_t t, time_t& before,
+                                          time_t& after,
+                                          GribRecordSetPtr& set) {
+  if (m_gribReader.IsOpen()) {
+    // The steps of the file are known, no need to ask for them
+    const std::vector<time_t>& steps = m_gribReader.Times();
+    std::vector<time_t>::const_iterator it =
+        std::upper_bound(steps.begin(), steps.end(), t);
+    if (it == steps.begin() || it == steps.end()) {
+      set = m_gribReader.GetRecordSet(it == steps.begin() ? steps.front()
+                                                          : steps.back());
+      return false;
+    }
+    before = *(it - 1);
+    after = before == t ? t : *it;
+    return true;
+  }
+
+  GribCurrentCache& cache = pPlugIn->m_GribCache;
+  if (cache.Bracket(t, before, after)) return true;
+
+  // Find out which forecast step t falls on
+  set = GetGribRecordSet(t);
+  if (!set) return false;
+  if (cache.Bracket(t, before, after, false)) return true;
+
+  // Look for the step on the other side of t, doubling the distance
+  // until the plugin returns another step. Before the interval between
+  // steps is known the first probe may be far too short: one minute after
+  // a 3 hourly step it takes seven doublings to reach the next one.
+  time_t step = GribCurrentCache::StepTime(set.get());
+  if (!step) return false;
+  const time_t maxGap = 8 * 24 * 3600;  // longer than any forecast step
+  time_t gap = cache.m_MinStep ? cache.m_MinStep
+                               : 2 * (t > step ? t - step : step - t);
+  for (; gap > 0 && gap <= maxGap; gap *= 2) {
+    GribRecordSetPtr probe =
+        GetGribRecordSet(step < t ? step + gap : step - gap);
+    if (!probe) break;
+    if (GribCurrentCache::StepTime(probe.get()) != step &&
+        cache.Bracket(t, before, after, false))
+      return true;
+  }
+  return false;
+}
+
 bool otidalrouteUIDialog::GetGribSpdDir(wxDateTime dt, double lat, double lon,
                                         double& spd, double& dir) {
-  wxDateTime dtime = dt;
-
-  pPlugIn->m_grib_lat = lat;
-  pPlugIn->m_grib_lon = lon;
-  RequestGrib(dtime);
-  if (pPlugIn->m_bGribValid) {
-    spd = pPlugIn->m_tr_spd;
-    dir = pPlugIn->m_tr_dir;
-    return true;
-  } else {
+  time_t t = dt.GetTicks();
+  time_t before, after;
+  GribRecordSetPtr set;
+
+  // No steps known either side of t: before the first or after the last
+  // step of the file, or no GRIB at all. The set nearest t, if any.
+  if (!FindGribBracket(t, before, after, set))
+    return GribCurrent(set.get(), lat, lon, dir, spd);
+
+  GribRecordSetPtr set1 = GetGribRecordSet(before);
+  if (before == after) return GribCurrent(set1.get(), lat, lon, dir, spd);
+  GribRecordSetPtr set2 = GetGribRecordSet(after);
+
+  // Blend the current at the two steps point-wise, rate and direction
+  // separately as GribRecord::Interpolated2DRecord does for whole grids
+  double dir1, spd1, dir2, spd2;
+  if (!GribCurrent(set1.get(), lat, lon, dir1, spd1) ||
+      !GribCurrent(set2.get(), lat, lon, dir2, spd2))
     return false;
+
+  double d = (double)(t - before) / (after - before);
+  double turn = dir2 - dir1;
+  if (turn > 180)
+    turn -= 360;
+  else if (turn < -180)
+    turn += 360;
+
+  spd = (1 - d) * spd1 + d * spd2;
+  dir = dir1 + d * turn;
+  if (dir < 0)
+    dir += 360;
+  else if (dir >= 360)
+    dir -= 360;
+  return true;
+}
+
+CurrentSampler* otidalrouteUIDialog::StartSampling(
+    const std::vector<PassageWaypoint>& waypoints, double speed,
+    time_t first, time_t last) {
+  m_cancelSampling = false;
+  m_sampler.reset(new GribCurrentSampler(this, &m_cancelSampling));
+  m_cube.reset();
+
+  // The file reader may be used from the worker threads directly
+  CurrentSampler* sampler = m_sampler.get();
+  if (m_gribReader.IsOpen()) sampler = &m_gribReader;
+
+  // Long enough for the last departure to arrive against a foul current
+  double distance = 0, legDist, legBrg;
+  for (size_t i = 1; i < waypoints.size(); i++) {
+    DistanceBearingMercator(waypoints[i].lat, waypoints[i].lon,
+                            waypoints[i - 1].lat, waypoints[i - 1].lon,
+                            &legDist, &legBrg);
+    distance += legDist;
+  }
+  if (speed > 0) last += (time_t)((2 * distance / speed + 6) * 3600);
+
+  // The tidal current stations, the GRIB covers what they do not
+  if (m_mUseStations->IsChecked() && OpenStations()) {
+    BuildStationCube(waypoints, first, last);
+    if (m_cube) {
+      m_cube->m_Fallback = sampler;
+      return m_cube.get();
+    }
+  }
+
+  // A mapped cube is used as it is, the GRIB covers what it does not
+  if (m_cubeFile) {
+    m_cubeFile->m_Fallback = sampler;
+    return m_cubeFile.get();
+  }
+
+  BuildCurrentCube(waypoints, first, last);
+  if (!m_cube) return sampler;
+
+  m_cube->m_Fallback = sampler;
+  return m_cube.get();
+}
+
+void otidalrouteUIDialog::StopSampling() {
+  m_cube.reset();
+  m_sampler.reset();
+}
+
+void otidalrouteUIDialog::BuildCurrentCube(
+    const std::vector<PassageWaypoint>& waypoints, time_t first,
+    time_t last) {
+  wxStopWatch sw;
+
+  // The forecast steps from the first departure to the last arrival
+  std::vector<time_t> steps;
+  time_t t = first, before, after;
+  GribRecordSetPtr set;
+  while (steps.size() < 1000 && FindGribBracket(t, before, after, set)) {
+    if (steps.empty() || steps.back() != before) steps.push_back(before);
+    if (after != before) steps.push_back(after);
+    if (after >= last) break;
+    t = after + 1;
+  }
+  if (steps.empty()) return;
+
+  set = GetGribRecordSet(steps[0]);
+  GribRecord* gx = set ? set->m_GribRecordPtrArray[Idx_SEACURRENT_VX] : NULL;
+  if (!gx || !gx->isOk() || !gx->getDi() || !gx->getDj()) return;
+
+  // Buffered box around the route legs
+  double latMin = 90, latMax = -90, lonMin = 180, lonMax = -180;
+  for (size_t i = 0; i < waypoints.size(); i++) {
+    latMin = wxMin(latMin, waypoints[i].lat);
+    latMax = wxMax(latMax, waypoints[i].lat);
+    lonMin = wxMin(lonMin, waypoints[i].lon);
+    lonMax = wxMax(lonMax, waypoints[i].lon);
+  }
+  if (lonMax - lonMin > 180) return;  // crosses the date line
+  if (lonMin < gx->getLonMin()) {     // GRIB in 0-360
+    lonMin += 360;
+    lonMax += 360;
+  }
+
+  int ni = gx->getNi(), nj = gx->getNj();
+  double pi1 = (lonMin - gx->getX(0)) / gx->getDi();
+  double pi2 = (lonMax - gx->getX(0)) / gx->getDi();
+  double pj1 = (latMin - gx->getY(0)) / gx->getDj();
+  double pj2 = (latMax - gx->getY(0)) / gx->getDj();
+  int i0 = wxMax(0, (int)floor(wxMin(pi1, pi2)) - 2);
+  int i1 = wxMin(ni - 1, (int)ceil(wxMax(pi1, pi2)) + 2);
+  int j0 = wxMax(0, (int)floor(wxMin(pj1, pj2)) - 2);
+  int j1 = wxMin(nj - 1, (int)ceil(wxMax(pj1, pj2)) + 2);
+  if (i0 > i1 || j0 > j1) return;  // route outside the GRIB
+
+  m_cube.reset(new CurrentCube);
+  m_cube->Init(gx->getY(j0), gx->getX(i0), gx->getDj(), gx->getDi(),
+               j1 - j0 + 1, i1 - i0 + 1, steps);
+
+  // A row of nodes, for steps on another grid
+  int nrow = i1 - i0 + 1;
+  std::vector<double> px(nrow), py(nrow), rm(nrow), ra(nrow);
+  std::unique_ptr<bool[]> rok(new bool[nrow]);
+
+  for (size_t k = 0; k < steps.size(); k++) {
+    set = GetGribRecordSet(steps[k]);
+    if (!set) continue;
+    GribRecord* rx = set->m_GribRecordPtrArray[Idx_SEACURRENT_VX];
+    GribRecord* ry = set->m_GribRecordPtrArray[Idx_SEACURRENT_VY];
+    if (!rx || !ry) continue;
+
+    bool sameGrid = rx->getNi() == ni && rx->getNj() == nj &&
+                    ry->getNi() == ni && ry->getNj() == nj &&
+                    rx->getX(0) == gx->getX(0) && rx->getY(0) == gx->getY(0) &&
+                    rx->getDi() == gx->getDi() && rx->getDj() == gx->getDj();
+
+    for (int j = j0; j <= j1; j++) {
+      // Resampled a row at a time, as GribCurrent would sample each node
+      if (!sameGrid) {
+        for (int i = 0; i < nrow; i++) {
+          px[i] = gx->getX(i0 + i);
+          py[i] = gx->getY(j);
+        }
+        GribRecord::getInterpolatedValues(nrow, &rm[0], &ra[0], rok.get(), rx,
+                                          ry, &px[0], &py[0]);
+      }
+
+      for (int i = i0; i <= i1; i++) {
+        double u, v;
+        if (sameGrid) {
+          u = rx->getValue(i, j);
+          v = ry->getValue(i, j);
+          if (u == GRIB_NOTDEF || v == GRIB_NOTDEF) continue;
+        } else {
+          if (!rok[i - i0]) continue;
+          // The angle is that of the vector (u, v) plus 180 degrees
+          u = -rm[i - i0] * sin(ra[i - i0] * M_PI / 180);
+          v = -rm[i - i0] * cos(ra[i - i0] * M_PI / 180);
+        }
+        m_cube->Set(k, j - j0, i - i0, u, v);
+      }
+    }
+  }
+
+  m_cube->m_BuildMs = sw.Time();
+  wxLogMessage(
+      "otidalroute_pi: current cube %d steps x %d x %d, %.1f kB, built in "
+      "%.0f ms",
+      (int)steps.size(), m_cube->m_NLat, m_cube->m_NLon,
+      m_cube->Bytes() / 1024.0, m_cube->m_BuildMs);
+}
+
+// The harmonic tide and current stations, loaded the first time they are
+// wanted
+bool otidalrouteUIDialog::OpenStations() {
+  if (!ptcmgr) {
+    wxString dir = *GetpSharedDataLocation() + "tcdata" +
+                   wxFileName::GetPathSeparator();
+    ptcmgr = new TCMgr(dir, pPlugIn->StandardPath());
   }
+  return ptcmgr->IsReady();
+}
+
+void otidalrouteUIDialog::BuildStationCube(
+    const std::vector<PassageWaypoint>& waypoints, time_t first,
+    time_t last) {
+  wxStopWatch sw;
+
+  StationCurrentField field;
+  m_cube.reset(new CurrentCube);
+  if (!field.Build(*ptcmgr, waypoints, first, last, *m_cube)) {
+    m_cube.reset();
+    wxLogMessage("otidalroute_pi: no tidal current stations near the route");
+    return;
+  }
+
+  m_cube->m_BuildMs = sw.Time();
+  wxLogMessage(
+      "otidalroute_pi: station current cube from %d stations, %d steps x %d "
+      "x %d, %.1f kB, built in %.0f ms",
+      field.m_Stations, (int)m_cube->m_Times.size(), m_cube->m_NLat,
+      m_cube->m_NLon, m_cube->Bytes() / 1024.0, m_cube->m_BuildMs);
 }
 
 int otidalrouteUIDialog::GetRandomNumber(int range_min, int range_max) {
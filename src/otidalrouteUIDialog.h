@@ -39,11 +39,17 @@
 #include "otidalrouteUIDialogBase.h"
 #include "routeprop.h"
 #include "NavFunc.h"
+#include "TidalPassageEngine.h"
+#include "DepartureSweep.h"
+#include "DepartureSolver.h"
+#include "CurrentCube.h"
+#include "GribCurrentReader.h"
+#include "StationCurrentField.h"
 
 #include <wx/progdlg.h>
 #include <list>
 #include <vector>
-#include "GribRecordSet.h"
+#include "GribCurrentCache.h"
 #include "tcmgr.h"
 #include "wx/dateevt.h"
 #include "wx/stattext.h"
@@ -60,6 +66,10 @@
 #include <wx/thread.h>
 #include <wx/event.h>
 #include <wx/listctrl.h>
+#include <wx/weakref.h>
+#include <atomic>
+#include <memory>
+#include <thread>
 #include "tableroutes.h"
 
 /* XPM */
@@ -115,6 +125,11 @@ static const long long lNaN = 0xfff8000000000000;
        (Y) * (Y))  // much faster than hypot#define distance(X, Y) sqrt((X)*(X)
                    // + (Y)*(Y)) // much faster than hypot
 
+/* Levels of the arrow quadtree, and the least size of its cells on the
+   chart before their arrows are merged */
+#define ARROW_LEVELS 30
+#define ARROW_CELL_PX 64
+
 class otidalrouteOverlayFactory;
 class PlugIn_ViewPort;
 class PositionRecordSet;
@@ -126,6 +141,7 @@ class routeprop;
 class TableRoutes;
 class ConfigurationDialog;
 class NewPositionDialog;
+class otidalrouteUIDialog;
 
 class Position {
 public:
@@ -164,6 +180,14 @@ struct Arrow {
   double m_tforce;
 };
 
+// The arrows merged over the cells of one level of a Mercator quadtree,
+// for when they would crowd each other on the chart. Level L has 2^L
+// cells round the world, each giving the vector mean of its arrows.
+struct ArrowLevel {
+  vector<Arrow> arrows;
+  StationIndex index;
+};
+
 struct TotalTideArrow {
   double m_dir;
   double m_force;
@@ -176,6 +200,23 @@ public:
   list<Position> m_positionslist;
 };
 
+// Samples the tidal current from the GRIB plugin for the passage engine.
+// May be called from worker threads: the sample is then handed to the GUI
+// thread, which is the only one that can talk to the GRIB plugin.
+class GribCurrentSampler : public CurrentSampler {
+public:
+  GribCurrentSampler(otidalrouteUIDialog* dlg,
+                     const std::atomic<bool>* cancel = NULL)
+      : m_dlg(dlg), m_cancel(cancel) {}
+
+  bool GetCurrent(time_t t, double lat, double lon, double& rate,
+                  double& set);
+
+private:
+  otidalrouteUIDialog* m_dlg;
+  const std::atomic<bool>* m_cancel;  // abandons the wait for the GUI thread
+};
+
 static const wxString column_names[] = {
     "",        _("Start"), _("Start Time"), _("End"),
     _("End Time"), _("Time"),  _("Distance")  //,
@@ -233,6 +274,8 @@ public:
   void OnShowRouteTable();
   void GetTable(wxString myRoute);
   void GetTides(wxString myRoute);
+  void BuildArrowLevels();
+  int ArrowLevelFor(double view_scale_ppm) const;
   void AddChartRoute(wxString myRoute);
   void AddTidalRoute(TidalRoute tr);
 
@@ -247,7 +290,10 @@ public:
   double AttributeDouble(TiXmlElement* e, const char* name, double def);
   vector<RouteMapPosition> Positions;
   wxString m_default_configuration_path;
-  list<Arrow> m_arrowList;
+  vector<Arrow> m_arrowList;
+  StationIndex m_arrowIndex;  // of m_arrowList, for culling to the viewport
+  unsigned int m_arrowSerial;  // changes with m_arrowList
+  vector<ArrowLevel> m_arrowLevels;  // coarsest first, m_arrowList after
   list<Arrow> m_cList;
   list<TotalTideArrow> m_totaltideList;
   list<TidalRoute> m_TidalRoutes;
@@ -270,6 +316,12 @@ public:
   void Addpoint(TiXmlElement* Route, wxString ptlat, wxString ptlon,
                 wxString ptname, wxString ptsym, wxString pttype);
 
+  GribRecordSetPtr GetGribRecordSet(time_t t);
+  bool FindGribBracket(time_t t, time_t& before, time_t& after,
+                       GribRecordSetPtr& set);
+  bool GetGribSpdDir(wxDateTime dt, double lat, double lon, double& spd,
+                     double& dir);
+
 protected:
   bool m_bNeedsGrib;
 
@@ -284,14 +336,52 @@ private:
   void OnShowTables(wxCommandEvent& event);
 
   void OnDeleteAllRoutes(wxCommandEvent& event);
-  void CalcDR(wxCommandEvent& event, bool write_file, int Pattern);
-  void CalcETA(wxCommandEvent& event, bool write_file, int Pattern);
+  void OnOpenGribFile(wxCommandEvent& event);
+  void OnCloseGribFile(wxCommandEvent& event);
+  void OnExportCube(wxCommandEvent& event);
+  void OnOpenCube(wxCommandEvent& event);
+  void OnUseStations(wxCommandEvent& event);
+  bool CheckNotCalculating();
+  void CalcDR(wxCommandEvent& event, bool write_file);
+  void CalcETA(wxCommandEvent& event, bool write_file);
+
+  void GetPassageWaypoints(std::vector<PassageWaypoint>& waypoints);
+  bool GetGPXFileName(wxString caption, wxString& path);
+  void ReportPassageError(PassageStatus status);
+  void FillPassage(const PassageResult& result, TidalRoute& tr,
+                   wxString epPrefix, wxString epIcon);
+  void AddPassage(const PassageResult& result, TidalRoute& tr,
+                  wxString epPrefix, wxString epIcon, bool save = true);
+  void WritePassageGPX(wxString filename, const PassageResult& result,
+                       wxString epPrefix, wxString epIcon);
 
   void DRCalculate(wxCommandEvent& event);
   void ETACalculate(wxCommandEvent& event);
-
-  bool GetGribSpdDir(wxDateTime dt, double lat, double lon, double& spd,
-                     double& dir);
+  void SweepCalculate(wxCommandEvent& event);
+
+  void StartSweep(const std::vector<PassageWaypoint>& waypoints,
+                  double speed, wxDateTime first, int step, int count,
+                  bool show_table);
+  double GetETATolerance();
+  wxString SweepRouteName(int index);
+  bool CheckSweepNames(int count);
+  void OnSweepResult(int index, const PassageResult& result);
+  void OnSweepFinished();
+  bool AddSweepRoute(int index, bool save);
+  void OnSweepRowActivated(wxListEvent& event);
+
+  void BestDeparture(wxCommandEvent& event);
+  void OnSolverFinished();
+  void CancelCalculation();
+
+  CurrentSampler* StartSampling(const std::vector<PassageWaypoint>& waypoints,
+                                double speed, time_t first, time_t last);
+  void StopSampling();
+  void BuildCurrentCube(const std::vector<PassageWaypoint>& waypoints,
+                        time_t first, time_t last);
+  bool OpenStations();
+  void BuildStationCube(const std::vector<PassageWaypoint>& waypoints,
+                        time_t first, time_t last);
 
   int GetRandomNumber(int range_min, int range_max);
 
@@ -303,7 +393,7 @@ private:
 
   double m_cursor_lat, m_cursor_lon;
   wxString g_SData_Locn;
-  TCMgr* ptcmgr;
+  TCMgr* ptcmgr;  // harmonic stations, NULL until first used
   wxString* pTC_Dir;
 
   int m_corr_mins;
@@ -320,13 +410,33 @@ private:
   bool dbg;
   wxString m_gpx_path;
 
-  wxString waypointName[200];
+  std::vector<wxString> waypointName;  // of the last GetPassageWaypoints
   Plugin_WaypointExList* myList;
   bool m_bUsingFollow;
   unique_ptr<PlugIn_Route_Ex> thisRoute;
   vector<PlugIn_Waypoint_Ex*> theWaypoints;
   int countRoutePoints;
   int nextRoutePointIndex;
+
+  DepartureSweep m_sweep;
+  std::unique_ptr<GribCurrentSampler> m_sampler;
+  std::unique_ptr<CurrentCube> m_cube;  // current in the route corridor
+  GribCurrentReader m_gribReader;  // used instead of the GRIB plugin if open
+  std::unique_ptr<CurrentCube> m_cubeFile;  // mapped cube, used if open
+  std::atomic<bool> m_cancelSampling;
+  wxWeakRef<TableRoutes> m_sweepTable;  // live summary of the sweep
+  wxString m_sweepGPX;  // GPX file for each departure, empty for none
+  int m_sweepFailed;
+  PassageStatus m_sweepError;
+  int m_sweepBest;  // index of the fastest departure
+  double m_sweepBestHours;
+  wxString m_sweepBestStart;
+  // Each departure of a sweep with a table, by index. Only the fastest
+  // and those the user picks in the table are added as routes.
+  std::vector<PassageResult> m_sweepResults;
+
+  std::unique_ptr<DepartureSolver> m_solver;
+  std::thread m_solverThread;
 };
 
 class GetRouteDialog : public wxDialog {
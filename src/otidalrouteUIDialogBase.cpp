@@ -85,6 +85,60 @@ otidalrouteUIDialogBase::otidalrouteUIDialogBase(wxWindow* parent,
   m_choiceDepartureTimes->SetSelection(0);
   sbSizer91->Add(m_choiceDepartureTimes, 0, wxALL, 5);
 
+  m_staticText5 = new wxStaticText(sbSizer91->GetStaticBox(), wxID_ANY,
+                                   wxT("Departure Window (hours)"),
+                                   wxDefaultPosition, wxDefaultSize, 0);
+  m_staticText5->Wrap(-1);
+  sbSizer91->Add(m_staticText5, 0, wxALL, 5);
+
+  m_tSweepHours =
+      new wxTextCtrl(sbSizer91->GetStaticBox(), wxID_ANY, wxT("48"),
+                     wxDefaultPosition, wxDefaultSize, 0);
+  sbSizer91->Add(m_tSweepHours, 0, wxALL, 5);
+
+  m_staticText6 = new wxStaticText(sbSizer91->GetStaticBox(), wxID_ANY,
+                                   wxT("Departure Interval (minutes)"),
+                                   wxDefaultPosition, wxDefaultSize, 0);
+  m_staticText6->Wrap(-1);
+  sbSizer91->Add(m_staticText6, 0, wxALL, 5);
+
+  m_tSweepInterval =
+      new wxTextCtrl(sbSizer91->GetStaticBox(), wxID_ANY, wxT("10"),
+                     wxDefaultPosition, wxDefaultSize, 0);
+  sbSizer91->Add(m_tSweepInterval, 0, wxALL, 5);
+
+  m_staticText7 = new wxStaticText(sbSizer91->GetStaticBox(), wxID_ANY,
+                                   wxT("Arrival Window (optional)"),
+                                   wxDefaultPosition, wxDefaultSize, 0);
+  m_staticText7->Wrap(-1);
+  sbSizer91->Add(m_staticText7, 0, wxALL, 5);
+
+  m_tArriveAfter =
+      new wxTextCtrl(sbSizer91->GetStaticBox(), wxID_ANY, wxEmptyString,
+                     wxDefaultPosition, wxDefaultSize, 0);
+  m_tArriveAfter->SetToolTip(wxT("Arrive after (yyyy-mm-dd hh:mm)"));
+  sbSizer91->Add(m_tArriveAfter, 0, wxALL, 5);
+
+  m_tArriveBefore =
+      new wxTextCtrl(sbSizer91->GetStaticBox(), wxID_ANY, wxEmptyString,
+                     wxDefaultPosition, wxDefaultSize, 0);
+  m_tArriveBefore->SetToolTip(wxT("Arrive before (yyyy-mm-dd hh:mm)"));
+  sbSizer91->Add(m_tArriveBefore, 0, wxALL, 5);
+
+  m_staticText8 = new wxStaticText(sbSizer91->GetStaticBox(), wxID_ANY,
+                                   wxT("ETA Tolerance (minutes)"),
+                                   wxDefaultPosition, wxDefaultSize, 0);
+  m_staticText8->Wrap(-1);
+  sbSizer91->Add(m_staticText8, 0, wxALL, 5);
+
+  m_tTolerance =
+      new wxTextCtrl(sbSizer91->GetStaticBox(), wxID_ANY, wxT("0"),
+                     wxDefaultPosition, wxDefaultSize, 0);
+  m_tTolerance->SetToolTip(
+      wxT("0 steps a whole hour at a time, otherwise the step adapts to the "
+          "current"));
+  sbSizer91->Add(m_tTolerance, 0, wxALL, 5);
+
   m_bCalcDR =
       new wxButton(sbSizer91->GetStaticBox(), wxID_ANY, wxT("Calculate DR"),
                    wxDefaultPosition, wxDefaultSize, 0);
@@ -95,6 +149,16 @@ otidalrouteUIDialogBase::otidalrouteUIDialogBase(wxWindow* parent,
                    wxDefaultPosition, wxDefaultSize, 0);
   sbSizer91->Add(m_bCalcETA, 0, wxALL | wxEXPAND, 5);
 
+  m_bSweep = new wxButton(sbSizer91->GetStaticBox(), wxID_ANY,
+                          wxT("Sweep Departures"), wxDefaultPosition,
+                          wxDefaultSize, 0);
+  sbSizer91->Add(m_bSweep, 0, wxALL | wxEXPAND, 5);
+
+  m_bBestDeparture = new wxButton(sbSizer91->GetStaticBox(), wxID_ANY,
+                                  wxT("Best Departure"), wxDefaultPosition,
+                                  wxDefaultSize, 0);
+  sbSizer91->Add(m_bBestDeparture, 0, wxALL | wxEXPAND, 5);
+
   sbSizer2->Add(sbSizer91, 1, wxEXPAND, 5);
 
   sbSizer3->Add(sbSizer2, 1, wxEXPAND, 5);
@@ -129,6 +193,43 @@ otidalrouteUIDialogBase::otidalrouteUIDialogBase(wxWindow* parent,
 
   m_menubar3->Append(m_menu3, wxT("Routes"));
 
+  m_menu2 = new wxMenu();
+
+  wxMenuItem* m_mOpenGribFile;
+  m_mOpenGribFile =
+      new wxMenuItem(m_menu2, wxID_ANY, wxString(wxT("Open GRIB File...")),
+                     wxEmptyString, wxITEM_NORMAL);
+  m_menu2->Append(m_mOpenGribFile);
+
+  wxMenuItem* m_mCloseGribFile;
+  m_mCloseGribFile =
+      new wxMenuItem(m_menu2, wxID_ANY, wxString(wxT("Use GRIB Plugin")),
+                     wxEmptyString, wxITEM_NORMAL);
+  m_menu2->Append(m_mCloseGribFile);
+
+  m_menu2->AppendSeparator();
+
+  wxMenuItem* m_mExportCube;
+  m_mExportCube =
+      new wxMenuItem(m_menu2, wxID_ANY, wxString(wxT("Export Current Cube...")),
+                     wxEmptyString, wxITEM_NORMAL);
+  m_menu2->Append(m_mExportCube);
+
+  wxMenuItem* m_mOpenCube;
+  m_mOpenCube =
+      new wxMenuItem(m_menu2, wxID_ANY, wxString(wxT("Open Current Cube...")),
+                     wxEmptyString, wxITEM_NORMAL);
+  m_menu2->Append(m_mOpenCube);
+
+  m_menu2->AppendSeparator();
+
+  m_mUseStations = new wxMenuItem(m_menu2, wxID_ANY,
+                                  wxString(wxT("Use Tidal Current Stations")),
+                                  wxEmptyString, wxITEM_CHECK);
+  m_menu2->Append(m_mUseStations);
+
+  m_menubar3->Append(m_menu2, wxT("GRIB"));
+
   m_mHelp = new wxMenu();
 
   wxMenuItem* m_mInformation;
@@ -160,6 +261,14 @@ otidalrouteUIDialogBase::otidalrouteUIDialogBase(wxWindow* parent,
   m_bCalcETA->Connect(
       wxEVT_COMMAND_BUTTON_CLICKED,
       wxCommandEventHandler(otidalrouteUIDialogBase::ETACalculate), NULL, this);
+  m_bSweep->Connect(
+      wxEVT_COMMAND_BUTTON_CLICKED,
+      wxCommandEventHandler(otidalrouteUIDialogBase::SweepCalculate), NULL,
+      this);
+  m_bBestDeparture->Connect(
+      wxEVT_COMMAND_BUTTON_CLICKED,
+      wxCommandEventHandler(otidalrouteUIDialogBase::BestDeparture), NULL,
+      this);
 
   this->Connect(m_mSummary->GetId(), wxEVT_COMMAND_MENU_SELECTED,
                 wxCommandEventHandler(otidalrouteUIDialogBase::OnSummary));
@@ -168,6 +277,18 @@ otidalrouteUIDialogBase::otidalrouteUIDialogBase(wxWindow* parent,
   this->Connect(
       m_mDeleteAllRoutes->GetId(), wxEVT_COMMAND_MENU_SELECTED,
       wxCommandEventHandler(otidalrouteUIDialogBase::OnDeleteAllRoutes));
+  this->Connect(
+      m_mOpenGribFile->GetId(), wxEVT_COMMAND_MENU_SELECTED,
+      wxCommandEventHandler(otidalrouteUIDialogBase::OnOpenGribFile));
+  this->Connect(
+      m_mCloseGribFile->GetId(), wxEVT_COMMAND_MENU_SELECTED,
+      wxCommandEventHandler(otidalrouteUIDialogBase::OnCloseGribFile));
+  this->Connect(m_mExportCube->GetId(), wxEVT_COMMAND_MENU_SELECTED,
+                wxCommandEventHandler(otidalrouteUIDialogBase::OnExportCube));
+  this->Connect(m_mOpenCube->GetId(), wxEVT_COMMAND_MENU_SELECTED,
+                wxCommandEventHandler(otidalrouteUIDialogBase::OnOpenCube));
+  this->Connect(m_mUseStations->GetId(), wxEVT_COMMAND_MENU_SELECTED,
+                wxCommandEventHandler(otidalrouteUIDialogBase::OnUseStations));
   this->Connect(m_mInformation->GetId(), wxEVT_COMMAND_MENU_SELECTED,
                 wxCommandEventHandler(otidalrouteUIDialogBase::OnInformation));
   this->Connect(m_mAbout->GetId(), wxEVT_COMMAND_MENU_SELECTED,
@@ -187,6 +308,14 @@ otidalrouteUIDialogBase::~otidalrouteUIDialogBase() {
   m_bCalcETA->Disconnect(
       wxEVT_COMMAND_BUTTON_CLICKED,
       wxCommandEventHandler(otidalrouteUIDialogBase::ETACalculate), NULL, this);
+  m_bSweep->Disconnect(
+      wxEVT_COMMAND_BUTTON_CLICKED,
+      wxCommandEventHandler(otidalrouteUIDialogBase::SweepCalculate), NULL,
+      this);
+  m_bBestDeparture->Disconnect(
+      wxEVT_COMMAND_BUTTON_CLICKED,
+      wxCommandEventHandler(otidalrouteUIDialogBase::BestDeparture), NULL,
+      this);
 
   this->Disconnect(wxID_ANY, wxEVT_COMMAND_MENU_SELECTED,
                    wxCommandEventHandler(otidalrouteUIDialogBase::OnSummary));
@@ -196,6 +325,20 @@ otidalrouteUIDialogBase::~otidalrouteUIDialogBase() {
   this->Disconnect(
       wxID_ANY, wxEVT_COMMAND_MENU_SELECTED,
       wxCommandEventHandler(otidalrouteUIDialogBase::OnDeleteAllRoutes));
+  this->Disconnect(
+      wxID_ANY, wxEVT_COMMAND_MENU_SELECTED,
+      wxCommandEventHandler(otidalrouteUIDialogBase::OnOpenGribFile));
+  this->Disconnect(
+      wxID_ANY, wxEVT_COMMAND_MENU_SELECTED,
+      wxCommandEventHandler(otidalrouteUIDialogBase::OnCloseGribFile));
+  this->Disconnect(
+      wxID_ANY, wxEVT_COMMAND_MENU_SELECTED,
+      wxCommandEventHandler(otidalrouteUIDialogBase::OnExportCube));
+  this->Disconnect(wxID_ANY, wxEVT_COMMAND_MENU_SELECTED,
+                   wxCommandEventHandler(otidalrouteUIDialogBase::OnOpenCube));
+  this->Disconnect(
+      wxID_ANY, wxEVT_COMMAND_MENU_SELECTED,
+      wxCommandEventHandler(otidalrouteUIDialogBase::OnUseStations));
   this->Disconnect(
       wxID_ANY, wxEVT_COMMAND_MENU_SELECTED,
       wxCommandEventHandler(otidalrouteUIDialogBase::OnInformation));
@@ -53,25 +53,39 @@ protected:
   wxPanel* m_panel2;
   wxButton* m_bCalcDR;
   wxButton* m_bCalcETA;
+  wxButton* m_bSweep;
+  wxButton* m_bBestDeparture;
   wxTextCtrl* m_tSpeed;
   wxMenuBar* m_menubar3;
   wxMenu* m_menu2;
   wxMenu* m_menu3;
   wxMenu* m_menu4;
   wxMenu* m_mHelp;
+  wxMenuItem* m_mUseStations;
   wxStaticText* m_staticText2;
 
   wxStaticText* m_staticText3;
   wxStaticText* m_staticText4;
+  wxStaticText* m_staticText5;
+  wxStaticText* m_staticText6;
+  wxStaticText* m_staticText7;
+  wxStaticText* m_staticText8;
 
   // Virtual event handlers, overide them in your derived class
   virtual void OnClose(wxCloseEvent& event) { event.Skip(); }
   virtual void OnSize(wxSizeEvent& event) { event.Skip(); }
   virtual void DRCalculate(wxCommandEvent& event) { event.Skip(); }
   virtual void ETACalculate(wxCommandEvent& event) { event.Skip(); }
+  virtual void SweepCalculate(wxCommandEvent& event) { event.Skip(); }
+  virtual void BestDeparture(wxCommandEvent& event) { event.Skip(); }
   virtual void OnSummary(wxCommandEvent& event) { event.Skip(); }
   virtual void OnShowTables(wxCommandEvent& event) { event.Skip(); }
   virtual void OnDeleteAllRoutes(wxCommandEvent& event) { event.Skip(); }
+  virtual void OnOpenGribFile(wxCommandEvent& event) { event.Skip(); }
+  virtual void OnCloseGribFile(wxCommandEvent& event) { event.Skip(); }
+  virtual void OnExportCube(wxCommandEvent& event) { event.Skip(); }
+  virtual void OnOpenCube(wxCommandEvent& event) { event.Skip(); }
+  virtual void OnUseStations(wxCommandEvent& event) { event.Skip(); }
   virtual void OnInformation(wxCommandEvent& event) { event.Skip(); }
   virtual void OnAbout(wxCommandEvent& event) { event.Skip(); }
 
@@ -83,6 +97,11 @@ public:
   wxTextCtrl* m_tRouteName;
   wxCheckBox* m_cbGPX;
   wxChoice* m_choiceDepartureTimes;
+  wxTextCtrl* m_tSweepHours;
+  wxTextCtrl* m_tSweepInterval;
+  wxTextCtrl* m_tArriveAfter;
+  wxTextCtrl* m_tArriveBefore;
+  wxTextCtrl* m_tTolerance;
 
   otidalrouteUIDialogBase(wxWindow* parent, wxWindowID id = wxID_ANY,
                           const wxString& title = wxEmptyString,
@@ -83,6 +83,7 @@ otidalroute_pi::otidalroute_pi(void *ppimgr) : opencpn_plugin_118(ppimgr) {
   else
     wxLogMessage("    oTidalRoute_pi panel icon NOT loaded");
   m_bShowotidalroute = false;
+  m_bGribRequested = false;
 }
 
 otidalroute_pi::~otidalroute_pi(void) {
@@ -338,10 +339,19 @@ void otidalroute_pi::OnotidalrouteDialogClose() {
 void otidalroute_pi::SetPluginMessage(wxString &message_id,
                                       wxString &message_body) {
   if (message_id == "GRIB_TIMELINE") {
+    // Sent when the GRIB plugin loads a file or moves its timeline. Moving
+    // the timeline leaves the records as they were, so rather than drop
+    // them the next sample asks the plugin again, and the set ID of the
+    // reply shows whether the file has changed.
     Json::Reader r;
     Json::Value v;
     r.parse(static_cast<std::string>(message_body), v);
 
+    if (v["Day"].asInt() == -1)
+      m_GribCache.Invalidate();  // no file loaded
+    else
+      m_GribCache.Recheck();
+
     if (v["Day"].asInt() != -1) {
       wxDateTime time, adjTime;
 
@@ -396,6 +406,13 @@ void otidalroute_pi::SetPluginMessage(wxString &message_id,
     GribRecordSet *gptr;
     sscanf(ptr, "%p", &gptr);
 
+    // Keep a copy of the current records for later samples at this time.
+    // Replies to requests from other plugins are not cached.
+    if (m_bGribRequested) {
+      m_grib_set = m_GribCache.Store(m_grib_time, gptr);
+      gptr = m_grib_set.get();
+    }
+
     double dir, spd;
 
     m_bGribValid = GribCurrent(gptr, m_grib_lat, m_grib_lon, dir, spd);
@@ -37,6 +37,7 @@
 #include "ocpn_plugin.h"
 #include "otidalrouteOverlayFactory.h"
 #include "otidalrouteUIDialog.h"
+#include "GribCurrentCache.h"
 #include "json/json.h"
 #include <wx/datetime.h>
 #include "config.h"
@@ -138,6 +139,10 @@ public:
 
   bool m_bGribValid;
   double m_grib_lat, m_grib_lon;
+  time_t m_grib_time;
+  bool m_bGribRequested;  // the GRIB_TIMELINE_RECORD is a reply to us
+  GribRecordSetPtr m_grib_set;  // cached copy of the reply
+  GribCurrentCache m_GribCache;
   double m_tr_spd;
   double m_tr_dir;
   otidalrouteOverlayFactory *m_potidalrouteOverlayFactory;
@@ -41,6 +41,14 @@
 #include <stdlib.h>
 #include <math.h>
 #include <time.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include <wx/listimpl.cpp>
 #include <wx/datetime.h>
@@ -76,9 +84,177 @@ hhmm2seconds (char *hhmm)
   return h*3600 + m*60;
 }
 
-int TCMgr::yearoftimet (time_t t)
+/* gmtime that may be called from several threads at once. */
+static struct tm *
+gmtime_ts (const time_t *t, struct tm *result)
+{
+#ifdef _WIN32
+  return gmtime_s (result, t) == 0 ? result : NULL;
+#else
+  return gmtime_r (t, result);
+#endif
+}
+
+int TCMgr::yearoftimet (time_t t) const
+{
+  struct tm gt;
+  return ((gmtime_ts (&t, &gt))->tm_year) + 1900;
+}
+
+/* Number of TideStations made, for telling them apart */
+static std::atomic<unsigned int> s_station_serial(0);
+
+//--------------------------------------------------------------------------------
+//    Compiled harmonic database
+//
+//    HARMONIC and HARMONIC.IDX compiled into one file that is mapped at
+//    startup. The index entries and the constituent tables are fixed size
+//    records, and the reference stations are found through a hash of
+//    their names instead of reading the text file for each one.
+//--------------------------------------------------------------------------------
+
+struct HarmDBHeader {
+      char        magic[8];               // "OTRHARM"
+      uint32_t    version;
+      uint32_t    byteOrder;              // HARMDB_BYTE_ORDER as written
+      uint32_t    indexSize, stationSize; // record sizes, for this build only
+      int64_t     hfileSize, hfileTime;   // the text files compiled
+      int64_t     ifileSize, ifileTime;
+      int32_t     num_csts, first_year, num_epochs, num_nodes;
+      int32_t     num_idx, num_stations, hash_size, pad;
+      uint64_t    speeds, epochs, nodes;  // file offsets of the sections
+      uint64_t    index, stations, hash, names, harm;
+};
+
+struct HarmDBIndex {                    // an IDX_entry
+      char        type;
+      char        zone[40];
+      char        station_name[MAXNAMELEN];
+      char        reference_name[MAXNAMELEN];
+      char        tzname[40];             // empty for none
+      double      lon, lat;
+      int32_t     time_zone;
+      int32_t     ht_time_off;
+      float       ht_mpy, ht_off;
+      int32_t     lt_time_off;
+      float       lt_mpy, lt_off;
+      int32_t     sta_num, flood_dir, ebb_dir, useable, ref_file_num;
+};
+
+struct HarmDBStation {                  // a Station_Data
+      uint32_t    name;                   // offset in the names section
+      int32_t     meridian;
+      char        type;                   // T or C
+      char        tzfile[40];
+      char        unit[40];
+      double      DATUM;
+      uint64_t    harm;                   // offset of the amplitudes, then the epochs
+};
+
+static const char HARMDB_MAGIC[8] = "OTRHARM";
+static const uint32_t HARMDB_VERSION = 2;
+static const uint32_t HARMDB_BYTE_ORDER = 0x01020304;
+
+static uint64_t harmdb_align (uint64_t offset) { return (offset + 7) & ~(uint64_t)7; }
+
+/* Pads the file from pos up to offset, then writes the section there */
+static bool harmdb_write_at (FILE *f, uint64_t &pos, uint64_t offset, const void *data, size_t bytes)
+{
+      static const char pad[8] = {0};
+      if (offset < pos || offset - pos > sizeof pad ||
+          fwrite(pad, 1, offset - pos, f) != offset - pos ||
+          (bytes && fwrite(data, 1, bytes, f) != bytes))
+            return false;
+      pos = offset + bytes;
+      return true;
+}
+
+/* Case insensitive FNV-1a hash of a station name, as slackcmp compares them */
+static uint32_t harmdb_hash (const char *name)
+{
+      uint32_t h = 2166136261u;
+      for ( ; *name ; name++)
+      {
+            char c = (*name >= 'A' && *name <= 'Z') ? *name - 'A' + 'a' : *name;
+            h = (h ^ (unsigned char)c) * 16777619u;
+      }
+      return h;
+}
+
+/* Compares station names, folding case as harmdb_hash does */
+static int harmdb_casecmp (const char *a, const char *b)
+{
+      for ( ; ; a++, b++)
+      {
+            int ca = (*a >= 'A' && *a <= 'Z') ? *a - 'A' + 'a' : (unsigned char)*a;
+            int cb = (*b >= 'A' && *b <= 'Z') ? *b - 'A' + 'a' : (unsigned char)*b;
+            if (ca != cb || !ca)
+                  return ca - cb;
+      }
+}
+
+/* Whether count records of size bytes at offset lie within the file */
+static bool harmdb_fits (uint64_t offset, uint64_t count, uint64_t size, uint64_t file_size)
+{
+      return offset <= file_size && count <= (file_size - offset) / size;
+}
+
+/* Whether a fixed size string field holds its terminating NUL */
+static bool harmdb_terminated (const char *field, size_t size)
 {
-  return ((gmtime (&t))->tm_year) + 1900;
+      return memchr(field, 0, size) != NULL;
+}
+
+/* Size and modification time of a file, to tell if it changed */
+static bool harmdb_stamp (const char *name, int64_t &size, int64_t &mtime)
+{
+      struct stat st;
+      if (stat(name, &st) != 0)
+            return false;
+      size = st.st_size;
+      mtime = st.st_mtime;
+      return true;
+}
+
+//--------------------------------------------------------------------------------
+//    The station MRU file, the reference stations last used, ready to go
+//--------------------------------------------------------------------------------
+
+struct MRUFileHeader {
+      char        magic[8];               // "OTRMRU"
+      uint32_t    version;
+      uint32_t    byteOrder;              // HARMDB_BYTE_ORDER as written
+      int64_t     hfileSize, hfileTime;   // the HARMONIC file read
+      int32_t     num_csts, count;
+};
+
+struct MRUFileRecord {                  // then the key, name, amplitudes and epochs
+      uint32_t    keyLen, nameLen;
+      int32_t     meridian;
+      char        type;
+      char        tzfile[40];
+      char        unit[40];
+      double      DATUM;
+};
+
+static const char MRU_MAGIC[8] = "OTRMRU";
+static const uint32_t MRU_VERSION = 1;
+
+static void free_station_data (Station_Data *psd)
+{
+      free(psd->station_name);
+      free(psd->amplitude);
+      free(psd->epoch);
+      delete psd;
+}
+
+/* The cache key of a reference station, its type and lowercased name */
+static std::string mru_key (const IDX_entry *pIDX)
+{
+      std::string key(1, (char)toupper(pIDX->IDX_type));
+      for (const char *c = pIDX->IDX_reference_name ; *c ; c++)
+            key += (char)tolower((unsigned char)*c);
+      return key;
 }
 
 //--------------------------------------------------------------------------------
@@ -126,7 +302,6 @@ TCMgr::TCMgr(const wxString &data_dir, const wxString &home_dir)
       num_csts = 0;
       cst_nodes = NULL;
       cst_epochs = NULL;
-      work = NULL;
       cst_speeds = NULL;
 
       index_in_memory=0;
@@ -134,14 +309,14 @@ TCMgr::TCMgr(const wxString &data_dir, const wxString &home_dir)
       hfile_name = NULL;
       indexfile_name = NULL;
       userfile_name = NULL;
+      dbfile_name = NULL;
       IDX_reference_name = NULL;
       Izone = NULL;
 
       paIDX = NULL;
+      clock15 = hits15 = misses15 = 0;
 
-      pmru_next = NULL;
-      pmru_head = NULL;
-      pmru_last = NULL;
+      mru_limit = STATION_CACHE_BYTES;
 
       looking_end = FALSE;
       rewound = 0;
@@ -160,11 +335,19 @@ TCMgr::TCMgr(const wxString &data_dir, const wxString &home_dir)
       allocate_copy_string(&hfile_name, harm_file.mb_str());
 
       pmru_file_name = new wxString(home_dir);                    // in the current users home
-      pmru_file_name->Append(_T("station_mru.dat"));
+      pmru_file_name->Append(_T("station_mru.bin"));
 
+      wxString db_file = home_dir;
+      db_file.Append(_T("harmonic_db.dat"));
+      allocate_copy_string(&dbfile_name, db_file.mb_str());
 
-//    Initialize and load the Index file structure
-      init_index_file(1,0);
+
+//    Initialize and load the Index file structure, from the compiled
+//    database if it is up to date with the text files
+      if(OpenHarmonicDB())
+            LoadIndexFromDB();
+      else
+            init_index_file(1,0);
 
 
 //    Build an array of pIDX for fast index access
@@ -177,10 +360,34 @@ TCMgr::TCMgr(const wxString &data_dir, const wxString &home_dir)
                   IDX_entry *pe = get_index_data( -i );           // Fetch next record pointer
                   paIDX[i] = pe;
             }
+
+            station_entry.assign(max_IDX + 1, mru.end());
+            days15.assign(max_IDX + 1, NULL);
+
+//    and a spatial index of the stations, for finding those near a position
+            std::vector<StationRef> refs;
+            for(int i=1 ; i < max_IDX +1 ; i++)
+            {
+                  IDX_entry *pe = paIDX[i];
+                  if(pe && pe->IDX_Useable)
+                  {
+                        StationRef r = { i, pe->IDX_lat, pe->IDX_lon, pe->IDX_type };
+                        refs.push_back(r);
+                  }
+            }
+            station_index.Build(refs);
       }
       else
             return;                                         // No Index file found
 
+      if(harm_db.IsOpen())
+      {
+            LoadTablesFromDB();
+            LoadMRU();
+            bTCMReady = true;
+            return;
+      }
+
 //    Load the Harmonic Constant Invariants
       FILE *fp;
       char linrec[linelen];
@@ -242,8 +449,13 @@ TCMgr::TCMgr(const wxString &data_dir, const wxString &home_dir)
                   ignore = fscanf (fp, "%lf", &(cst_nodes[a][b]));
       }
 
+      long stations_start = ftell(fp);
       fclose(fp);
 
+//    Compile the text files for the next time, and look up stations in it
+      if(CompileHarmonicDB(stations_start))
+            OpenHarmonicDB();
+
 //    Load the Master Station Data Cache file
       LoadMRU();
 
@@ -255,10 +467,10 @@ TCMgr::~TCMgr()
 {
    SaveMRU();
 
-   FreeMRU();
-
    if(userfile_name)
       free(userfile_name);
+   if(dbfile_name)
+      free(dbfile_name);
    if(indexfile_name)
       free(indexfile_name);
    if(hfile_name)
@@ -271,6 +483,9 @@ TCMgr::~TCMgr()
    if(paIDX)
       free(paIDX);
 
+   for(size_t i=0 ; i < days15.size() ; i++)
+      delete days15[i];
+
    free_data();
 
    delete plast_reference_not_found;
@@ -286,312 +501,290 @@ TCMgr::~TCMgr()
 }
 
 
+//    The MRU file: a header, then a record, the key, the station name
+//    and the amplitudes and epochs of each station, most recently used
+//    first. Binary in the byte order of the machine, so no precision is
+//    lost, and tied to the HARMONIC file the stations were read from.
 void TCMgr::LoadMRU(void)
 {
-      wxString str;
-
-      mru_entry *pmru_entry;
-      Station_Data *psd;
-      pmru_head = NULL;
+      MRUFileHeader h;
+      int64_t hsize, htime;
 
-      wxTextFile mru_file(*pmru_file_name);
-
-      if(!mru_file.Exists())
+      if(!harmdb_stamp(hfile_name, hsize, htime))
+            return;
+      FILE *fp = fopen(pmru_file_name->mb_str(), "rb");
+      if(NULL == fp)
             return;
 
-      if(mru_file.Open())
+      if(fread(&h, sizeof h, 1, fp) != 1 ||
+         memcmp(h.magic, MRU_MAGIC, sizeof h.magic) || h.version != MRU_VERSION ||
+         h.byteOrder != HARMDB_BYTE_ORDER || h.hfileSize != hsize || h.hfileTime != htime ||
+         h.num_csts != num_csts || h.count < 0)
       {
-            if(mru_file.GetLineCount())
-                  str = mru_file.GetFirstLine();                  //Signature
-
-            if(str != _T("Signature250"))
-               return;
-
-            while(!mru_file.Eof())
-            {
-                  str = mru_file.GetNextLine();
-                  while(((str[0] == '#') || (str.IsEmpty())) && !mru_file.Eof())
-                          str = mru_file.GetNextLine();
-
-                  if(mru_file.Eof())
-                      break;
-
-                  pmru_entry = (mru_entry *)malloc(sizeof(mru_entry));
-
-                  psd = new Station_Data;
-                  pmru_entry->sta_data = psd;
-
-//          Capture and store the data
-
-//          Allocate and store station name
-                  psd->station_name = (char *)malloc(strlen(str.mb_str(wxConvUTF8)) +1);
-                  strcpy(psd->station_name, str.mb_str(wxConvUTF8));
-
-//          Station Type
-                  str = mru_file.GetNextLine();
-                  psd->station_type = *(str.mb_str());       // one character T or C
-
-//          Meridian
-                  str = mru_file.GetNextLine();
-                  sscanf(str.mb_str(), "%d", &(psd->meridian));
-
-//          Datum, units
-                  char temp[40];
-                  float tf, tfa, tfe;
-                  str = mru_file.GetNextLine();
-
-                  sscanf(str.mb_str(), "%f %s", &tf, &temp[0]);
-                  psd->DATUM = tf;
-                  strcpy( psd->unit, temp );
-                  psd->have_BOGUS = (findunit(psd->unit) != -1) && (known_units[findunit(psd->unit)].type == BOGUS);
-
-                  int unit_c;
-                  if (psd->have_BOGUS)
-                        unit_c = findunit("knots");
-                  else
-                        unit_c = findunit(psd->unit);
-
-                  if (unit_c != -1)
-                  {
-                        strcpy (psd->units_conv,       known_units[unit_c].name);
-                        strcpy (psd->units_abbrv,      known_units[unit_c].abbrv);
-                  }
-
-//          Amplitude/epoch
-                  psd->amplitude = (double *)malloc(num_csts * sizeof(double));
-                  psd->epoch = (double *)malloc(num_csts * sizeof(double));
+            fclose(fp);
+            return;
+      }
 
-                  for(int i=0 ; i<num_csts ; i++)
-                  {
-                        str = mru_file.GetNextLine();
-                        sscanf(str.mb_str(), "%f %f", &tfa, &tfe);
-                        psd->amplitude[i] = tfa;
-                        psd->epoch[i] = tfe;
-                  }
-//          Link it up
-                  pmru_entry->next = NULL;
-                  if(pmru_head == NULL)
-                  {
-                        pmru_head = pmru_entry;
-                        pmru_last = pmru_entry;
-                        pmru_next = pmru_entry;             // for AddMRU
-                  }
-                  else
-                  {
-                        pmru_last->next = pmru_entry;
-                        pmru_last = pmru_entry;
-                        pmru_next = pmru_entry;             // for AddMRU
-                  }
-            }
+      std::vector<char> text;
+      size_t bytes = 0;
+      for(int i=0 ; i < h.count && bytes < mru_limit ; i++)
+      {
+            MRUFileRecord r;
+            if(fread(&r, sizeof r, 1, fp) != 1 || r.keyLen > linelen || r.nameLen > linelen)
+                  break;
+            text.resize(r.keyLen + r.nameLen + 1);
+            if(fread(text.data(), 1, r.keyLen + r.nameLen, fp) != r.keyLen + r.nameLen)
+                  break;
+
+            Station_Data *psd = new Station_Data;
+            psd->station_name = (char *)malloc(r.nameLen + 1);
+            memcpy(psd->station_name, &text[r.keyLen], r.nameLen);
+            psd->station_name[r.nameLen] = 0;
+            psd->station_type = r.type;
+            psd->meridian = r.meridian;
+            memcpy(psd->tzfile, r.tzfile, sizeof psd->tzfile);
+            psd->DATUM = r.DATUM;
+            memcpy(psd->unit, r.unit, sizeof psd->unit);
+            figure_units(psd);
+            psd->amplitude = (double *)malloc(num_csts * sizeof(double));
+            psd->epoch = (double *)malloc(num_csts * sizeof(double));
+            std::shared_ptr<Station_Data> sp(psd, free_station_data);
+
+            if(fread(psd->amplitude, sizeof(double), num_csts, fp) != (size_t)num_csts ||
+               fread(psd->epoch, sizeof(double), num_csts, fp) != (size_t)num_csts)
+                  break;
+
+//    In file order, the most recently used first
+            std::string key(text.data(), r.keyLen);
+            if(mru_map.count(key))
+                  continue;
+            StationCacheEntry e;
+            e.key = key;
+            e.data = sp;
+            mru_map[key] = mru.insert(mru.end(), e);
+            bytes += station_data_size(psd);
       }
+      fclose(fp);
  }
 
 
-void TCMgr::FreeMRU()
+mru_list::iterator TCMgr::FindMRU(const std::string &key)
 {
-      Station_Data *psd;
-
-      if(pmru_head)
-      {
-            mru_entry *pmru = pmru_head;
+      std::unordered_map<std::string, mru_list::iterator>::iterator it = mru_map.find(key);
+      if(it == mru_map.end())
+            return mru.end();
 
-            while(pmru)
-            {
-
-                  psd = pmru->sta_data;
-//    Station Name
-                  free(psd->station_name);
-
-//    Data
-                  free(psd->amplitude);
-                  free(psd->epoch);
+      mru.splice(mru.begin(), mru, it->second);         // now the most recent
+      return it->second;
+}
 
-                  delete psd;
 
-                  mru_entry *pt = (mru_entry *)pmru->next;
-                  free(pmru);
+mru_list::iterator TCMgr::AddMRU(const std::string &key, std::shared_ptr<Station_Data> psd)
+{
+      mru_list::iterator it = FindMRU(key);
+      if(it != mru.end())
+            return it;
+      StationCacheEntry e;
+      e.key = key;
+      e.data = psd;
+      mru.push_front(e);
+      return mru_map[key] = mru.begin();
+}
 
-                  pmru = pt;
-            }
 
+//    Let go of the least recently used entries, and the stations loaded
+//    on them, beyond the limit, but never the most recent. A station that
+//    another thread is evaluating is freed when that thread is done.
+void TCMgr::TrimMRU(void)
+{
+      mru_list::iterator it = mru.begin();
+      size_t bytes = 0;
+      if(it != mru.end())
+            bytes = entry_size(*it++);
+      while(it != mru.end() && (bytes += entry_size(*it)) <= mru_limit)
+            ++it;
+
+      while(it != mru.end())
+      {
+            for(size_t i=0 ; i < it->stations.size() ; i++)
+                  station_entry[it->stations[i]->idx] = mru.end();
+            mru_map.erase(it->key);
+            it = mru.erase(it);
       }
 }
 
 
-void TCMgr::AddMRU(Station_Data *psd)
+void TCMgr::SetStationCacheSize(size_t bytes)
 {
-            mru_entry *pmru_entry = (mru_entry *)malloc(sizeof(mru_entry));
-            pmru_entry->sta_data = psd;
+      std::lock_guard<std::mutex> lock(load_mutex);
+      mru_limit = bytes;
+      TrimMRU();
+}
 
 
-//    Link it in
-            if(pmru_next == NULL)
-            {
-                  pmru_head = pmru_entry;
-            }
-            else
-            {
-                  pmru_next->next = pmru_entry;
-            }
+size_t TCMgr::station_data_size(const Station_Data *psd) const
+{
+      return sizeof(Station_Data) + strlen(psd->station_name) + 1 + 2 * num_csts * sizeof(double);
+}
 
-            pmru_entry->next = NULL;
 
-            pmru_next = pmru_entry;
+//    The data and the stations on it, with the year tables made so far
+size_t TCMgr::entry_size(const StationCacheEntry &e) const
+{
+      size_t bytes = sizeof e + e.key.size() + station_data_size(e.data.get());
+      for(size_t i=0 ; i < e.stations.size() ; i++)
+            bytes += sizeof(TideStation) + num_epochs * sizeof(std::atomic<const TideYear *>) +
+                     e.stations[i]->table_bytes.load(std::memory_order_relaxed);
+      return bytes;
 }
 
 
-
 void TCMgr::SaveMRU(void)
 {
-      wxString str_sbuf;
-      Station_Data *psd;
-
-      if(pmru_head)
-      {
-            remove(pmru_file_name->mb_str());                // simply delete the existing file
-
-            wxTextFile mru_file(*pmru_file_name);
-            mru_file.Create();
-
-            mru_file.AddLine(wxString(_T("Signature250")));
-
-            mru_entry *pmru = pmru_head;
-
-            while(pmru)
-            {
-
-                  psd = pmru->sta_data;
-//    Station Name
-                  mru_file.AddLine(wxString(psd->station_name,  wxConvUTF8));
-
-//    Station Type
-                  mru_file.AddLine(wxString(psd->station_type));
-
-//    Meridian/tz
-                  str_sbuf.Printf(_T("%d"), psd->meridian);
-                  mru_file.AddLine(str_sbuf);
-//    Datum, Units
-                  wxString unit(psd->unit, wxConvUTF8);
-                  str_sbuf.Printf(_T("%8.4f  "), psd->DATUM);
-                  str_sbuf += unit;
-                  mru_file.AddLine(str_sbuf);
-//    Data
-                  for(int i=0 ; i<num_csts ; i++)
-                  {
-                      str_sbuf.Printf(_T("%8.4f  %8.4f"), psd->amplitude[i], psd->epoch[i]);
-                      mru_file.AddLine(str_sbuf);
-                  }
+      MRUFileHeader h;
 
+      if(mru.empty())
+            return;
 
-                  mru_entry *pt = (mru_entry *)pmru->next;
-                  pmru = pt;
-            }
+      memset(&h, 0, sizeof h);
+      if(!harmdb_stamp(hfile_name, h.hfileSize, h.hfileTime))
+            return;
+      memcpy(h.magic, MRU_MAGIC, sizeof h.magic);
+      h.version = MRU_VERSION;
+      h.byteOrder = HARMDB_BYTE_ORDER;
+      h.num_csts = num_csts;
+      h.count = mru.size();
+
+      FILE *fp = fopen(pmru_file_name->mb_str(), "wb");
+      if(NULL == fp)
+            return;
 
-            mru_file.Write();
+      bool ok = fwrite(&h, sizeof h, 1, fp) == 1;
+      for(mru_list::iterator it = mru.begin() ; ok && it != mru.end() ; ++it)
+      {
+            const Station_Data *psd = it->data.get();
+            MRUFileRecord r;
+            memset(&r, 0, sizeof r);
+            r.keyLen = it->key.size();
+            r.nameLen = strlen(psd->station_name);
+            r.meridian = psd->meridian;
+            r.type = psd->station_type;
+            memcpy(r.tzfile, psd->tzfile, sizeof r.tzfile);
+            memcpy(r.unit, psd->unit, sizeof r.unit);
+            r.DATUM = psd->DATUM;
+
+            ok = fwrite(&r, sizeof r, 1, fp) == 1 &&
+                 fwrite(it->key.data(), 1, r.keyLen, fp) == r.keyLen &&
+                 fwrite(psd->station_name, 1, r.nameLen, fp) == r.nameLen &&
+                 fwrite(psd->amplitude, sizeof(double), num_csts, fp) == (size_t)num_csts &&
+                 fwrite(psd->epoch, sizeof(double), num_csts, fp) == (size_t)num_csts;
       }
+      if(fclose(fp) != 0 || !ok)
+            remove(pmru_file_name->mb_str());
 }
 
 int TCMgr::GetNextBigEvent (time_t *tm, int idx)
 {
-   float tcvalue[1]; float dir; bool ret;
-  double p, q;
-  int flags = 0, slope = 0;
-      ret = GetTideOrCurrent(*tm, idx, tcvalue[0],  dir);
-  p = tcvalue[0];
-  *tm += 60;
-      ret = GetTideOrCurrent(*tm, idx, tcvalue[0],  dir);
-  q = tcvalue[0];
-  *tm += 60;
-  if (p < q)
-    slope = 1;
-  while (1) {
-    if ((slope == 1 && q < p) || (slope == 0 && p < q)) {
-      /* Tide event */
-      flags |= (1 << slope);
-    }
-    if (flags) {
-      *tm -= 60;
-      if (flags < 4)
-        *tm -= 60;
-      return flags;
-    }
-    p = q;
-      ret = GetTideOrCurrent(*tm, idx, tcvalue[0],  dir);
-    q = tcvalue[0];
-    *tm += 60;
-  }
-}
-
+      std::shared_ptr<const TideStation> ps = GetStation(idx);
+      if(!ps)                             // Unuseable or master station not found
+            return 0;
 
-bool TCMgr::GetTideOrCurrent15(wxDateTime myTime, int idx, float &tcvalue, float& dir, bool &bnew_val)
-{
-      int ret;
-      IDX_entry *pIDX = paIDX[idx];             // point to the index entry
+      TideContext c;
+      happy_new_year (ps.get(), yearoftimet(*tm), c);
 
+      return next_station_event (c, tm, 3, NULL);
+}
 
-//    Figure out this computer timezone minute offset
-      wxDateTime this_now = myTime;   //wxDateTime::Now();
-      wxDateTime this_gmt = this_now.ToGMT();
-      wxTimeSpan diff = this_gmt.Subtract(this_now);
-      int diff_mins = diff.GetMinutes();
+bool TCMgr::GetTideEvents(time_t t0, time_t t1, int idx, std::vector<TideEvent> &events)
+{
+      events.clear();
 
-      int station_offset = pIDX->IDX_time_zone;
-      if(this_now.IsDST())
-            station_offset += 60;
-      int corr_mins = station_offset - diff_mins;
+      std::shared_ptr<const TideStation> ps = GetStation(idx);
+      if(!ps)                             // Unuseable or master station not found
+            return false;
 
-      wxDateTime today_00 = myTime;  //wxDateTime::Today();
-      int t_today_00 = today_00.GetTicks();
-      int t_today_00_at_station = t_today_00 - (corr_mins * 60);
+      TideContext c;
+      happy_new_year (ps.get(), yearoftimet(t0), c);
 
-      int t_at_station = this_gmt.GetTicks() - (station_offset * 60) + (corr_mins * 60);
+      find_events (c, t0, t1, 15, events);
+      return true;
+}
 
-      int t_mins = (t_at_station - t_today_00_at_station) / 60;
-      int t_15s = t_mins / 15;
 
-      if(pIDX->Valid15)                               // valid data available
+bool TCMgr::GetTideOrCurrent15(wxDateTime myTime, int idx, float &tcvalue, float& dir, bool &bnew_val)
+{
+      tcvalue = 0;
+      dir = 0;
+      bnew_val = false;
+      if(station_entry.empty() || idx < 0 || idx > max_IDX)
+            return false;
+
+//    The day and the 15 minutes of it
+      time_t t = myTime.GetTicks();
+      time_t day = t - ((t % 86400) + 86400) % 86400;
+      int bucket = (t - day) / TIDE_BUCKET;
+
+      std::unique_lock<std::mutex> lock(cache15_mutex);
+      TideDays *pdays = days15[idx];
+      if(!pdays)
       {
-
-            int tref1 = t_today_00_at_station + t_15s * 15 * 60;
-            if(tref1 == pIDX->Valid15)
-            {
-                  tcvalue = pIDX->Value15;
-                  dir = pIDX->Dir15;
-                  bnew_val = false;
-                  return pIDX->Ret15;
-            }
-            else
-            {
-                  int tref = t_today_00_at_station + t_15s * 15 * 60;
-                  ret = GetTideOrCurrent(tref, idx, tcvalue, dir);
-
-                  pIDX->Valid15 = tref;
-                  pIDX->Value15 = tcvalue;
-                  pIDX->Dir15 = dir;
-                  pIDX->Ret15 = !(ret == 0);
-                  bnew_val = true;
-
-                  return !(ret == 0);
-            }
+            pdays = days15[idx] = new TideDays;
+            pdays->last = TIDE_BAD_TIME;
+            for(int i=0 ; i < TIDE_DAY_SLOTS ; i++)
+                  pdays->day[i].day = pdays->day[i].used = 0;
       }
 
+      TideDay *pday = find_day15(pdays, day);
+      if(pday)
+            hits15++;
       else
       {
+//    Work out the whole day without the lock, so other stations' hits do
+//    not wait for it, then keep it in the oldest slot. Another thread may
+//    have worked out the same day meanwhile, so look again.
+            lock.unlock();
+            TideDay fill;
+            fill.day = day;
+            fill.ok = GetTideOrCurrent(day, TIDE_BUCKET, TIDE_BUCKETS, idx, fill.value, fill.dir);
+            lock.lock();
+
+            misses15++;
+            pday = find_day15(pdays, day);
+            if(!pday)
+            {
+                  pday = &pdays->day[0];
+                  for(int i=1 ; i < TIDE_DAY_SLOTS ; i++)
+                        if(pdays->day[i].used < pday->used)
+                              pday = &pdays->day[i];
+                  *pday = fill;
+            }
+      }
+      pday->used = ++clock15;
 
+      tcvalue = pday->value[bucket];
+      dir = pday->dir[bucket];
 
-            int tref = t_today_00_at_station + t_15s * 15 * 60;
-            ret = GetTideOrCurrent(tref, idx, tcvalue, dir);
-
-            pIDX->Valid15 = tref;
-            pIDX->Value15 = tcvalue;
-            pIDX->Dir15 = dir;
-            pIDX->Ret15 = !(ret == 0);
-            bnew_val = true;
+      time_t tref = day + bucket * TIDE_BUCKET;
+      bnew_val = tref != pdays->last;
+      pdays->last = tref;
 
-      }
+      return pday->ok;
+}
 
-      return !(ret == 0);
+//    The slot of a day of a station, NULL if the day is not kept
+TideDay *TCMgr::find_day15(TideDays *pdays, time_t day)
+{
+      for(int i=0 ; i < TIDE_DAY_SLOTS ; i++)
+            if(pdays->day[i].day == day)
+                  return &pdays->day[i];
+      return NULL;
+}
 
+void TCMgr::GetCacheStats15(unsigned long &hits, unsigned long &misses)
+{
+      std::lock_guard<std::mutex> lock(cache15_mutex);
+      hits = hits15;
+      misses = misses15;
 }
 
 bool TCMgr::GetTideFlowSens(time_t t, int sch_step, int idx, float &tcvalue_now, float &tcvalue_prev, bool &w_t)
@@ -605,33 +798,17 @@ bool TCMgr::GetTideFlowSens(time_t t, int sch_step, int idx, float &tcvalue_now,
 
 //    Load up this location data
 
-      IDX_entry *pIDX = paIDX[idx];             // point to the index entry
-      if(   !pIDX->IDX_Useable )
-            return false;                                        // no error, but unuseable
-
-	  pmsd = find_or_load_harm_data(pIDX);
-      if(!pmsd)                           // Master station not found
-            return false;                      // Error
-
-	  have_offsets = 0;
-//    fudge_constituents(pmsd, pIDX);
-	  if(       pIDX->IDX_ht_time_off ||
-                pIDX->IDX_ht_off != 0.0 ||
-                pIDX->IDX_lt_off != 0.0 ||
-                pIDX->IDX_ht_mpy != 1.0 ||
-                pIDX->IDX_lt_mpy != 1.0)
-	  have_offsets = 1;
+      std::shared_ptr<const TideStation> ps = GetStation(idx);
+      if(!ps)                             // Unuseable or master station not found
+            return false;
 
-      amplitude = 0.0;                // Force multiplier re-compute
-      time_t tt = time(NULL);
-      int yott = ((gmtime (&tt))->tm_year) + 1900;
-
-      happy_new_year (yott);//Force new multipliers
+      TideContext c;
+      happy_new_year (ps.get(), yearoftimet(t), c);
 
 //    Finally, process the tide flow sens
 
-	  tcvalue_now = time2asecondary (t , pIDX);
-	  tcvalue_prev = time2asecondary (t + sch_step , pIDX);
+	  tcvalue_now = time2asecondary (c, t);
+	  tcvalue_prev = time2asecondary (c, t + sch_step);
 
 	  w_t = tcvalue_now > tcvalue_prev;		// w_t = true --> flood , w_t = false --> ebb
 
@@ -639,7 +816,7 @@ bool TCMgr::GetTideFlowSens(time_t t, int sch_step, int idx, float &tcvalue_now,
 
 }
 
-void TCMgr::GetHightOrLowTide(time_t t, int sch_step_1, int sch_step_2, float tide_val ,bool w_t , int idx, float &tcvalue, time_t &tctime)
+void TCMgr::GetHightOrLowTide(time_t t, bool w_t , int idx, float &tcvalue, time_t &tctime)
 {
 
 //    Return a sensible value of 0,0 by default
@@ -649,57 +826,26 @@ void TCMgr::GetHightOrLowTide(time_t t, int sch_step_1, int sch_step_2, float ti
 
 //    Load up this location data
 
+      std::shared_ptr<const TideStation> ps = GetStation(idx);
+      if(!ps)                             // Unuseable or master station not found
+            return;
 
-      IDX_entry *pIDX = paIDX[idx];             // point to the index entry
-
-      if(   !pIDX->IDX_Useable )
-            return;                                        // no error, but unuseable
-
-	  pmsd = find_or_load_harm_data(pIDX);
-
-      if(!pmsd)                           // Master station not found
-            return;                      // Error
-
-	  have_offsets = 0;
-//    fudge_constituents(pmsd, pIDX);
-	  if(       pIDX->IDX_ht_time_off ||
-                pIDX->IDX_ht_off != 0.0 ||
-                pIDX->IDX_lt_off != 0.0 ||
-                pIDX->IDX_ht_mpy != 1.0 ||
-                pIDX->IDX_lt_mpy != 1.0)
-	  have_offsets = 1;
-
-
-
-      amplitude = 0.0;                // Force multiplier re-compute
-      time_t tt = time(NULL);
-      int yott = ((gmtime (&tt))->tm_year) + 1900;
-
-      happy_new_year (yott);//Force new multipliers
-
-// Finally, calculate the Hight and low tides
-	  double newval = tide_val;
-	  double oldval = ( w_t ) ? newval - 1: newval + 1 ;
-	  int j = 0 ;
-	  int k = 0 ;
-	  int ttt = 0 ;
-        while ( (newval > oldval) == w_t )			//searching each ten minute
-	  {
-		j++;
-		oldval = newval;
-		ttt = t + ( sch_step_1 * j );
-		newval = time2asecondary (ttt, pIDX);
-	  }
-	  oldval = ( w_t ) ? newval - 1: newval + 1 ;
-	  while ( (newval > oldval) == w_t )			// searching back each minute
-	  {
-		oldval = newval ;
-		k++;
-		ttt = t +  ( sch_step_1 * j ) - ( sch_step_2 * k ) ;
-		newval = time2asecondary (ttt, pIDX);
-	  }
-        tcvalue = newval;
-	  tctime = ttt + sch_step_2 ;
+      TideContext c;
+      happy_new_year (ps.get(), yearoftimet(t), c);
+
+// Finally, find the next high water when rising or low water when falling.
+// The root finder places it to TIDE_TIME_PREC seconds.  With none within
+// TIDE_MAX_SEARCH the tide at t is returned, rather than the 0 set for an
+// unknown station.
+      time_t tt = t;
+      float value = 0;
+      tcvalue = time2asecondary (c, t);
+      tctime = t;
+      if(next_station_event (c, &tt, w_t ? 2 : 1, &value))
+      {
+            tcvalue = value;
+            tctime = tt;
+      }
 }
 
 bool TCMgr::GetTideOrCurrent(time_t t, int idx, float &tcvalue, float& dir)
@@ -712,15 +858,11 @@ bool TCMgr::GetTideOrCurrent(time_t t, int idx, float &tcvalue, float& dir)
 
 //    Load up this location data
 
+      std::shared_ptr<const TideStation> ps = GetStation(idx);
+      if(!ps)                             // Unuseable or master station not found
+            return(false);
 
-      IDX_entry *pIDX = paIDX[idx];             // point to the index entry
-
-      if(   !pIDX->IDX_Useable )
-      {
-            dir = 0;
-            tcvalue = 0;
-            return(false);                                        // no error, but unuseable
-      }
+      IDX_entry *pIDX = ps->pIDX;
 
 /*
    load_location_info( station_name, rec_num ))
@@ -784,32 +926,10 @@ bool TCMgr::GetTideOrCurrent(time_t t, int idx, float &tcvalue, float& dir)
          else ltleveloff = htleveloff;
 */
 
-      pmsd = find_or_load_harm_data(pIDX);
-
-      if(!pmsd)                           // Master station not found
-            return(false);                      // Error
-
-
-
+//    Multipliers for this year
 
-
-
-      have_offsets = 0;
-//    fudge_constituents(pmsd, pIDX);
-  if(             pIDX->IDX_ht_time_off ||
-                  pIDX->IDX_ht_off != 0.0 ||
-                  pIDX->IDX_lt_off != 0.0 ||
-                  pIDX->IDX_ht_mpy != 1.0 ||
-                  pIDX->IDX_lt_mpy != 1.0)
-            have_offsets = 1;
-
-
-
-      amplitude = 0.0;                // Force multiplier re-compute
-      time_t tt = time(NULL);
-      int yott = ((gmtime (&tt))->tm_year) + 1900;
-
-      happy_new_year (yott);//Force new multipliers
+      TideContext c;
+      happy_new_year (ps.get(), yearoftimet(t), c);
 
 /*
       if (Usetadjust == 2) {
@@ -856,7 +976,7 @@ bool TCMgr::GetTideOrCurrent(time_t t, int idx, float &tcvalue, float& dir)
 
 //    Finally, calculate the tide/current
 
-      double level = time2asecondary (t, pIDX);
+      double level = time2asecondary (c, t);
       if(level >= 0)
             dir = pIDX->IDX_flood_dir;
       else
@@ -867,6 +987,50 @@ bool TCMgr::GetTideOrCurrent(time_t t, int idx, float &tcvalue, float& dir)
       return(true); // Got it!
 }
 
+bool TCMgr::GetTideOrCurrent(time_t t0, int step, int n, int idx, float *tcvalue, float *dir)
+{
+
+//    Return sensible values of 0,0 by default
+      for(int k=0 ; k < n ; k++)
+      {
+            dir[k] = 0;
+            tcvalue[k] = 0;
+      }
+
+      std::shared_ptr<const TideStation> ps = GetStation(idx);
+      if(!ps)                             // Unuseable or master station not found
+            return(false);
+
+      IDX_entry *pIDX = ps->pIDX;
+
+      TideContext c;
+      happy_new_year (ps.get(), yearoftimet(t0), c);
+
+//    Reference stations are summed for all the times together. Secondary
+//    stations search for the high and low waters around each time, so go
+//    one time at a time, in order, as GetTideOrCurrent would.
+      std::vector<double> level(n);
+      if(ps->have_offsets)
+      {
+            for(int k=0 ; k < n ; k++)
+                  level[k] = time2asecondary (c, t0 + (time_t)k * step);
+      }
+      else
+      {
+            time2tides (c, t0, step, n, level.data());
+            for(int k=0 ; k < n ; k++)
+                  level[k] = BOGUS_amplitude(c, level[k]) + ps->pmsd->DATUM;
+      }
+
+      for(int k=0 ; k < n ; k++)
+      {
+            tcvalue[k] = level[k];
+            dir[k] = level[k] >= 0 ? pIDX->IDX_flood_dir : pIDX->IDX_ebb_dir;
+      }
+
+      return(true);
+}
+
 int TCMgr::GetStationTimeOffset(IDX_entry *pIDX)
 {
       if(0/*pIDX->b_is_secondary*/)
@@ -880,37 +1044,17 @@ int TCMgr::GetStationTimeOffset(IDX_entry *pIDX)
 
 
 
-Station_Data *TCMgr::find_or_load_harm_data(IDX_entry *pIDX)
+//    The cache entry of the reference station of an index entry, loaded
+//    into the cache if need be, mru.end() if there is no such station
+mru_list::iterator TCMgr::find_or_load_harm_data(IDX_entry *pIDX)
 {
       Station_Data *psd = NULL;
 
-//    Look in the index first
-      if(pIDX->pref_sta_data)
-            return pIDX->pref_sta_data;         //easy
-
-//    Try the MRU list
-      mru_entry *pmru = pmru_head;
-
-      while(pmru)
-      {
-            psd = pmru->sta_data;
-//    In the following comparison, it is allowed that the sub-station reference_name may be
-//          a pre-subset of the master station name.
-//          e.g  IDX_refence_name:  The Narrows midchannel New York
-//                            as found in HARMONIC.IDX
-//                 psd_station_name:      The Narrows, Midchannel, New York Harbor, New York Current
-//                            as found in HARMONIC
-            if( (!slackcmp(psd->station_name, pIDX->IDX_reference_name)) && (toupper(pIDX->IDX_type) == psd->station_type) )
-            {
-                  pIDX->pref_sta_data = psd;                // save for later
-                  return psd;
-            }
-            else
-            {
-                  mru_entry *pt = (mru_entry *)pmru->next;
-                  pmru = pt;
-            }
-      }
+//    Try the MRU cache
+      std::string key = mru_key(pIDX);
+      mru_list::iterator it = FindMRU(key);
+      if(it != mru.end())
+            return it;
 
 //    OK, have to read and create from the raw file
 
@@ -924,85 +1068,90 @@ Station_Data *TCMgr::find_or_load_harm_data(IDX_entry *pIDX)
             if(plast_reference_not_found->IsSameAs(wxString(pIDX->IDX_reference_name, wxConvUTF8)))
 
             {
-                  return NULL;
+                  return mru.end();
             }
 //    Clear for this looking
             plast_reference_not_found->Clear();
 
-      //    Find and load appropriate constituents
-            FILE *fp;
-            char linrec[linelen];
-            fp = fopen (hfile_name, "r");
-
-            while (next_line (fp, linrec, 1))
+      //    Look it up in the compiled database, else scan the text file
+            if(harm_db.IsOpen())
+                  psd = find_db_station(pIDX->IDX_reference_name);
+            else
             {
-                  nojunk (linrec);
-                  int curonly = 0;
-                  if (curonly)
-                        if (!strstr (linrec, "Current"))
-                              continue;
+            //    Find and load appropriate constituents
+                  FILE *fp;
+                  char linrec[linelen];
+                  fp = fopen (hfile_name, "r");
+
+                  while (next_line (fp, linrec, 1))
+                  {
+                        nojunk (linrec);
+                        int curonly = 0;
+                        if (curonly)
+                              if (!strstr (linrec, "Current"))
+                                    continue;
 //    See the note above about station names
 //                  if(!strncmp(linrec, "Rivi", 4))
 //                        int ggl = 4;
 
-                  if (slackcmp (linrec, pIDX->IDX_reference_name))
-                        continue;
+                        if (slackcmp (linrec, pIDX->IDX_reference_name))
+                              continue;
 
-      //    Got the right location, so load the data
+            //    Got the right location, so load the data
 
-                  psd = new Station_Data;
+                        psd = new Station_Data;
 
-                  psd->amplitude = (double *)malloc(num_csts * sizeof(double));
-                  psd->epoch     = (double *)malloc(num_csts * sizeof(double));
-                  psd->station_name = (char *)malloc(strlen(linrec) +1);
+                        psd->amplitude = (double *)malloc(num_csts * sizeof(double));
+                        psd->epoch     = (double *)malloc(num_csts * sizeof(double));
+                        psd->station_name = (char *)malloc(strlen(linrec) +1);
 
-                  char junk[80];
-                  int a;
-                  strcpy (psd->station_name, linrec);
+                        char junk[80];
+                        int a;
+                        strcpy (psd->station_name, linrec);
 
 //    Establish Station Type
-                  wxString caplin(linrec, wxConvUTF8);
-                  caplin.MakeUpper();
-                  if(caplin.Contains(_T("CURRENT")))
-                        psd->station_type = 'C';
-                  else
-                        psd->station_type = 'T';
+                        wxString caplin(linrec, wxConvUTF8);
+                        caplin.MakeUpper();
+                        if(caplin.Contains(_T("CURRENT")))
+                              psd->station_type = 'C';
+                        else
+                              psd->station_type = 'T';
 
 
 
-              /* Get meridian */
-              next_line (fp, linrec, 0);
-              psd->meridian = hhmm2seconds (linrec);
+                    /* Get meridian */
+                    next_line (fp, linrec, 0);
+                    psd->meridian = hhmm2seconds (linrec);
 
-              /* Get tzfile, if present */
-              if (sscanf (nojunk(linrec), "%s %s", junk, psd->tzfile) < 2)
-                  strcpy (psd->tzfile, "UTC0");
+                    /* Get tzfile, if present */
+                    if (sscanf (nojunk(linrec), "%s %s", junk, psd->tzfile) < 2)
+                        strcpy (psd->tzfile, "UTC0");
 
-              /* Get DATUM and units */
-              next_line (fp, linrec, 0);
-              if (sscanf (nojunk(linrec), "%lf %s", &(psd->DATUM), psd->unit) < 2)
-                  strcpy (psd->unit, "unknown");
+                    /* Get DATUM and units */
+                    next_line (fp, linrec, 0);
+                    if (sscanf (nojunk(linrec), "%lf %s", &(psd->DATUM), psd->unit) < 2)
+                        strcpy (psd->unit, "unknown");
 
-              if ((a = findunit (psd->unit)) == -1)
-              {
+                    if ((a = findunit (psd->unit)) == -1)
+                    {
 // Nonsense....
 //                        strcpy (psd->units_abbrv, psd->unit);
 //                        strcpy (psd->units_conv, known_units[a].name);
-              }
+                    }
 
-                  psd->have_BOGUS = (findunit(psd->unit) != -1) && (known_units[findunit(psd->unit)].type == BOGUS);
+                        psd->have_BOGUS = (findunit(psd->unit) != -1) && (known_units[findunit(psd->unit)].type == BOGUS);
 
-                  int unit_c;
-                  if (psd->have_BOGUS)
-                        unit_c = findunit("knots");
-                  else
-                        unit_c = findunit(psd->unit);
+                        int unit_c;
+                        if (psd->have_BOGUS)
+                              unit_c = findunit("knots");
+                        else
+                              unit_c = findunit(psd->unit);
 
-                  if (unit_c != -1)
-                  {
-                        strcpy (psd->units_conv,       known_units[unit_c].name);
-                        strcpy (psd->units_abbrv,      known_units[unit_c].abbrv);
-                  }
+                        if (unit_c != -1)
+                        {
+                              strcpy (psd->units_conv,       known_units[unit_c].name);
+                              strcpy (psd->units_abbrv,      known_units[unit_c].abbrv);
+                        }
 
 
 
@@ -1010,29 +1159,29 @@ Station_Data *TCMgr::find_or_load_harm_data(IDX_entry *pIDX)
 
 
 
-              /* Get constituents */
-              double loca, loce;
-              for (a=0;a<num_csts;a++)
-              {
-                  next_line (fp, linrec, 0);
-                  sscanf (linrec, "%s %lf %lf", junk, &loca, &loce);
-      //          loc_epoch[a] *= M_PI / 180.0;
-                  psd->amplitude[a] = loca;
-                  psd->epoch[a] = loce * M_PI / 180.;
-              }
-              fclose (fp);
+                    /* Get constituents */
+                    double loca, loce;
+                    for (a=0;a<num_csts;a++)
+                    {
+                        next_line (fp, linrec, 0);
+                        sscanf (linrec, "%s %lf %lf", junk, &loca, &loce);
+            //          loc_epoch[a] *= M_PI / 180.0;
+                        psd->amplitude[a] = loca;
+                        psd->epoch[a] = loce * M_PI / 180.;
+                    }
+                    fclose (fp);
+
+                    break;
+                  }
 
-              break;
             }
 
             if(!psd)
                 plast_reference_not_found->Append(wxString(pIDX->IDX_reference_name, wxConvUTF8));
 
-            if(psd)
-                  AddMRU(psd);                                    // add it to the list
-
-            pIDX->pref_sta_data = psd;                // save for later
-            return psd;
+            if(!psd)
+                  return mru.end();
+            return AddMRU(key, std::shared_ptr<Station_Data>(psd, free_station_data));
       }
 //      else                                                  // already tried
 //            return NULL;
@@ -1042,201 +1191,560 @@ Station_Data *TCMgr::find_or_load_harm_data(IDX_entry *pIDX)
 
 
 //----------------------------------------------------------------------------------
-//          Adjust loaded constituents for any offsets
+//          Station ready for evaluation, from the cache or loaded into it
 //----------------------------------------------------------------------------------
-void TCMgr::fudge_constituents (Station_Data *psd, IDX_entry *pIDX)
+std::shared_ptr<const TideStation> TCMgr::GetStation(int idx)
 {
-  // Modify location name to show offsets
-/*
-  if (httimeoff)
-    sprintf (location+strlen(location), " htoff=%dmin", httimeoff/60);
-  if (lttimeoff)
-    sprintf (location+strlen(location), " ltoff=%dmin", lttimeoff/60);
-  if (htleveloff || hlevelmult != 1.0) {
-    sprintf (location+strlen(location), " hloff=");
-    if (hlevelmult != 1.0)
-      sprintf (location+strlen(location), "*%.2f ", hlevelmult);
-    if (htleveloff)
-      sprintf (location+strlen(location), "%+.2f",  htleveloff);
-  }
-  if (ltleveloff || llevelmult != 1.0) {
-    sprintf (location+strlen(location), " lloff=");
-    if (llevelmult != 1.0)
-      sprintf (location+strlen(location), "*%.2f ", llevelmult);
-    if (ltleveloff)
-      sprintf (location+strlen(location), "%+.2f",  ltleveloff);
-  }
-*/
-  // Apply time offset
-/*
-  if (httimeoff == lttimeoff && httimeoff != 0) {
-    int looper;
-    for (looper=0; looper<num_csts; looper++)
-      loc_epoch[looper] += cst_speeds[looper] * (double)httimeoff;
-    httimeoff = lttimeoff = 0;
-  }
-*/
-/*
-  // Apply units conversions
-  if (youwant) {
-    int iyouhave, iyouwant;
-    iyouhave = findunit (units);
-    iyouwant = findunit (youwant);
-    if (iyouhave != -1 && iyouwant != -1 && iyouhave != iyouwant) {
-      if (known_units[iyouhave].type == known_units[iyouwant].type) {
-        int looper;
-        double mult = known_units[iyouhave].conv_factor /
-                      known_units[iyouwant].conv_factor;
-        for (looper=0; looper<num_csts; looper++)
-          loc_amp[looper] *= mult;
-        DATUM *= mult;
-        strcpy (units, known_units[iyouwant].name);
-        strcpy (units_abbrv, known_units[iyouwant].abbrv);
+      if(station_entry.empty() || idx < 0 || idx > max_IDX)
+            return NULL;
+
+      IDX_entry *pIDX = paIDX[idx];             // point to the index entry
+      if(   !pIDX->IDX_Useable )
+            return NULL;                        // no error, but unuseable
+
+//    Only one thread loads, the others wait for it
+      std::lock_guard<std::mutex> lock(load_mutex);
+      mru_list::iterator it = station_entry[idx];
+      if(it != mru.end())
+      {
+            mru.splice(mru.begin(), mru, it);   // now the most recent
+            for(size_t i=0 ; i < it->stations.size() ; i++)
+                  if(it->stations[i]->idx == idx)
+                        return it->stations[i];
       }
-    }
-  }
-*/
-/*
-  // Apply units conversions to offsets (in feet)
-  if (!iscurrent && strcmp(units_abbrv,"ft")) {
-    int iyouhave, iyouwant;
-    iyouhave = findunit ("ft");
-    iyouwant = findunit (units);
-    if (iyouhave != -1 && iyouwant != -1 && iyouhave != iyouwant) {
-      if (known_units[iyouhave].type == known_units[iyouwant].type) {
-        double mult = known_units[iyouhave].conv_factor /
-                      known_units[iyouwant].conv_factor;
-        htleveloff *= mult; // Convert feet to meters
-        ltleveloff *= mult;
+
+      it = find_or_load_harm_data(pIDX);
+      if(it == mru.end())                       // Master station not found
+            return NULL;
+
+      TideStation *pts = new TideStation;
+      pts->idx = idx;
+      pts->pIDX = pIDX;
+      pts->pmsd = it->data.get();
+      pts->hold = it->data;                     // stays loaded while in use
+      pts->table_bytes = 0;
+      pts->amplitude = figure_amplitude(pts->pmsd);
+      pts->serial = s_station_serial++;
+      pts->num_years = num_epochs;
+      pts->years.reset(new std::atomic<const TideYear *>[num_epochs]());
+
+//    Set flag to indicate whether offsets have to be "handled"
+      pts->have_offsets = 0;
+      if(       pIDX->IDX_ht_time_off ||
+                pIDX->IDX_ht_off != 0.0 ||
+                pIDX->IDX_lt_off != 0.0 ||
+                pIDX->IDX_ht_mpy != 1.0 ||
+                pIDX->IDX_lt_mpy != 1.0)
+            pts->have_offsets = 1;
+
+//    Bounds of the tide derivatives for the event finder
+      for(int d = 0 ; d < 4 ; d++)
+            pts->max_dt[d] = max_dt_tide(pts, d);
+
+      std::shared_ptr<const TideStation> sp(pts);
+      it->stations.push_back(sp);
+      station_entry[idx] = it;
+      TrimMRU();
+      return sp;
+}
+
+
+//----------------------------------------------------------------------------------
+//          Compiled harmonic database
+//----------------------------------------------------------------------------------
+
+//    Map the database if it was compiled from the text files as they are now
+bool TCMgr::OpenHarmonicDB(void)
+{
+      int64_t hsize, htime, isize, itime;
+      HarmDBHeader h;
+
+      harm_db.Close();
+      if(!harmdb_stamp(hfile_name, hsize, htime) || !harmdb_stamp(indexfile_name, isize, itime))
+            return false;
+      if(!harm_db.Open(dbfile_name))
+            return false;
+
+      const unsigned char *data = harm_db.Data();
+      size_t size = harm_db.Size();
+      if(size < sizeof h)
+      {
+            harm_db.Close();
+            return false;
+      }
+      memcpy(&h, data, sizeof h);
+
+      uint64_t ncst = h.num_csts;
+      bool ok = memcmp(h.magic, HARMDB_MAGIC, sizeof h.magic) == 0 &&
+            h.version == HARMDB_VERSION && h.byteOrder == HARMDB_BYTE_ORDER &&
+            h.indexSize == sizeof(HarmDBIndex) && h.stationSize == sizeof(HarmDBStation) &&
+            h.hfileSize == hsize && h.hfileTime == htime &&
+            h.ifileSize == isize && h.ifileTime == itime &&
+            h.num_csts > 0 && h.num_epochs > 0 && h.num_nodes > 0 &&
+            h.num_idx > 0 && h.num_stations >= 0 &&
+            h.hash_size > 0 && !(h.hash_size & (h.hash_size - 1)) &&
+            h.speeds % 8 == 0 && h.epochs % 8 == 0 && h.nodes % 8 == 0 &&
+            h.index % 8 == 0 && h.stations % 8 == 0 && h.hash % 8 == 0 && h.harm % 8 == 0 &&
+            harmdb_fits(h.speeds, ncst, sizeof(double), size) &&
+            harmdb_fits(h.epochs, ncst * h.num_epochs, sizeof(double), size) &&
+            harmdb_fits(h.nodes, ncst * h.num_nodes, sizeof(double), size) &&
+            harmdb_fits(h.index, h.num_idx, sizeof(HarmDBIndex), size) &&
+            harmdb_fits(h.stations, h.num_stations, sizeof(HarmDBStation), size) &&
+            harmdb_fits(h.hash, h.hash_size, sizeof(uint32_t), size) &&
+            h.names <= h.harm && h.harm <= size;
+
+//    Every record is used as it lies in the mapping, so a truncated or
+//    damaged file must not send a name or table offset outside it
+      const HarmDBIndex *rec = (const HarmDBIndex *)(data + h.index);
+      for(int i = 0 ; ok && i < h.num_idx ; i++)
+            ok = harmdb_terminated(rec[i].zone, sizeof rec[i].zone) &&
+                 harmdb_terminated(rec[i].station_name, sizeof rec[i].station_name) &&
+                 harmdb_terminated(rec[i].reference_name, sizeof rec[i].reference_name) &&
+                 harmdb_terminated(rec[i].tzname, sizeof rec[i].tzname);
+
+      const HarmDBStation *stations = (const HarmDBStation *)(data + h.stations);
+      const char *names = (const char *)(data + h.names);
+      uint64_t names_size = h.harm - h.names;
+      for(int i = 0 ; ok && i < h.num_stations ; i++)
+      {
+            const HarmDBStation &st = stations[i];
+            ok = st.name < names_size &&
+                 memchr(names + st.name, 0, names_size - st.name) != NULL &&
+                 harmdb_terminated(st.tzfile, sizeof st.tzfile) &&
+                 harmdb_terminated(st.unit, sizeof st.unit) &&
+                 st.harm >= h.harm && st.harm % 8 == 0 &&
+                 harmdb_fits(st.harm, 2 * ncst, sizeof(double), size);
       }
-    }
-  }
-*/
 
-  // Check for knots^2 and handle any of those conversions
-//  psd->have_BOGUS = (findunit(psd->unit) != -1) && (known_units[findunit(psd->unit)].type == BOGUS);
-/*
-  if (psd->have_BOGUS)
-  {
-        pIDX->IDX_ht_off *= pIDX->IDX_ht_off;         // Square offset in kts to adjust for kts^2
-        pIDX->IDX_lt_off *= pIDX->IDX_lt_off;
+      const uint32_t *hash = (const uint32_t *)(data + h.hash);
+      for(int i = 0 ; ok && i < h.hash_size ; i++)
+            ok = hash[i] <= (uint32_t)h.num_stations;
 
-//     htleveloff *= htleveloff1; // Square offset in kts to adjust for kts^2
-//     ltleveloff *= ltleveloff;
+      if(!ok)
+            harm_db.Close();
+      return ok;
+}
 
-     if (convert_BOGUS) {
-        int knots = findunit("knots");
-        if (knots != -1) {
-           strcpy (psd->units_conv,       known_units[knots].name);
-           strcpy (psd->units_abbrv,      known_units[knots].abbrv);
-        }
-     }
+//    Write the database from the index and tables just read from the text
+//    files, and the reference stations that follow the tables in HARMONIC
+bool TCMgr::CompileHarmonicDB(long stations_start)
+{
+      HarmDBHeader h;
+      memset(&h, 0, sizeof h);
+      if(!harmdb_stamp(hfile_name, h.hfileSize, h.hfileTime) ||
+         !harmdb_stamp(indexfile_name, h.ifileSize, h.ifileTime))
+            return false;
+
+//    The index
+      std::vector<HarmDBIndex> index;
+      for(IDX_entry *pIDX = pIDX_first ; pIDX ; pIDX = (IDX_entry *)pIDX->IDX_next)
+      {
+            HarmDBIndex r;
+            memset(&r, 0, sizeof r);
+            r.type = pIDX->IDX_type;
+            strncpy(r.zone, pIDX->IDX_zone, sizeof r.zone - 1);
+            strncpy(r.station_name, pIDX->IDX_station_name, sizeof r.station_name - 1);
+            strncpy(r.reference_name, pIDX->IDX_reference_name, sizeof r.reference_name - 1);
+            if(pIDX->IDX_tzname)
+                  strncpy(r.tzname, pIDX->IDX_tzname, sizeof r.tzname - 1);
+            r.lon = pIDX->IDX_lon;
+            r.lat = pIDX->IDX_lat;
+            r.time_zone = pIDX->IDX_time_zone;
+            r.ht_time_off = pIDX->IDX_ht_time_off;
+            r.ht_mpy = pIDX->IDX_ht_mpy;
+            r.ht_off = pIDX->IDX_ht_off;
+            r.lt_time_off = pIDX->IDX_lt_time_off;
+            r.lt_mpy = pIDX->IDX_lt_mpy;
+            r.lt_off = pIDX->IDX_lt_off;
+            r.sta_num = pIDX->IDX_sta_num;
+            r.flood_dir = pIDX->IDX_flood_dir;
+            r.ebb_dir = pIDX->IDX_ebb_dir;
+            r.useable = pIDX->IDX_Useable;
+            r.ref_file_num = pIDX->IDX_ref_file_num;
+            index.push_back(r);
+      }
+      if(index.size() != (size_t)max_IDX)
+            return false;
+
+//    The reference stations, each a name line, the meridian and time zone,
+//    the datum and units, and a line for each constituent
+      std::vector<HarmDBStation> stations;
+      std::vector<char> names;
+      std::vector<double> harm;
+      FILE *fp = fopen (hfile_name, "r");
+      if(NULL == fp)
+            return false;
+      fseek(fp, stations_start, SEEK_SET);
+
+      char linrec[linelen], junk[80];
+      bool ok = true;
+      auto read_line = [&](void) {                     // next_line, but not fatal at the end
+            do {
+                  if(!fgets (linrec, linelen, fp))
+                        return false;
+            } while (linrec[0] == '#' || linrec[0] == '\r' || linrec[0] == '\n');
+            return true;
+      };
+      while(read_line())
+      {
+            nojunk (linrec);
+            if(!strncmp(linrec, "*END*", 5) || !linrec[0])
+                  continue;
+
+            HarmDBStation st;
+            memset(&st, 0, sizeof st);
+            st.name = names.size();
+            names.insert(names.end(), linrec, linrec + strlen(linrec) + 1);
+
+            char caplin[linelen];
+            int i;
+            for(i = 0 ; linrec[i] ; i++)
+                  caplin[i] = toupper(linrec[i]);
+            caplin[i] = 0;
+            st.type = strstr(caplin, "CURRENT") ? 'C' : 'T';
+
+            if(!read_line())
+            {
+                  ok = false;
+                  break;
+            }
+            st.meridian = hhmm2seconds (linrec);
+            if (sscanf (nojunk(linrec), "%s %39s", junk, st.tzfile) < 2)
+                  strcpy (st.tzfile, "UTC0");
 
-  }
+            if(!read_line())
+            {
+                  ok = false;
+                  break;
+            }
+            if (sscanf (nojunk(linrec), "%lf %39s", &st.DATUM, st.unit) < 2)
+                  strcpy (st.unit, "unknown");
 
-*/
-  // Apply level offset
-  /*
-  if (htleveloff == ltleveloff && htleveloff != 0.0) {
-     DATUM += htleveloff;
-     htleveloff = ltleveloff = 0.0;
-  }
-  if (hlevelmult == llevelmult && hlevelmult != 1.0) {
-     int looper;
-     for (looper=0; looper<num_csts; looper++)
-       loc_amp[looper] *= hlevelmult;
-     DATUM *= hlevelmult;
-     hlevelmult = llevelmult = 1.0;
-  }
-*/
+            size_t base = harm.size();
+            harm.resize(base + 2 * num_csts);
+            for (int a = 0 ; a < num_csts && ok ; a++)
+            {
+                  double loca = 0, loce = 0;
+                  if(!read_line())
+                        ok = false;
+                  sscanf (linrec, "%s %lf %lf", junk, &loca, &loce);
+                  harm[base + a] = loca;
+                  harm[base + num_csts + a] = loce * M_PI / 180.;
+            }
+            if(!ok)
+                  break;
+            st.harm = base * sizeof(double);        // made absolute below
+            stations.push_back(st);
+      }
+      fclose(fp);
+      if(!ok)
+            return false;
+
+//    Hashed directory of the names, the first of a name being kept as a
+//    scan of the text file would find it
+      uint32_t hash_size = 16;
+      while(hash_size < 2 * stations.size())
+            hash_size *= 2;
+      std::vector<uint32_t> hash(hash_size, 0);       // station + 1, 0 for none
+      for(size_t i = 0 ; i < stations.size() ; i++)
+      {
+            const char *name = &names[stations[i].name];
+            uint32_t k = harmdb_hash(name) & (hash_size - 1);
+            while(hash[k] && harmdb_casecmp(&names[stations[hash[k] - 1].name], name))
+                  k = (k + 1) & (hash_size - 1);
+            if(!hash[k])
+                  hash[k] = i + 1;
+      }
 
-//   Set flag to indicate whether offsets have been "handled"
-/*
-  if (httimeoff || lttimeoff || htleveloff != 0.0 || ltleveloff != 0.0 ||
-                                hlevelmult != 1.0 || llevelmult != 1.0)
-    have_offsets = 1;
-*/
+      memcpy(h.magic, HARMDB_MAGIC, sizeof h.magic);
+      h.version = HARMDB_VERSION;
+      h.byteOrder = HARMDB_BYTE_ORDER;
+      h.indexSize = sizeof(HarmDBIndex);
+      h.stationSize = sizeof(HarmDBStation);
+      h.num_csts = num_csts;
+      h.first_year = first_year;
+      h.num_epochs = num_epochs;
+      h.num_nodes = num_nodes;
+      h.num_idx = index.size();
+      h.num_stations = stations.size();
+      h.hash_size = hash_size;
+      h.speeds = harmdb_align(sizeof h);
+      h.epochs = harmdb_align(h.speeds + num_csts * sizeof(double));
+      h.nodes = harmdb_align(h.epochs + (uint64_t)num_csts * num_epochs * sizeof(double));
+      h.index = harmdb_align(h.nodes + (uint64_t)num_csts * num_nodes * sizeof(double));
+      h.stations = harmdb_align(h.index + index.size() * sizeof(HarmDBIndex));
+      h.hash = harmdb_align(h.stations + stations.size() * sizeof(HarmDBStation));
+      h.names = harmdb_align(h.hash + hash.size() * sizeof(uint32_t));
+      h.harm = harmdb_align(h.names + names.size());
+      for(size_t i = 0 ; i < stations.size() ; i++)
+            stations[i].harm += h.harm;
+
+      FILE *f = fopen(dbfile_name, "wb");
+      if(NULL == f)
+            return false;
+      uint64_t pos = 0;
+      ok = harmdb_write_at(f, pos, 0, &h, sizeof h) &&
+           harmdb_write_at(f, pos, h.speeds, cst_speeds, num_csts * sizeof(double));
+      for (int a = 0 ; a < num_csts && ok ; a++)
+            ok = harmdb_write_at(f, pos, h.epochs + a * num_epochs * sizeof(double),
+                                 cst_epochs[a], num_epochs * sizeof(double));
+      for (int a = 0 ; a < num_csts && ok ; a++)
+            ok = harmdb_write_at(f, pos, h.nodes + a * num_nodes * sizeof(double),
+                                 cst_nodes[a], num_nodes * sizeof(double));
+      ok = ok &&
+           harmdb_write_at(f, pos, h.index, index.data(), index.size() * sizeof(HarmDBIndex)) &&
+           harmdb_write_at(f, pos, h.stations, stations.data(), stations.size() * sizeof(HarmDBStation)) &&
+           harmdb_write_at(f, pos, h.hash, hash.data(), hash.size() * sizeof(uint32_t)) &&
+           harmdb_write_at(f, pos, h.names, names.data(), names.size()) &&
+           harmdb_write_at(f, pos, h.harm, harm.data(), harm.size() * sizeof(double));
+      if(fclose(f) != 0)
+            ok = false;
+      if(!ok)
+            remove(dbfile_name);
+      return ok;
+}
+
+//    Build the index entry list from the database, as init_index_file would
+void TCMgr::LoadIndexFromDB(void)
+{
+      HarmDBHeader h;
+      memcpy(&h, harm_db.Data(), sizeof h);
+      const HarmDBIndex *rec = (const HarmDBIndex *)(harm_db.Data() + h.index);
+
+      free_harmonic_file_list();
+      free_abbreviation_list();
+      free_station_index();
+
+      IDX_entry *pIDX_prev = NULL;
+      for(int i = 0 ; i < h.num_idx ; i++)
+      {
+            const HarmDBIndex &r = rec[i];
+            IDX_entry *pIDX = (IDX_entry *)malloc(sizeof(IDX_entry));
+            if(NULL == pIDX)
+                  break;
+            memset(pIDX, 0, sizeof(IDX_entry));
+
+            pIDX->IDX_rec_num = i + 1;
+            pIDX->IDX_type = r.type;
+            memcpy(pIDX->IDX_zone, r.zone, sizeof r.zone);
+            memcpy(pIDX->IDX_station_name, r.station_name, sizeof r.station_name);
+            memcpy(pIDX->IDX_reference_name, r.reference_name, sizeof r.reference_name);
+            if(r.tzname[0] && NULL != (pIDX->IDX_tzname = (char *)malloc(strlen(r.tzname) + 1)))
+                  strcpy(pIDX->IDX_tzname, r.tzname);
+            pIDX->IDX_lon = r.lon;
+            pIDX->IDX_lat = r.lat;
+            pIDX->IDX_time_zone = r.time_zone;
+            pIDX->IDX_ht_time_off = r.ht_time_off;
+            pIDX->IDX_ht_mpy = r.ht_mpy;
+            pIDX->IDX_ht_off = r.ht_off;
+            pIDX->IDX_lt_time_off = r.lt_time_off;
+            pIDX->IDX_lt_mpy = r.lt_mpy;
+            pIDX->IDX_lt_off = r.lt_off;
+            pIDX->IDX_sta_num = r.sta_num;
+            pIDX->IDX_flood_dir = r.flood_dir;
+            pIDX->IDX_ebb_dir = r.ebb_dir;
+            pIDX->IDX_Useable = r.useable;
+            pIDX->IDX_ref_file_num = r.ref_file_num;
+
+            if(pIDX_first == NULL)
+                  pIDX_first = pIDX;
+            else
+                  pIDX_prev->IDX_next = pIDX;
+            pIDX_prev = pIDX;
+      }
+
+      index_in_memory = TRUE;
+      have_index = 1;
+      max_IDX = h.num_idx;
+}
+
+//    The constituent speeds, epochs and node factors
+void TCMgr::LoadTablesFromDB(void)
+{
+      HarmDBHeader h;
+      memcpy(&h, harm_db.Data(), sizeof h);
+      const double *speeds = (const double *)(harm_db.Data() + h.speeds);
+      const double *epochs = (const double *)(harm_db.Data() + h.epochs);
+      const double *nodes = (const double *)(harm_db.Data() + h.nodes);
 
-  if(       pIDX->IDX_ht_time_off ||
-                  pIDX->IDX_ht_time_off ||
-                  pIDX->IDX_ht_off != 0.0 ||
-                  pIDX->IDX_lt_off != 0.0 ||
-                  pIDX->IDX_ht_mpy != 1.0 ||
-                  pIDX->IDX_lt_mpy != 1.0)
-            have_offsets = 1;
+      free_data();
+      num_csts = h.num_csts;
+      first_year = h.first_year;
+      num_epochs = h.num_epochs;
+      num_nodes = h.num_nodes;
+      allocate_cst ();
+      allocate_epochs ();
+      allocate_nodes ();
 
+      memcpy(cst_speeds, speeds, num_csts * sizeof(double));
+      for (int a = 0 ; a < num_csts ; a++)
+      {
+            memcpy(cst_epochs[a], epochs + (size_t)a * num_epochs, num_epochs * sizeof(double));
+            memcpy(cst_nodes[a], nodes + (size_t)a * num_nodes, num_nodes * sizeof(double));
+      }
+}
+
+//    Station_Data for the reference station name, NULL if there is none.
+//    Matches as slackcmp does, the exact name through the hash directory,
+//    else the first station in the file that the name is a prefix of
+Station_Data *TCMgr::find_db_station(const char *name)
+{
+      HarmDBHeader h;
+      const unsigned char *data = harm_db.Data();
+      memcpy(&h, data, sizeof h);
+      const HarmDBStation *stations = (const HarmDBStation *)(data + h.stations);
+      const uint32_t *hash = (const uint32_t *)(data + h.hash);
+      const char *names = (const char *)(data + h.names);
+      const HarmDBStation *pst = NULL;
+
+      if(!strchr(name, '?'))
+      {
+            uint32_t k = harmdb_hash(name) & (h.hash_size - 1);
+            for( ; hash[k] ; k = (k + 1) & (h.hash_size - 1))
+                  if(!harmdb_casecmp(names + stations[hash[k] - 1].name, name))
+                  {
+                        pst = &stations[hash[k] - 1];
+                        break;
+                  }
+      }
+      for(int i = 0 ; !pst && i < h.num_stations ; i++)
+            if(!slackcmp((char *)names + stations[i].name, (char *)name))
+                  pst = &stations[i];
+      if(!pst)
+            return NULL;
+
+      Station_Data *psd = new Station_Data;
+      const char *sname = names + pst->name;
+      psd->station_name = (char *)malloc(strlen(sname) + 1);
+      strcpy(psd->station_name, sname);
+      psd->station_type = pst->type;
+      psd->meridian = pst->meridian;
+      memcpy(psd->tzfile, pst->tzfile, sizeof psd->tzfile);
+      psd->DATUM = pst->DATUM;
+      memcpy(psd->unit, pst->unit, sizeof psd->unit);
+      figure_units(psd);
+
+      const double *harm = (const double *)(data + pst->harm);
+      psd->amplitude = (double *)malloc(num_csts * sizeof(double));
+      psd->epoch     = (double *)malloc(num_csts * sizeof(double));
+      memcpy(psd->amplitude, harm, num_csts * sizeof(double));
+      memcpy(psd->epoch, harm + num_csts, num_csts * sizeof(double));
+      return psd;
 }
 
 
 /* Figure out max amplitude over all the years in the node factors table. */
 /* This function by Geoffrey T. Dairiki */
-void TCMgr::figure_amplitude ()
+double TCMgr::figure_amplitude (Station_Data *psd) const
 {
   int       i, a;
+  double    amplitude = 0.0;
 
-  if (amplitude == 0.0) {
-      for (i = 0; i < num_nodes; i++) {
-         double year_amp = 0.0;
+  for (i = 0; i < num_nodes; i++) {
+     double year_amp = 0.0;
 
-         for (a=0; a < num_csts; a++)
-               year_amp += pmsd->amplitude[a] * cst_nodes[a][i];
-         if (year_amp > amplitude)
-               amplitude = year_amp;
-      }
+     for (a=0; a < num_csts; a++)
+           year_amp += psd->amplitude[a] * cst_nodes[a][i];
+     if (year_amp > amplitude)
+           amplitude = year_amp;
+  }
+  return amplitude;
+}
 
-/*
-      // Figure other, related global values (DWF)
-      absmax = DATUM + BOGUS_amplitude(1.0);
-      absmin = DATUM - BOGUS_amplitude(1.0);
-
-      absmax = htleveloff + hlevelmult * absmax;
-      absmin = ltleveloff + llevelmult * absmin;
-      if (absmax <= absmin)
-      barf (MAXBELOWMIN);
-      fakedatum = (absmax + absmin) / 2.0;
-      fakeamplitude = (absmax - absmin) / 2.0;
-      if (fabs (fakedatum) >= 100.0 || fakeamplitude >= 100.0)
-        fprintf (stderr, "Tidelib warning:  tidal range out of normal bounds\n");
-*/
-    }
+TideStation::~TideStation()
+{
+  for (int i = 0; i < num_years; i++)
+      delete years[i].load();
 }
 
 /* Figure out normalized multipliers for constituents for a particular
-   year.  Save amplitude for drawing unit lines. */
-void TCMgr::figure_multipliers ()
+   year. */
+void TCMgr::figure_multipliers (const TideStation *ps, TideYear &y) const
 {
   int a;
+  const Station_Data *pmsd = ps->pmsd;
+
+  /* Most stations use a small part of the constituents in the harmonics
+     file, so only those with an amplitude are packed. The meridian and
+     the equilibrium arguments for the year go into the phase. */
+  y.amp.reserve(num_csts);
+  y.speed.reserve(num_csts);
+  y.phase.reserve(num_csts);
+  for (a = 0; a < num_csts; a++) {
+      double mpy = pmsd->amplitude[a] * cst_nodes[a][y.year-first_year] / ps->amplitude;  // BOGUS_amplitude?
+      if (mpy == 0.0)
+          continue;
+      y.amp.push_back(mpy);
+      y.speed.push_back(cst_speeds[a]);
+      y.phase.push_back(cst_speeds[a] * pmsd->meridian +
+                        cst_epochs[a][y.year-first_year] - pmsd->epoch[a]);
+  }
+}
 
-  figure_amplitude();
-  for (a = 0; a < num_csts; a++)
-      work[a] = pmsd->amplitude[a] * cst_nodes[a][year-first_year] / amplitude;  // BOGUS_amplitude?
-//  if (hincmagic)
-//      pick_hinc ();
+/* The tables of a station for a year, made the first time they are
+   wanted.  Years outside the node factors table use the nearest one. */
+const TideYear *TCMgr::year_tables (const TideStation *ps, int year) const
+{
+  if (year < first_year)
+      year = first_year;
+  else if (year >= first_year + ps->num_years)
+      year = first_year + ps->num_years - 1;
+
+  std::atomic<const TideYear *> &slot = ps->years[year - first_year];
+  const TideYear *py = slot.load(std::memory_order_acquire);
+  if (py)
+      return py;
+
+  TideYear *pnew = new TideYear;
+  pnew->year = year;
+  pnew->epoch = year_epoch (year);
+  figure_multipliers (ps, *pnew);
+
+  /* Another thread may have made them meanwhile, keep the first */
+  if (slot.compare_exchange_strong(py, pnew, std::memory_order_acq_rel))
+  {
+      ps->table_bytes += sizeof *pnew + 3 * pnew->amp.size() * sizeof(double);
+      return pnew;
+  }
+  delete pnew;
+  return py;
 }
 
-/* Re-initialize for a different year */
-void TCMgr::happy_new_year (int new_year)
+/* Initialize a context for a station and year */
+void TCMgr::happy_new_year (const TideStation *ps, int new_year, TideContext &c) const
 {
-  year = new_year;
-  figure_multipliers ();
-  set_epoch (year, num_epochs, first_year);
+  c.station = ps;
+  c.tables = year_tables (ps, new_year);
+  c.year = c.tables->year;
+  c.epoch = c.tables->epoch;
 }
 
 
-/* Calculate time_t of the epoch. */
-void TCMgr::set_epoch (int year, int num_epochs, int first_year)
+/* c, or cy made for the year of t when c is for another.  The callers
+   make c for the year a query starts in, which it may run out of. */
+const TideContext &TCMgr::year_context (const TideContext &c, time_t t, TideContext &cy) const
 {
-  struct tm ht;
+  if (t >= c.epoch ? c.year + 1 >= first_year + num_epochs || t < year_epoch (c.year + 1)
+                   : c.year == first_year)
+      return c;
+  happy_new_year (c.station, yearoftimet (t), cy);
+  return cy;
+}
+
 
-  ht.tm_year = year - 1900;
-  ht.tm_sec = ht.tm_min = ht.tm_hour = ht.tm_mon = 0;
-  ht.tm_mday = 1;
-  epoch = tm2gmt (&ht);
+/* Calculate time_t of the epoch, the start of the year in UTC. */
+time_t TCMgr::year_epoch (int year) const
+{
+  /* Days from 1970 with the Gregorian leap years, as tm2gmt would find */
+  long y = year - 1;
+  long days = 365L * (year - 1970) + (y / 4 - 1969 / 4)
+              - (y / 100 - 1969 / 100) + (y / 400 - 1969 / 400);
+  return (time_t) days * 86400;
 }
 
 /* This idiotic function is needed by the new tm2gmt. */
 #define compare_int(a,b) (((int)(a))-((int)(b)))
-int TCMgr::compare_tm (struct tm *a, struct tm *b) {
+int TCMgr::compare_tm (struct tm *a, struct tm *b) const {
   int temp;
   /* printf ("A is %d:%d:%d:%d:%d:%d   B is %d:%d:%d:%d:%d:%d\n",
     a->tm_year+1900, a->tm_mon+1, a->tm_mday, a->tm_hour,
@@ -1274,11 +1782,11 @@ int TCMgr::compare_tm (struct tm *a, struct tm *b) {
    fixing it.  As a result, we have to use idiotic kludges and workarounds
    like this one.
 */
-time_t TCMgr::tm2gmt (struct tm *ht)
+time_t TCMgr::tm2gmt (struct tm *ht) const
 {
   time_t guess, newguess, thebit;
   int loopcounter, compare;
-  struct tm *gt;
+  struct tm *gt, gtbuf;
 
   /*
       "A thing not worth doing at all is not worth doing well."
@@ -1302,7 +1810,7 @@ time_t TCMgr::tm2gmt (struct tm *ht)
 
   for (; loopcounter; loopcounter--) {
     newguess = guess | thebit;
-    gt = gmtime(&newguess);
+    gt = gmtime_ts(&newguess, &gtbuf);
     if(NULL != gt)
     {
       compare = compare_tm (gt, ht);
@@ -1334,10 +1842,28 @@ void TCMgr::allocate_cst ()
   cst_speeds = (double *) malloc (num_csts * sizeof (double));
 //  loc_amp = (double *) malloc (num_csts * sizeof (double));
 //  loc_epoch = (double *) malloc (num_csts * sizeof (double));
-  work = (double *) malloc (num_csts * sizeof (double));
 }
 
 
+/* Set the BOGUS flag and the printable units from the station's units */
+void TCMgr::figure_units (Station_Data *psd)
+{
+  psd->have_BOGUS = (findunit(psd->unit) != -1) && (known_units[findunit(psd->unit)].type == BOGUS);
+
+  int unit_c;
+  if (psd->have_BOGUS)
+    unit_c = findunit("knots");
+  else
+    unit_c = findunit(psd->unit);
+
+  psd->units_conv[0] = psd->units_abbrv[0] = 0;
+  if (unit_c != -1)
+  {
+    strcpy (psd->units_conv,       known_units[unit_c].name);
+    strcpy (psd->units_abbrv,      known_units[unit_c].abbrv);
+  }
+}
+
 /* Find a unit; returns -1 if not found. */
 int TCMgr::findunit (const char *unit) {
   int a;
@@ -1373,7 +1899,6 @@ void TCMgr::free_cst()
   free(cst_speeds);
 //  free(loc_amp);
 //  free(loc_epoch);
-  free(work);
 }
 void TCMgr::free_nodes()
  {
@@ -1798,8 +2323,8 @@ char stz[80];
 #ifdef __WXMSW__
 //#error Added extra \r to format strings... check it, or convert to wxTextFile
 #endif
-      pIDX->pref_sta_data = NULL;                     // no reference data yet
       pIDX->IDX_Useable = 1;                          // but assume data is OK
+      pIDX->IDX_flood_dir = pIDX->IDX_ebb_dir = 0;    // none, unless on a ^ line
 
       pIDX->IDX_tzname = NULL;
       if (7 != sscanf( index_line, "%c%s%lf%lf%d:%d%*c%[^\r\n]",
@@ -1994,7 +2519,6 @@ harmonic_file_entry *pHarmonic, *pHarmonic_prev;
                   pIDX->IDX_next    = NULL;
                   pIDX->IDX_rec_num = num_IDX;
                   pIDX->IDX_tried_once = 0;               // master station search control
-                  pIDX->Valid15 = 0;
 
                   if (build_IDX_entry(pIDX))
                      printf("Index file error at entry %d!\n", num_IDX);
@@ -2337,10 +2861,148 @@ load_data ()
 //    TIDELIB
 //-----------------------------------------------------------------------------------
 
+#ifdef __SSE2__
+/* cos(x + q * pi/2) for two lanes.  x is reduced by the nearest multiple
+   of pi/2 in three parts (Cody-Waite) and the Cephes sin and cos
+   polynomials are used on [-pi/4, pi/4].  Within a few ulp of cos() for
+   the arguments of a tide year, which stay well under 1e6 radians. */
+static inline __m128d cos_pd (__m128d x, int q)
+{
+  const __m128d sign = _mm_set1_pd(-0.0);
+  const __m128i one = _mm_set1_epi32(1), two = _mm_set1_epi32(2);
+
+  __m128i j = _mm_cvtpd_epi32(_mm_mul_pd(x, _mm_set1_pd(2.0 / M_PI)));
+  __m128d y = _mm_cvtepi32_pd(j);
+  x = _mm_sub_pd(x, _mm_mul_pd(y, _mm_set1_pd(1.57079625129699707031E0)));
+  x = _mm_sub_pd(x, _mm_mul_pd(y, _mm_set1_pd(7.54978941586159635336E-8)));
+  x = _mm_sub_pd(x, _mm_mul_pd(y, _mm_set1_pd(5.39030285815811905290E-15)));
+
+  /* Quadrant: odd takes the sine, 1 and 2 are negative */
+  j = _mm_add_epi32(j, _mm_set1_epi32(q));
+  j = _mm_shuffle_epi32(j, _MM_SHUFFLE(1, 1, 0, 0));
+  __m128d swap = _mm_castsi128_pd(_mm_cmpeq_epi32(_mm_and_si128(j, one), one));
+  __m128d neg = _mm_castsi128_pd(
+      _mm_cmpeq_epi32(_mm_and_si128(_mm_add_epi32(j, one), two), two));
+
+  __m128d z = _mm_mul_pd(x, x);
+  __m128d s = _mm_set1_pd(1.58962301576546568060E-10);
+  s = _mm_add_pd(_mm_mul_pd(s, z), _mm_set1_pd(-2.50507477628578072866E-8));
+  s = _mm_add_pd(_mm_mul_pd(s, z), _mm_set1_pd(2.75573136213857245213E-6));
+  s = _mm_add_pd(_mm_mul_pd(s, z), _mm_set1_pd(-1.98412698295895385996E-4));
+  s = _mm_add_pd(_mm_mul_pd(s, z), _mm_set1_pd(8.33333333332211858878E-3));
+  s = _mm_add_pd(_mm_mul_pd(s, z), _mm_set1_pd(-1.66666666666666307295E-1));
+  s = _mm_add_pd(_mm_mul_pd(_mm_mul_pd(s, z), x), x);
+  __m128d c = _mm_set1_pd(-1.13585365213876817300E-11);
+  c = _mm_add_pd(_mm_mul_pd(c, z), _mm_set1_pd(2.08757008419747316778E-9));
+  c = _mm_add_pd(_mm_mul_pd(c, z), _mm_set1_pd(-2.75573141792967388112E-7));
+  c = _mm_add_pd(_mm_mul_pd(c, z), _mm_set1_pd(2.48015872888517045348E-5));
+  c = _mm_add_pd(_mm_mul_pd(c, z), _mm_set1_pd(-1.38888888888730564116E-3));
+  c = _mm_add_pd(_mm_mul_pd(c, z), _mm_set1_pd(4.16666666666665929218E-2));
+  c = _mm_add_pd(_mm_mul_pd(_mm_mul_pd(c, z), z),
+                 _mm_sub_pd(_mm_set1_pd(1.0), _mm_mul_pd(_mm_set1_pd(0.5), z)));
+
+  __m128d r = _mm_or_pd(_mm_and_pd(swap, s), _mm_andnot_pd(swap, c));
+  return _mm_xor_pd(r, _mm_and_pd(neg, sign));
+}
+#endif
+
+/* Sum of amp * speed^deriv * cos(speed * x + phase + deriv * pi/2) over
+   the constituents of c, x being the seconds from the epoch.  Two
+   constituents at a time with SSE2. */
+double harmonic_sum (const TideContext &c, double x, int deriv)
+{
+  const TideYear &y = *c.tables;
+  const double *amp = y.amp.data(), *speed = y.speed.data(), *phase = y.phase.data();
+  int n = y.amp.size(), a = 0, b;
+  double sum = 0.0;
+
+#ifdef __SSE2__
+  __m128d acc = _mm_setzero_pd(), vx = _mm_set1_pd(x);
+  for (; a + 2 <= n; a += 2)
+    {
+      __m128d w = _mm_loadu_pd(speed + a);
+      __m128d arg = _mm_add_pd(_mm_mul_pd(w, vx), _mm_loadu_pd(phase + a));
+      __m128d term = _mm_mul_pd(_mm_loadu_pd(amp + a), cos_pd(arg, deriv));
+      for (b = deriv; b > 0; b--)
+          term = _mm_mul_pd(term, w);
+      acc = _mm_add_pd(acc, term);
+    }
+  double lanes[2];
+  _mm_storeu_pd(lanes, acc);
+  sum = lanes[0] + lanes[1];
+#endif
+  for (; a < n; a++)
+    {
+      double term = amp[a] * cos(M_PI / 2.0 * deriv + speed[a] * x + phase[a]);
+      for (b = deriv; b > 0; b--)
+          term *= speed[a];
+      sum += term;
+    }
+  return sum;
+}
+
+/* harmonic_sum(c, x0 + k * dx, 0) for k = 0 .. n-1.  Rather than take a
+   cosine for every sample, each constituent is carried as the phasor
+   amp * exp(i * arg) and turned by exp(i * speed * dx) from one sample
+   to the next.  The phasors are set again from cos() and sin() at the
+   start of every block, which keeps the rounding built up by the
+   rotations to a few hundred ulp, and the block of sums stays in the L1
+   cache.  With SSE2 the two lanes carry samples k and k+1 and are turned
+   by 2 * dx. */
+void harmonic_sums (const TideContext &c, double x0, double dx, int n, double *out)
+{
+  const int BLOCK = 256;
+  const TideYear &y = *c.tables;
+  int nc = y.amp.size();
+
+  for (int base = 0; base < n; base += BLOCK)
+    {
+      int bn = n - base < BLOCK ? n - base : BLOCK;
+      double *o = out + base;
+      for (int k = 0; k < bn; k++)
+          o[k] = 0.0;
+
+      for (int a = 0; a < nc; a++)
+        {
+          double amp = y.amp[a], w = y.speed[a];
+          double arg = w * (x0 + base * dx) + y.phase[a];
+          double zr = amp * cos(arg), zi = amp * sin(arg);   /* re-anchor */
+          double rr = cos(w * dx), ri = sin(w * dx);          /* one step */
+          double t;
+          int k = 0;
+#ifdef __SSE2__
+          if (bn >= 2)
+            {
+              __m128d vzr = _mm_set_pd(zr * rr - zi * ri, zr);
+              __m128d vzi = _mm_set_pd(zr * ri + zi * rr, zi);
+              __m128d vrr = _mm_set1_pd(rr * rr - ri * ri);   /* two steps */
+              __m128d vri = _mm_set1_pd(2.0 * rr * ri);
+              for (; k + 2 <= bn; k += 2)
+                {
+                  _mm_storeu_pd(o + k, _mm_add_pd(_mm_loadu_pd(o + k), vzr));
+                  __m128d vt = _mm_sub_pd(_mm_mul_pd(vzr, vrr), _mm_mul_pd(vzi, vri));
+                  vzi = _mm_add_pd(_mm_mul_pd(vzr, vri), _mm_mul_pd(vzi, vrr));
+                  vzr = vt;
+                }
+              zr = _mm_cvtsd_f64(vzr);
+              zi = _mm_cvtsd_f64(vzi);
+            }
+#endif
+          for (; k < bn; k++)
+            {
+              o[k] += zr;
+              t = zr * rr - zi * ri;
+              zi = zr * ri + zi * rr;
+              zr = t;
+            }
+        }
+    }
+}
+
 
-double TCMgr::time2tide (time_t t)
+double TCMgr::time2tide (const TideContext &c, time_t t) const
 {
-  return time2dt_tide(t, 0);
+  return time2dt_tide(c, t, 0);
 }
 
 
@@ -2349,9 +3011,10 @@ double TCMgr::time2tide (time_t t)
  * For knots^2 current stations, returns square root of (value * amplitude),
  * For normal stations, returns value * amplitude */
 
-double TCMgr::BOGUS_amplitude(double mpy, IDX_entry *pIDX)
+double TCMgr::BOGUS_amplitude(const TideContext &c, double mpy) const
 {
-       Station_Data *pmsd = pIDX->pref_sta_data;
+       Station_Data *pmsd = c.station->pmsd;
+       double amplitude = c.station->amplitude;
 
       if (!pmsd->have_BOGUS)                                // || !convert_BOGUS)   // Added mgh
         return(mpy * amplitude);
@@ -2364,87 +3027,303 @@ double TCMgr::BOGUS_amplitude(double mpy, IDX_entry *pIDX)
 }
 
 /* Calculate the denormalized tide. */
-double TCMgr::time2atide (time_t t, IDX_entry *pIDX)
+double TCMgr::time2atide (const TideContext &c, time_t t) const
+{
+  return BOGUS_amplitude(c, time2tide(c, t)) + c.station->pmsd->DATUM;
+}
+
+
+
+/* Largest value the deriv'th derivative of the normalized tide can take
+   in any year of the node factors table, with a margin for the blending
+   at the new year.  This bounds how fast the tide can turn. */
+double TCMgr::max_dt_tide (const TideStation *ps, int deriv) const
+{
+  double max_dt = 0.0;
+  int a, i, b;
+
+  for (a = 0; a < num_csts; a++) {
+     double node = 0.0, term;
+
+     for (i = 0; i < num_nodes; i++)
+           if (cst_nodes[a][i] > node)
+                 node = cst_nodes[a][i];
+     term = fabs(ps->pmsd->amplitude[a]) * node / ps->amplitude;
+     for (b = deriv; b > 0; b--)
+           term *= cst_speeds[a];
+     max_dt += term;
+  }
+  return 1.1 * max_dt;
+}
+
+/* find_zero(tl, tr, gl, gr, g)
+ *
+ *   The zero of g(t) bracketed by tl and tr, g(tl) = gl and g(tr) = gr
+ *   being of opposite signs, to TIDE_TIME_PREC seconds.  Regula falsi
+ *   with the Illinois modification: the value kept at one end is halved
+ *   when that end is kept twice running, so the bracket closes from both
+ *   sides.  The zero is in (tl, tr] of the last bracket, tl is returned.
+ */
+template <class G>
+static time_t find_zero (time_t tl, time_t tr, double gl, double gr, G g)
+{
+  int side = 0;
+
+  while (tr - tl > TIDE_TIME_PREC)
+    {
+      time_t t = tl + (time_t)((tr - tl) * (gl / (gl - gr)));
+      if (t <= tl)
+          t = tl + 1;
+      else if (t >= tr)
+          t = tr - 1;
+
+      double gt = g(t);
+      if (gt == 0.0)
+          return t;
+      if ((gt < 0.0) == (gl < 0.0)) {
+          tl = t;
+          gl = gt;
+          if (side == -1)
+              gr /= 2.0;
+          side = -1;
+      }
+      else {
+          tr = t;
+          gr = gt;
+          if (side == 1)
+              gl /= 2.0;
+          side = 1;
+      }
+    }
+  return tl;
+}
+
+/* next_zero(c, t, t_end, deriv, target, max_dgg, &rising)
+ *
+ *   First zero after t of g(t) = time2dt_tide(t, deriv) - target, or
+ *   TIDE_BAD_TIME if there is none before t_end.  rising tells if g goes
+ *   from negative to positive there.
+ *
+ *   max_dgg bounds |g''|, so from g and g' at tl, g cannot reach zero
+ *   before tl + tau where
+ *
+ *        |g(tl)| = g'(tl) tau + max_dgg tau^2 / 2
+ *
+ *   taking g' towards the zero as positive.  This is the step taken.
+ *   Far from a zero the steps are hours long, close to one they shrink
+ *   as Newton's would, and the last step of TIDE_TIME_STEP seconds
+ *   brackets it for find_zero.  As with stepping at TIDE_TIME_STEP, no
+ *   zero is missed unless it is that close to the one before.
+ */
+time_t TCMgr::next_zero (const TideContext &c, time_t t, time_t t_end, int deriv, double target, double max_dgg, int *rising) const
 {
-  return BOGUS_amplitude(time2tide(t), pIDX) + pmsd->DATUM;
+  time_t tl = t, tr;
+  double gl, gr, dgl, tau, scale = 1.0;
+  auto g = [&](time_t tt) { return time2dt_tide(c, tt, deriv) - target; };
+
+  /* If we start at a zero, step forward until we're past it. */
+  while ((gl = g(tl)) == 0.0)
+      tl += TIDE_TIME_PREC;
+
+  *rising = gl < 0.0;
+  if (!*rising)
+      scale = -1.0;
+  gl *= scale;
+
+  while (tl < t_end)
+    {
+      dgl = scale * time2dt_tide(c, tl, deriv + 1);
+      tau = -2.0 * gl / (dgl + sqrt(dgl * dgl - 2.0 * max_dgg * gl));
+      if (!(tau >= TIDE_TIME_STEP))
+          tau = TIDE_TIME_STEP;
+      tr = tau < (double)(t_end - tl) ? tl + (time_t)tau : t_end;
+
+      gr = scale * g(tr);
+      if (gr >= 0.0)
+          return find_zero(tl, tr, scale * gl, scale * gr, g);
+      tl = tr;
+      gl = gr;
+    }
+  return TIDE_BAD_TIME;
 }
 
+/* find_events(c, t0, t1, want, events)
+ *
+ *   Adds the tide events from t0 to t1 to events in time order.  want
+ *   selects them with the bits of next_big_event, the level that makes a
+ *   transition being 0, which is slack water at a current station:
+ *       Bit      Meaning
+ *        0       low tide
+ *        1       high tide
+ *        2       falling transition, flood to ebb
+ *        3       rising transition, ebb to flood
+ *
+ *   The high and low tides are the zeros of the first derivative and
+ *   the transitions the zeros of the tide, all found by next_zero.
+ *   Secondary stations have no derivative, see find_events_secondary.
+ */
+void TCMgr::find_events (const TideContext &c, time_t t0, time_t t1, int want, std::vector<TideEvent> &events) const
+{
+  const TideStation *ps = c.station;
+  size_t first = events.size();
+  TideEvent e;
+  int rising;
+  time_t t;
+
+  if (ps->pmsd->station_type != 'C')
+      want &= 3;
+  if (ps->have_offsets) {
+      find_events_secondary(c, t0, t1, want, events);
+      return;
+  }
 
+  if (want & 3) {
+      double max_dddt = ps->max_dt[3];
+      for (t = t0; (t = next_zero(c, t, t1, 1, 0.0, max_dddt, &rising)) != TIDE_BAD_TIME; t += TIDE_TIME_PREC) {
+          e.flags = rising ? 1 : 2;
+          if (!(want & e.flags))
+              continue;
+          e.time = t;
+          e.value = time2atide(c, t);
+          events.push_back(e);
+      }
+  }
+
+  if (want & 12) {
+      /* The normalized tide for a level of 0, undoing BOGUS_amplitude */
+      double level = -ps->pmsd->DATUM;
+      double target = ps->pmsd->have_BOGUS ? level * fabs(level) / ps->amplitude
+                                           : level / ps->amplitude;
+      double max_ddt = ps->max_dt[2];
+      for (t = t0; (t = next_zero(c, t, t1, 0, target, max_ddt, &rising)) != TIDE_BAD_TIME; t += TIDE_TIME_PREC) {
+          e.flags = rising ? 8 : 4;
+          if (!(want & e.flags))
+              continue;
+          e.time = t;
+          e.value = 0.0;
+          events.push_back(e);
+      }
+  }
+
+  std::sort(events.begin() + first, events.end(),
+            [](const TideEvent &a, const TideEvent &b) { return a.time < b.time; });
+}
+
+/* find_events_secondary(c, t0, t1, want, events)
+ *
+ *   find_events for a station with offsets.  time2asecondary moves the
+ *   reference tide in time and level around each high and low water, so
+ *   the tide is sampled every TIDE_SCAN_STEP seconds.  A high or low
+ *   tide between two samples is then closed in on by golden section,
+ *   and a transition by find_zero.
+ */
+#define TIDE_SCAN_STEP (300)
+
+void TCMgr::find_events_secondary (const TideContext &c, time_t t0, time_t t1, int want, std::vector<TideEvent> &events) const
+{
+  const double  golden = 0.3819660112501051;   /* 2 - phi */
+  auto f = [&](time_t t) { return time2asecondary(c, t); };
+  TideEvent e;
+  time_t ta = t0, tb, tc;
+  double fa = f(ta), fb, fc;
+
+  tb = ta + TIDE_SCAN_STEP < t1 ? ta + TIDE_SCAN_STEP : t1;
+  fb = f(tb);
+  while (ta < t1)
+    {
+      if ((want & 12) && (fa < 0.0) != (fb < 0.0)) {
+          e.flags = fa < 0.0 ? 8 : 4;
+          if (want & e.flags) {
+              e.time = fa == 0.0 ? ta : find_zero(ta, tb, fa, fb, f);
+              e.value = 0.0;
+              events.push_back(e);
+          }
+      }
+      if (tb >= t1)
+          break;
+
+      tc = tb + TIDE_SCAN_STEP < t1 ? tb + TIDE_SCAN_STEP : t1;
+      fc = f(tc);
+      if ((want & 3) && ((fb > fa && fb >= fc) || (fb < fa && fb <= fc))) {
+          /* Golden section search of [ta, tc] for the turn near tb */
+          double sign = fb > fa ? 1.0 : -1.0;
+          time_t l = ta, r = tc, x = tb;
+          double fx = sign * fb;
+          while (r - l > TIDE_TIME_PREC) {
+              time_t y = (x - l > r - x) ? x - (time_t)(golden * (x - l))
+                                         : x + (time_t)(golden * (r - x));
+              if (y == x)
+                  break;
+              double fy = sign * f(y);
+              if (fy > fx) {
+                  if (y < x) r = x; else l = x;
+                  x = y;
+                  fx = fy;
+              }
+              else {
+                  if (y < x) l = y; else r = y;
+              }
+          }
+          e.flags = sign > 0 ? 2 : 1;
+          if (want & e.flags) {
+              e.time = x;
+              e.value = sign * fx;
+              events.push_back(e);
+          }
+      }
+      ta = tb; fa = fb;
+      tb = tc; fb = fc;
+    }
+}
 
-/* Next high tide, low tide, transition of the mark level, or some
-   combination.
+/* Next high or low tide of the reference station after *tm, which is
+   set to the time of the event.  want selects them with the bits of
+   find_events.  Returns 0 if there is none within TIDE_MAX_SEARCH
+   seconds, *tm then being moved on by that much.
        Bit      Meaning
         0       low tide
         1       high tide
-        2       falling transition
-        3       rising transition
 */
-int TCMgr::next_big_event (time_t *tm, IDX_entry *pIDX)
-{
-  double p, q;
-  int flags = 0, slope = 0;
-  p = time2atide (*tm, pIDX);
-  *tm += 60;
-  q = time2atide (*tm, pIDX);
-  *tm += 60;
-  if (p < q)
-    slope = 1;
-  while (1) {
-    if ((slope == 1 && q < p) || (slope == 0 && p < q)) {
-      /* Tide event */
-      flags |= (1 << slope);
-    }
-    /* Modes in which to return mark transitions: */
-    /*    -text (no -graph)   */
-    /*    -graph (no -text)   */
-    /*    -ppm                */
-    /*    -gif                */
-    /*    -ps                 */
-
-
-//    if (mark && ((text && !graphmode) || (!text && graphmode)
-//    || ppm || gif || ps))
-//      int marklev = 0;
-#if (0)
-      if(0)
-      if ((p > marklev && q <= marklev) || (p < marklev && q >= marklev)) {
-        /* Transition event */
-        if (p < q)
-          flags |= 8;
-        else
-          flags |= 4;
-        if (!(flags & 3)) {
-          /* If we're incredibly unlucky, we could miss a tide event if we
-             don't check for it here:
-
-                             . <----   Value that would be returned
-                        -----------    Mark level
-                      .           .
-          */
-          p = q;
-          q = time2atide (*tm, pIDX);
-          if ((slope == 1 && q < p) || (slope == 0 && p < q)) {
-            /* Tide event */
-            flags |= (1 << slope);
-          }
-        }
+#define TIDE_MAX_SEARCH (31 * 86400)
+
+int TCMgr::next_big_event (const TideContext &c, time_t *tm, int want, float *value) const
+{
+  time_t t = *tm + TIDE_TIME_PREC, t_end = *tm + TIDE_MAX_SEARCH;
+  int rising, flags;
+
+  for (; (t = next_zero(c, t, t_end, 1, 0.0, c.station->max_dt[3], &rising)) != TIDE_BAD_TIME; t += TIDE_TIME_PREC) {
+      flags = rising ? 1 : 2;
+      if (want & flags) {
+          *tm = t;
+          if (value)
+              *value = time2atide(c, t);
+          return flags;
       }
-#endif
+  }
+  *tm = t_end;
+  return 0;
+}
 
-    if (flags) {
-      *tm -= 60;
-      /* Don't back up over a transition event, but do back up to where the
-         tide changed if possible.  If they happen at the same time, then
-         we're off by a minute on the tide, but if we back it up it will
-         get snagged on the transition event over and over. */
-      if (flags < 4)
-        *tm -= 60;
-      return flags;
-    }
-    p = q;
-    q = time2atide (*tm, pIDX);
-    *tm += 60;
+/* next_big_event for the station itself, with its offsets applied. */
+int TCMgr::next_station_event (const TideContext &c, time_t *tm, int want, float *value) const
+{
+  std::vector<TideEvent> events;
+  time_t t;
+
+  if (!c.station->have_offsets)
+      return next_big_event(c, tm, want, value);
+
+  for (t = *tm + TIDE_TIME_PREC; t < *tm + TIDE_MAX_SEARCH; t += 86400) {
+      find_events_secondary(c, t, t + 86400, want, events);
+      if (!events.empty()) {
+          *tm = events[0].time;
+          if (value)
+              *value = events[0].value;
+          return events[0].flags;
+      }
   }
+  *tm += TIDE_MAX_SEARCH;
+  return 0;
 }
 
 
@@ -2453,17 +3332,15 @@ int TCMgr::next_big_event (time_t *tm, IDX_entry *pIDX)
    summing only the long-term constituents. */
 /* Does not do any blending around year's end. */
 /* This is used only by time2asecondary for finding the mean tide level */
-double TCMgr::time2mean (time_t t)
+double TCMgr::time2mean (const TideContext &c, time_t t) const
 {
   double tide = 0.0;
-  int a, new_year = yearoftimet (t);
-  if (new_year != year)
-    happy_new_year (new_year);
-  for (a=0;a<num_csts;a++) {
-    if (cst_speeds[a] < 6e-6)
-      tide += work[a] *
-        cos (cst_speeds[a] * ((long)(t - epoch) + pmsd->meridian) +
-        cst_epochs[a][year-first_year] - pmsd->epoch[a]);
+  TideContext cy;
+  const TideYear *py = year_context (c, t, cy).tables;
+  for (size_t a=0;a<py->amp.size();a++) {
+    if (py->speed[a] < 6e-6)
+      tide += py->amp[a] *
+        cos (py->speed[a] * (long)(t - py->epoch) + py->phase[a]);
   }
   return tide;
 }
@@ -2474,11 +3351,14 @@ double TCMgr::time2mean (time_t t)
 tide.  The normalized is derived from this, instead of the other way
 around, because the application of height offsets requires the
 denormalized tide. */
-double TCMgr::time2asecondary (time_t t, IDX_entry *pIDX) {
+double TCMgr::time2asecondary (const TideContext &c, time_t t) const {
 
   /* Get rid of the normals. */
-  if (!(have_offsets))
-    return time2atide (t, pIDX);
+  if (!(c.station->have_offsets))
+    return time2atide (c, t);
+
+  IDX_entry *pIDX = c.station->pIDX;
+  Station_Data *pmsd = c.station->pmsd;
 
   {
 /* Intervalwidth of 14 (was originally 13) failed on this input:
@@ -2487,8 +3367,16 @@ double TCMgr::time2asecondary (time_t t, IDX_entry *pIDX) {
 #define intervalwidth 15
 #define stretchfactor 3
 
-    static time_t lowtime=0, hightime=0;
-    static double lowlvl, highlvl; /* Normalized tide levels for MIN, MAX */
+    /* MIN and MAX are kept for each station, and each thread */
+    struct levels {
+      time_t lowtime, hightime;
+      double lowlvl, highlvl; /* Normalized tide levels for MIN, MAX */
+    };
+    static thread_local std::map<unsigned int, levels> station_levels;
+    levels &lv = station_levels.insert(std::make_pair(c.station->serial,
+                                        levels())).first->second;
+    time_t &lowtime = lv.lowtime, &hightime = lv.hightime;
+    double &lowlvl = lv.lowlvl, &highlvl = lv.highlvl;
     time_t T;  /* Adjusted t */
     double S, Z, HI, HS, magicnum;
     time_t interval = 3600 * intervalwidth;
@@ -2507,8 +3395,8 @@ double TCMgr::time2asecondary (time_t t, IDX_entry *pIDX) {
        the zero of the tide function as the mean, but this gave bad
        results around summer and winter for locations with large seasonal
        variations. */
-    Z = time2mean(T);
-    S = time2tide(T) - Z;
+    Z = time2mean(c, T);
+    S = time2tide(c, T) - Z;
 
     /* Find MAX and MIN.  I use the highest high tide and the lowest
        low tide over a 26 hour period, but I allow the interval to stretch
@@ -2544,12 +3432,12 @@ double TCMgr::time2asecondary (time_t t, IDX_entry *pIDX) {
       time_t tt;
       double tl;
       tt = T - interval;
-      next_big_event (&tt, pIDX);
-      lowlvl = time2tide (tt);
+      next_big_event (c, &tt, 3, NULL);
+      lowlvl = time2tide (c, tt);
       lowtime = tt;
       while (tt < T + interval) {
-        next_big_event (&tt, pIDX);
-        tl = time2tide (tt);
+        next_big_event (c, &tt, 3, NULL);
+        tl = time2tide (c, tt);
         if (tl < lowlvl && tt < T + interval) {
           lowlvl = tl;
           lowtime = tt;
@@ -2563,12 +3451,12 @@ double TCMgr::time2asecondary (time_t t, IDX_entry *pIDX) {
       time_t tt;
       double tl;
       tt = T - interval;
-      next_big_event (&tt, pIDX);
-      highlvl = time2tide (tt);
+      next_big_event (c, &tt, 3, NULL);
+      highlvl = time2tide (c, tt);
       hightime = tt;
       while (tt < T + interval) {
-        next_big_event (&tt, pIDX);
-        tl = time2tide (tt);
+        next_big_event (c, &tt, 3, NULL);
+        tl = time2tide (c, tt);
         if (tl > highlvl && tt < T + interval) {
           highlvl = tl;
           hightime = tt;
@@ -2595,7 +3483,7 @@ double TCMgr::time2asecondary (time_t t, IDX_entry *pIDX) {
       magicnum = 0.5 * S / fabs(lowlvl - Z);
 //    T = T - magicnum * (httimeoff - lttimeoff);
     T = T - (time_t)(magicnum * ((pIDX->IDX_ht_time_off * 60) - (pIDX->IDX_lt_time_off * 60)));
-      HI = time2tide(T);
+      HI = time2tide(c, T);
 
 //    Correct the amplitude offsets for BOGUS knot^2 units
       double ht_off, lt_off;
@@ -2612,7 +3500,7 @@ double TCMgr::time2asecondary (time_t t, IDX_entry *pIDX) {
 
 
     /* Denormalize and apply the height offsets. */
-    HI = BOGUS_amplitude(HI, pIDX) + pmsd->DATUM;
+    HI = BOGUS_amplitude(c, HI) + pmsd->DATUM;
     {
       double RH=1.0, RL=1.0, HH=0.0, HL=0.0;
       RH = pIDX->IDX_ht_mpy;
@@ -2683,24 +3571,49 @@ double TCMgr::time2asecondary (time_t t, IDX_entry *pIDX) {
  *  Except for this detail, time2dt_tide(t,0) should return a value
  *  identical to time2tide(t).
  */
- double TCMgr::_time2dt_tide (time_t t, int deriv)
+ double TCMgr::_time2dt_tide (const TideContext &c, time_t t, int deriv) const
 {
-  double dt_tide = 0.0;
-  int a, b;
-  double term, tempd;
+  return harmonic_sum (c, (double)(t - c.epoch), deriv);
+}
 
-  tempd = M_PI / 2.0 * deriv;
-  for (a=0;a<num_csts;a++)
+/* time2tides(t0, step, n, tide)
+ *
+ *   time2dt_tide(t, 0) for the n times t0, t0 + step, ...
+ *   The samples are summed together by harmonic_sums, the few that need
+ *   blending with the year before or after are done by time2dt_tide.
+ */
+void TCMgr::time2tides (const TideContext &c, time_t t0, int step, int n, double *tide) const
+{
+  TideContext cy;
+  int k = 0;
+
+  /* A run of samples for each year the times fall in */
+  while (k < n)
     {
-      term = work[a] *
-          cos(tempd +
-              cst_speeds[a] * ((long)(t - epoch) + pmsd->meridian) +
-              cst_epochs[a][year-first_year] - pmsd->epoch[a]);
-      for (b = deriv; b > 0; b--)
-          term *= cst_speeds[a];
-      dt_tide += term;
+      const TideContext &cc = year_context (c, t0 + (time_t)k * step, cy);
+      time_t next_epoch = TIDE_BAD_TIME;
+      bool   has_prev   = cc.year > first_year;
+      bool   has_next   = cc.year + 1 < first_year + num_epochs;
+      int    m          = n - k;
+
+      if (has_next)
+        {
+          next_epoch = year_epoch(cc.year + 1);
+          time_t left = next_epoch - (t0 + (time_t)k * step);
+          if ((left + step - 1) / step < m)
+              m = (left + step - 1) / step;
+        }
+
+      harmonic_sums (cc, (double)(t0 + (time_t)k * step - cc.epoch), step, m, tide + k);
+
+      for (int e = k + m; k < e; k++)
+        {
+          time_t t = t0 + (time_t)k * step;
+          if ((t - cc.epoch <= TIDE_BLEND_TIME && has_prev)
+              || (next_epoch - t <= TIDE_BLEND_TIME && has_next))
+              tide[k] = time2dt_tide(cc, t, 0);
+        }
     }
-  return dt_tide;
 }
 
 
@@ -2744,45 +3657,38 @@ blend_weight (double x, int deriv)
  * This function does the actual "blending" of the tide
  * and its derivatives.
  */
-double TCMgr::blend_tide (time_t t, unsigned int deriv, int first_year, double blend)
+double TCMgr::blend_tide (const TideContext &c, time_t t, unsigned int deriv, int first_year, double blend) const
 {
   double        fl[TIDE_MAX_DERIV + 1];
   double        fr[TIDE_MAX_DERIV + 1];
-  double *      fp      = fl;
   double        w[TIDE_MAX_DERIV + 1];
   double        fact = 1.0;
   double        f;
   unsigned int  n;
-
+  TideContext   cl, cr;
 
   /*
-   * If we are already happy_new_year()ed into one of the two years
-   * of interest, compute that years tide values first.
+   * Use the context we have for one of the two years of interest,
+   * and make one for the other.
    */
-  if (year == first_year + 1)
-      fp = fr;
-  else if (year != first_year)
-      happy_new_year(first_year);
-  for (n = 0; n <= deriv; n++)
-      fp[n] = _time2dt_tide(t, n);
+  const TideContext *pl = &cl, *pr = &cr;
+  if (c.year == first_year)
+      pl = &c;
+  else
+      happy_new_year(c.station, first_year, cl);
+  if (c.year == first_year + 1)
+      pr = &c;
+  else
+      happy_new_year(c.station, first_year + 1, cr);
 
   /*
-   * Compute tide values for the other year of interest,
+   * Compute tide values for both years,
    *  and the needed values of w(x) and its derivatives.
    */
-  if (fp == fl)
-    {
-      happy_new_year(first_year + 1);
-      fp = fr;
-    }
-  else
-    {
-      happy_new_year(first_year);
-      fp = fl;
-    }
   for (n = 0; n <= deriv; n++)
     {
-      fp[n] = _time2dt_tide(t, n);
+      fl[n] = _time2dt_tide(*pl, t, n);
+      fr[n] = _time2dt_tide(*pr, t, n);
       w[n] = blend_weight(blend, n);
     }
 
@@ -2798,80 +3704,64 @@ double TCMgr::blend_tide (time_t t, unsigned int deriv, int first_year, double b
   return f;
 }
 
-double TCMgr::time2dt_tide (time_t t, int deriv)
+/*
+ * Evaluated in the year of t, whatever the year of c.
+ */
+double TCMgr::time2dt_tide (const TideContext &cq, time_t t, int deriv) const
 {
-  static time_t next_epoch      = TIDE_BAD_TIME; /* next years newyears */
-  static time_t this_epoch      = TIDE_BAD_TIME; /* this years newyears */
-  static int    this_year       = -1;
-  int           new_year;
-      time_t tt = time(NULL);
-      int yott = ((gmtime (&tt))->tm_year) + 1900;
-      new_year = yott;                    //= yearoftimet(t);
-
-  /* Make sure our values of next_epoch and epoch are up to date. */
-  if (new_year != this_year)
-    {
-      if (new_year + 1 < first_year + num_epochs)
-        {
-          set_epoch(new_year + 1, num_epochs, first_year);
-          next_epoch = epoch;
-        }
-      else
-          next_epoch = TIDE_BAD_TIME;
-
-      happy_new_year(this_year = new_year);
-      this_epoch = epoch;
-    }
+  TideContext cy;
+  const TideContext &c   = year_context (cq, t, cy);
+  time_t next_epoch      = TIDE_BAD_TIME; /* next years newyears */
+  time_t this_epoch      = c.epoch;       /* this years newyears */
+  int    this_year       = c.year;
 
+  if (this_year + 1 < first_year + num_epochs)
+      next_epoch = year_epoch(this_year + 1);
 
   /*
    * If we're close to either the previous or the next
    * new years we must blend the two years tides.
    */
   if (t - this_epoch <= TIDE_BLEND_TIME && this_year > first_year)
-      return blend_tide(t, deriv,
+      return blend_tide(c, t, deriv,
                         this_year - 1,
                         (double)(t - this_epoch)/TIDE_BLEND_TIME);
   else if (next_epoch - t <= TIDE_BLEND_TIME
            && this_year + 1 < first_year + num_epochs)
-      return blend_tide(t, deriv,
+      return blend_tide(c, t, deriv,
                         this_year,
                         -(double)(next_epoch - t)/TIDE_BLEND_TIME);
 
   /*
    * Else, we're far enough from newyears to ignore the blending.
    */
-  if (this_year != year)
-      happy_new_year(this_year);
-  return _time2dt_tide(t, deriv);
+  return _time2dt_tide(c, t, deriv);
 }
 
+//    The nearest station of the kinds in types, 0 if none
+int TCMgr::GetNearestStation(double lat, double lon, unsigned types)
+{
+      std::vector<StationHit> hits;
+      station_index.Nearest(lat, lon, 1, types, hits);
+      return hits.empty() ? 0 : hits[0].idx;
+}
+
+//    The nearest tide station whose name starts with prefix, 0 if none
 int TCMgr::GetStationIDXbyName(wxString prefix, double xlat, double xlon, TCMgr *ptcmgr)
-	{
-		  IDX_entry *lpIDX;
-		  int jx = 0;
-		  wxString locn;
-		  double distx = 100000.;
-
-	     // if (prp->m_MarkName.Find(_T("@~~")) != wxNOT_FOUND) {
-		    //tide_form = prp->m_MarkName.Mid(prp->m_MarkName.Find(_T("@~~"))+3);
-
-			for ( int j=1 ; j<ptcmgr->Get_max_IDX() +1 ; j++ ) {
-					lpIDX = ptcmgr->GetIDX_entry ( j );
-					char type = lpIDX->IDX_type;             // Entry "TCtcIUu" identifier
-					wxString locnx ( lpIDX->IDX_station_name, wxConvUTF8 );
-
-					if ( (( type == 't' ) ||  ( type == 'T' ) )   // only Tides
-						&& (locnx.StartsWith(prefix))) {
-							//double brg, dist;
-							//DistanceBearingMercator(xlat, xlon, lpIDX->IDX_lat, lpIDX->IDX_lon, &brg, &dist);
-							//if (dist < distx){
-								//distx = dist;
-								//locn = locnx.Prepend(_T(" @~~"));
-								jx = j;
-							//}
-						}
-			} // end for loop
-		  //} // end if @~~ found in WP
-			return(jx);
-		}
+{
+      std::string pfx(prefix.ToUTF8());
+
+//    Look through the stations nearest first, more of them each time
+      std::vector<StationHit> hits;
+      size_t tried = 0;
+      for(size_t k = 16 ; ; k *= 2)
+      {
+            ptcmgr->station_index.Nearest(xlat, xlon, k, STATION_ALL_TIDES, hits);
+            for(size_t i = tried ; i < hits.size() ; i++)
+                  if(!strncmp(ptcmgr->paIDX[hits[i].idx]->IDX_station_name, pfx.c_str(), pfx.size()))
+                        return hits[i].idx;
+            if(hits.size() < k)
+                  return 0;
+            tried = k;
+      }
+}
@@ -34,6 +34,16 @@
 #ifndef __TCMGR_H__
 #define __TCMGR_H__
 
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "MappedFile.h"
+#include "StationIndex.h"
 
 // ----------------------------------------------------------------------------
 // external C linkages
@@ -82,6 +92,19 @@ typedef struct {
 #define TIDE_TIME_STEP (TIDE_TIME_PREC)
 #define TIDE_BAD_TIME   ((time_t) -1)
 
+/* TIDE_BUCKET
+ *   Step (in seconds) of the values kept by GetTideOrCurrent15, and the
+ * number of days of them kept for each station.
+ */
+#define TIDE_BUCKET (15 * 60)
+#define TIDE_BUCKETS (86400 / TIDE_BUCKET)
+#define TIDE_DAY_SLOTS (4)
+
+/* STATION_CACHE_BYTES
+ *   Default size of the reference station data kept by the MRU cache.
+ */
+#define STATION_CACHE_BYTES (4 * 1024 * 1024)
+
 
 //    class/struct declarations
 
@@ -152,16 +175,11 @@ public:
       int       IDX_ebb_dir;
       int       IDX_tried_once;                // Master station search control
       int       IDX_Useable;
-      int       Valid15;
-      float     Value15;
-      float     Dir15;
-      bool      Ret15;
       bool      b_is_secondary;
       char     *IDX_tzname;                    // Timezone name
       int       IDX_ref_file_num;              // # of reference file where reference station is
       char      IDX_reference_name[MAXNAMELEN];// Name of reference station
       int       IDX_ref_dbIndex;               // tcd index of reference station
-      Station_Data   *pref_sta_data;           // Pointer to the Reference Station Data
 };
 
 typedef struct {
@@ -192,10 +210,110 @@ public:
 };
 
 
-typedef struct{
-      Station_Data      *sta_data;
-      void        *next;
-} mru_entry;
+//----------------------------------------------------------------------------
+//   Tide Evaluation Contexts
+//----------------------------------------------------------------------------
+
+//    The multipliers and epoch of a station for one year of the node
+//    factors table. The constituents with a non zero amplitude are packed
+//    into arrays so that the harmonic sum runs over contiguous memory:
+//          tide(t) = sum amp[i] * cos(speed[i] * (t - epoch) + phase[i])
+class TideYear
+{
+public:
+      int                     year;
+      time_t                  epoch;      // start of the year, UTC
+      std::vector<double>     amp;        // normalized multipliers
+      std::vector<double>     speed;      // radians per second
+      std::vector<double>     phase;      // radians at the epoch
+};
+
+//    A station ready to evaluate: the reference station data and the
+//    offsets of the index entry. Built by TCMgr on first use of the
+//    station and never modified but for its year tables, which are each
+//    made once on first use and published atomically, so any number of
+//    threads may share it. The station cache owns it, and a caller holds
+//    it while evaluating, so it lives until both let it go.
+class TideStation
+{
+public:
+      ~TideStation();
+
+      int               idx;              // of the index entry
+      IDX_entry         *pIDX;
+      Station_Data      *pmsd;
+      std::shared_ptr<Station_Data> hold; // keeps pmsd while the station lives
+      double            amplitude;        // max over the node factor years
+      int               have_offsets;
+      double            max_dt[4];        // bounds of the tide derivatives
+      unsigned int      serial;           // unique over all TCMgr instances
+      int               num_years;        // of the node factors table
+      std::unique_ptr<std::atomic<const TideYear *>[]> years;
+      mutable std::atomic<size_t> table_bytes;  // of the years made so far
+};
+
+
+//    The station cache, most recently used first: the data of a reference
+//    station, keyed by the type and reference name of the index entries
+//    that found it, and the stations loaded on it
+class StationCacheEntry
+{
+public:
+      std::string                   key;
+      std::shared_ptr<Station_Data> data;
+      std::vector<std::shared_ptr<const TideStation> > stations;
+};
+typedef std::list<StationCacheEntry> mru_list;
+
+//    A station and the tables of the year to evaluate it in, which used
+//    to be left in TCMgr by happy_new_year. Each query makes its own, so
+//    queries for different stations or years do not disturb each other.
+class TideContext
+{
+public:
+      const TideStation       *station;
+      const TideYear          *tables;
+      int                     year;
+      time_t                  epoch;      // start of the year, UTC
+};
+
+//    The normalized tide of c and its derivatives x seconds after the
+//    epoch, and the tide at n steps of dx from x0 by phasor rotation.
+//    Used by TCMgr, outside it only by the tests.
+double harmonic_sum (const TideContext &c, double x, int deriv);
+void harmonic_sums (const TideContext &c, double x0, double dx, int n, double *out);
+
+
+//    A day of a station's values at TIDE_BUCKET steps from 00:00 UTC,
+//    worked out together the first time any of them is wanted
+class TideDay
+{
+public:
+      time_t      day;                    // 00:00 UTC, 0 for an empty slot
+      unsigned long used;                 // cache clock when last used
+      bool        ok;
+      float       value[TIDE_BUCKETS];
+      float       dir[TIDE_BUCKETS];
+};
+
+//    The days kept for a station, the least recently used replaced first
+class TideDays
+{
+public:
+      time_t      last;                   // bucket last returned, for bnew_val
+      TideDay     day[TIDE_DAY_SLOTS];
+};
+
+
+//    A high or low tide, or a slack water at a current station, as found
+//    by GetTideEvents. flags has one of the bits of GetNextBigEvent.
+class TideEvent
+{
+public:
+      time_t      time;
+      int         flags;      // 1 low, 2 high, 4 flood to ebb, 8 ebb to flood
+      float       value;      // tide or current at the time
+};
 
 
 //----------------------------------------------------------------------------
@@ -208,16 +326,36 @@ public:
       TCMgr(const wxString &data_dir, const wxString &home_dir);
       ~TCMgr();
       bool IsReady(void){return bTCMReady;}
+
+//    GetTideOrCurrent, GetTideOrCurrent15, GetTideFlowSens, GetHightOrLowTide
+//    and GetNextBigEvent may be called from several threads at once.
       bool GetTideOrCurrent(time_t t, int idx, float &value, float& dir);
+//    The same for n times t0, t0 + step, ... of one station
+      bool GetTideOrCurrent(time_t t0, int step, int n, int idx, float *value, float *dir);
+//    The value at the start of the 15 minutes holding myTime, from a cache
+//    of a few days per station. bnew_val is true if the 15 minutes are not
+//    those of the last call for the station.
       bool GetTideOrCurrent15(wxDateTime myTime, int idx, float &tcvalue, float& dir, bool &bnew_val);
+//    Cache use of GetTideOrCurrent15: calls answered from it, and days
+//    worked out for it
+      void GetCacheStats15(unsigned long &hits, unsigned long &misses);
       bool GetTideFlowSens(time_t t, int sch_step, int idx, float &tcvalue_now, float &tcvalue_prev, bool &w_t);
-      void GetHightOrLowTide(time_t t, int sch_step_1, int sch_step_2, float tide_val ,bool w_t , int idx, float &tcvalue, time_t &tctime);
+//    The next high water after t if w_t (rising), else the next low water
+      void GetHightOrLowTide(time_t t, bool w_t , int idx, float &tcvalue, time_t &tctime);
       int GetStationTimeOffset(IDX_entry *pIDX);
       int GetStationIDXbyName(wxString prefix, double xlat, double xlong, TCMgr *ptcmgr);
+//    The stations nearest a position, or in a box, by kind of station
+      const StationIndex &GetStationIndex(void){ return station_index; }
+      int GetNearestStation(double lat, double lon, unsigned types);
       int GetNextBigEvent(time_t *tm, int idx);
+//    All the high and low tides from t0 to t1 and, at a current station, the
+//    slack waters, in time order
+      bool GetTideEvents(time_t t0, time_t t1, int idx, std::vector<TideEvent> &events);
 
       int Get_max_IDX(){ return max_IDX;}
       IDX_entry *GetIDX_entry(int i){ return paIDX[i];}
+//    Bytes of reference station data to keep loaded, and save for next time
+      void SetStationCacheSize(size_t bytes);
 
 	   wxString GetHarmonicFilename() { return wxString::FromUTF8(hfile_name); }
 private:
@@ -226,14 +364,19 @@ private:
 
       void LoadMRU(void);
       void SaveMRU(void);
-      void AddMRU(Station_Data *psd);
-      void FreeMRU(void);
+      TideDay *find_day15(TideDays *pdays, time_t day);
+      mru_list::iterator FindMRU(const std::string &key);
+      mru_list::iterator AddMRU(const std::string &key, std::shared_ptr<Station_Data> psd);
+      void TrimMRU(void);
+      size_t station_data_size(const Station_Data *psd) const;
+      size_t entry_size(const StationCacheEntry &e) const;
 
 
       int build_IDX_entry(IDX_entry *pIDX );
       int init_index_file(int load_index, int hwnd);
       IDX_entry *get_index_data( short int rec_num );
-      Station_Data *find_or_load_harm_data(IDX_entry *pIDX);
+      mru_list::iterator find_or_load_harm_data(IDX_entry *pIDX);
+      std::shared_ptr<const TideStation> GetStation(int idx);
 
       long IndexFileIO(int func, long value);
       void UserStationFuncs(int func, char *custom_name);
@@ -253,42 +396,59 @@ private:
       void allocate_epochs ();
       void allocate_nodes ();
       void allocate_cst ();
-      void fudge_constituents (Station_Data *psd, IDX_entry *pIDX);
       int findunit (const char *unit);
-      void figure_amplitude ();
-      void figure_multipliers ();
-      void happy_new_year (int new_year);
-      void set_epoch (int year, int num_epochs, int first_year);
-      int compare_tm (struct tm *a, struct tm *b);
+      void figure_units (Station_Data *psd);
+      double figure_amplitude (Station_Data *psd) const;
+      void figure_multipliers (const TideStation *ps, TideYear &y) const;
+      const TideYear *year_tables (const TideStation *ps, int year) const;
+      const TideContext &year_context (const TideContext &c, time_t t, TideContext &cy) const;
+      void happy_new_year (const TideStation *ps, int new_year, TideContext &c) const;
+      time_t year_epoch (int year) const;
+      int compare_tm (struct tm *a, struct tm *b) const;
+
+//    Compiled harmonic database
+      bool OpenHarmonicDB(void);
+      bool CompileHarmonicDB(long stations_start);
+      void LoadIndexFromDB(void);
+      void LoadTablesFromDB(void);
+      Station_Data *find_db_station(const char *name);
 
 //    TideLib
-      double _time2dt_tide (time_t t, int deriv);
-      double blend_tide (time_t t, unsigned int deriv, int first_year, double blend);
-      double time2dt_tide (time_t t, int deriv);
-      int next_big_event (time_t *tm, IDX_entry *pIDX);
-      double time2atide (time_t t, IDX_entry *pIDX);
-      double BOGUS_amplitude(double mpy, IDX_entry *pIDX);
-      double time2tide (time_t t);
-      double time2mean (time_t t);
-      double time2asecondary (time_t t, IDX_entry *pIDX);
+      double _time2dt_tide (const TideContext &c, time_t t, int deriv) const;
+      void time2tides (const TideContext &c, time_t t0, int step, int n, double *tide) const;
+      double blend_tide (const TideContext &c, time_t t, unsigned int deriv, int first_year, double blend) const;
+      double time2dt_tide (const TideContext &c, time_t t, int deriv) const;
+      int next_big_event (const TideContext &c, time_t *tm, int want, float *value) const;
+      int next_station_event (const TideContext &c, time_t *tm, int want, float *value) const;
+      double max_dt_tide (const TideStation *ps, int deriv) const;
+      time_t next_zero (const TideContext &c, time_t t, time_t t_end, int deriv, double target, double max_dgg, int *rising) const;
+      void find_events (const TideContext &c, time_t t0, time_t t1, int want, std::vector<TideEvent> &events) const;
+      void find_events_secondary (const TideContext &c, time_t t0, time_t t1, int want, std::vector<TideEvent> &events) const;
+      double time2atide (const TideContext &c, time_t t) const;
+      double BOGUS_amplitude(const TideContext &c, double mpy) const;
+      double time2tide (const TideContext &c, time_t t) const;
+      double time2mean (const TideContext &c, time_t t) const;
+      double time2asecondary (const TideContext &c, time_t t) const;
 
 //    TimeLib
-      int yearoftimet (time_t t);
-      time_t tm2gmt (struct tm *ht);
+      int yearoftimet (time_t t) const;
+      time_t tm2gmt (struct tm *ht) const;
 
 
       IDX_entry   **paIDX;
       int         max_IDX;
 
 
-      mru_entry   *pmru_head;
-      mru_entry   *pmru_last;
-      mru_entry   *pmru_next;
+      mru_list    mru;
+      std::unordered_map<std::string, mru_list::iterator> mru_map;
+      size_t      mru_limit;                        // bytes of mru entries to keep
 
+      std::vector<mru_list::iterator>     station_entry;  // by IDX index, mru.end() if not loaded
+      std::mutex                          load_mutex;     // guards the station cache
 
-      double                        amplitude;
-      int                           year;
-      time_t                        epoch;
+      std::vector<TideDays *>   days15;           // by IDX index, NULL until used
+      std::mutex                cache15_mutex;    // guards days15 and the counts
+      unsigned long             clock15, hits15, misses15;
 
 
       abbreviation_entry      **abbreviation_list;
@@ -300,6 +460,9 @@ private:
       char                    location[200];
       char                    *indexfile_name;
       char                    *userfile_name;
+      char                    *dbfile_name;
+      MappedFile              harm_db;          // compiled HARMONIC and HARMONIC.IDX
+      StationIndex            station_index;    // the useable stations, by position
       char                    *IDX_reference_name;
       char                    *Izone;
 
@@ -309,18 +472,12 @@ private:
 
       int         num_csts;
       double      *cst_speeds;
-      double      *work;
       int         num_nodes;
       double      **cst_nodes;
       double      **cst_epochs;
       int         num_epochs;
       int         first_year;
 
-      Station_Data      *pmsd;
-
-
-      int   have_offsets;
-
       char  tzfile[80];
 
 
@@ -0,0 +1,144 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  otidalroute Plugin
+ * Author:   Mike Rossiter
+ *
+ ***************************************************************************
+ *   Copyright (C) 2016 by Mike Rossiter  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+
+// Checks that the batch GribRecord::getInterpolatedValues, with its SSE2
+// fast path, gives what the single point routine gives for the same
+// points: cells with all four corners defined, cells with a corner
+// missing, and points that wrap around a world wide grid.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory>
+#include <vector>
+
+#include "GribRecord.h"
+
+// A grid of pseudo random currents, one value in missing undefined if
+// missing is not 0
+class TestRecord : public GribRecord {
+public:
+  TestRecord(double lo1, double la1, double di, double dj, int ni, int nj,
+             unsigned int seed, int missing) {
+    ok = true;
+    m_bfilled = false;
+    hasBMS = false;
+    BMSbits = NULL;
+    Ni = ni;
+    Nj = nj;
+    Di = di;
+    Dj = dj;
+    Lo1 = lo1;
+    La1 = la1;
+    Lo2 = Lo1 + (Ni - 1) * Di;
+    La2 = La1 + (Nj - 1) * Dj;
+    lonMin = Lo1;
+    lonMax = Lo2;
+    latMin = fmin(La1, La2);
+    latMax = fmax(La1, La2);
+
+    int cells = ni * nj;
+    data = new double[cells];
+    srand(seed);
+    for (int k = 0; k < cells; k++)
+      data[k] = missing && rand() % missing == 0
+                    ? GRIB_NOTDEF
+                    : 2.0 * rand() / RAND_MAX - 1.0;
+  }
+};
+
+static int Compare(const char* name, const GribRecord& x, const GribRecord& y,
+                   const std::vector<double>& px,
+                   const std::vector<double>& py) {
+  int n = px.size();
+  std::vector<double> M(n), A(n);
+  std::unique_ptr<bool[]> ok(new bool[n]);
+  GribRecord::getInterpolatedValues(n, &M[0], &A[0], ok.get(), &x, &y, &px[0],
+                                    &py[0]);
+
+  int failed = 0, defined = 0;
+  double maxM = 0, maxA = 0;
+  for (int k = 0; k < n; k++) {
+    double m, a;
+    bool sok = GribRecord::getInterpolatedValues(m, a, &x, &y, px[k], py[k]);
+    if (sok != ok[k]) {
+      if (failed++ < 5)
+        printf("%s: %.6f %.6f defined %d by one, %d by the other\n", name,
+               px[k], py[k], ok[k], sok);
+      continue;
+    }
+    if (!sok) continue;
+
+    defined++;
+    double da = fabs(A[k] - a);
+    if (da > 180) da = 360 - da;
+    maxM = fmax(maxM, fabs(M[k] - m));
+    maxA = fmax(maxA, da);
+    if (fabs(M[k] - m) > 1e-12 || da > 1e-9) {
+      if (failed++ < 5)
+        printf("%s: %.6f %.6f gives %.17g %.17g, not %.17g %.17g\n", name,
+               px[k], py[k], M[k], A[k], m, a);
+    }
+  }
+
+  printf("%s: %d points, %d defined, max error %.3g m/s %.3g degrees, %s\n",
+         name, n, defined, maxM, maxA, failed ? "FAILED" : "ok");
+  return failed;
+}
+
+int main() {
+  int failed = 0;
+  const int n = 100000;
+  std::vector<double> px(n), py(n);
+
+  // A regional grid, north to south as most are
+  srand(7);
+  for (int k = 0; k < n; k++) {
+    px[k] = -10.5 + 21.0 * rand() / RAND_MAX;
+    py[k] = 39.5 + 16.0 * rand() / RAND_MAX;
+  }
+  TestRecord x1(-10, 55, 0.1, -0.1, 200, 150, 1, 0);
+  TestRecord y1(-10, 55, 0.1, -0.1, 200, 150, 2, 0);
+  failed += Compare("all defined", x1, y1, px, py);
+
+  // The same with land, so some cells lack a corner
+  TestRecord x2(-10, 55, 0.1, -0.1, 200, 150, 1, 20);
+  TestRecord y2(-10, 55, 0.1, -0.1, 200, 150, 2, 20);
+  failed += Compare("partly undefined", x2, y2, px, py);
+
+  // A world wide grid from 0 to 359 degrees. Points west of 0 wrap round
+  // to the east, and those past 359 fall in the last column.
+  for (int k = 0; k < n; k++) {
+    px[k] = -3.0 + 366.0 * rand() / RAND_MAX;
+    py[k] = -80.0 + 160.0 * rand() / RAND_MAX;
+  }
+  TestRecord x3(0, 80, 1, -1, 360, 161, 3, 50);
+  TestRecord y3(0, 80, 1, -1, 360, 161, 4, 50);
+  failed += Compare("wrap around", x3, y3, px, py);
+
+  return failed ? 1 : 0;
+}
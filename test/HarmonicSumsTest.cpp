@@ -0,0 +1,99 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  otidalroute Plugin
+ * Author:   Mike Rossiter
+ *
+ ***************************************************************************
+ *   Copyright (C) 2016 by Mike Rossiter  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+
+
+// Checks harmonic_sums, which turns a phasor per constituent from one
+// sample to the next, against harmonic_sum, which takes the cosine of
+// every term, for a year of samples at 1 minute, 15 minute and 1 hour
+// steps.
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include <wx/wx.h>
+
+#include "tcmgr.h"
+
+// A year of pseudo random constituents at tidal speeds, with a slow
+// annual one as the Sa of the harmonics files
+static void MakeYear(TideYear &y, int n, unsigned int seed) {
+  srand(seed);
+  y.year = 2026;
+  y.epoch = 0;
+  for (int a = 0; a < n; a++) {
+    y.amp.push_back((double)rand() / RAND_MAX);
+    y.speed.push_back(a == 0 ? 1.99e-7 : 1.2e-3 * rand() / RAND_MAX);
+    y.phase.push_back(2.0 * M_PI * rand() / RAND_MAX);
+  }
+}
+
+static int Compare(const TideContext &c, int step, double tol) {
+  int n = 366 * 86400 / step;
+  std::vector<double> out(n);
+  harmonic_sums(c, 0.0, step, n, &out[0]);
+
+  double maxerr = 0.0;
+  for (int k = 0; k < n; k++) {
+    double err = fabs(out[k] - harmonic_sum(c, (double)k * step, 0));
+    if (err > maxerr) maxerr = err;
+  }
+  bool failed = !(maxerr <= tol);
+  printf("%5d s steps: %d samples, max error %.3g, tolerance %.3g, %s\n",
+         step, n, maxerr, tol, failed ? "FAILED" : "ok");
+  return failed;
+}
+
+int main() {
+  TideYear y;
+  MakeYear(y, 37, 11);
+
+  TideContext c;
+  c.station = NULL;
+  c.tables = &y;
+  c.year = y.year;
+  c.epoch = y.epoch;
+
+  // harmonic_sums sets its phasors from cos() and sin() every 256
+  // samples, so each term has taken at most 256 turns of a few ulp each
+  // when it is summed. harmonic_sum rounds the argument of the cosine,
+  // up to speed * one year, to half an ulp of its own. The errors of
+  // the terms are bounded by amp times the sum of the two.
+  double tol = 0.0;
+  for (size_t a = 0; a < y.amp.size(); a++) {
+    double arg = y.speed[a] * 366 * 86400 + y.phase[a];
+    tol += y.amp[a] * (256 * 4 * DBL_EPSILON + arg * DBL_EPSILON / 2);
+  }
+
+  int failed = 0;
+  failed += Compare(c, 60, tol);
+  failed += Compare(c, 900, tol);
+  failed += Compare(c, 3600, tol);
+  return failed ? 1 : 0;
+}